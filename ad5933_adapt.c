@@ -0,0 +1,297 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_adapt.c 
+ *
+ * @brief Adaptive coarse to fine sweeps
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ad5933_adapt.h"
+#include "ad5933_calc.h"
+
+/**
+ * @brief Magnitude and phase of a result point
+ *
+ * A failed point has no data, and a point measured on another setting
+ * than the calibration table can not be corrected with it.
+ *
+ * @param a_adapt_p a adaptive sweep
+ * @param a_index a result index
+ * @param a_mag_p a magnitude result
+ * @param a_phase_p a phase result in 0.01 degree
+ *
+ * @return 0 when the point has no usable data
+ */
+static unsigned char ad5933_adapt_point( const ad5933_adapt* a_adapt_p, unsigned int a_index, long* a_mag_p, short* a_phase_p ) {
+
+	const ad5933_record* record = &a_adapt_p->records_p[a_index];
+	ad5933_impedance z;
+
+	if(record->status & AD5933_REC_FAILED) {
+		return 0;
+	}
+
+	if(a_adapt_p->cal_p) {
+		if(record->setting != a_adapt_p->cal_p->setting) {
+			return 0;
+		}
+		ad5933_cal_impedance(a_adapt_p->cal_p, record, &z);
+		ad5933_cal_impedance(a_adapt_p->cal_p, record, &z);
+
+		//Halved to stay inside long
+		*a_mag_p = (long)(z.magnitude >> 1);
+		*a_phase_p = z.phase;
+	}
+	else {
+		*a_mag_p = ad5933_calc_magnitude(record->real, record->imaginary);
+		*a_phase_p = ad5933_calc_phase(record->real, record->imaginary);
+	}
+
+	return 1;
+}
+
+/**
+ * @brief Phase difference brought in -180 to 180 degree
+ */
+static long ad5933_adapt_wrap( long a_diff ) {
+
+	if(a_diff > AD5933_PHASE_180) {
+		a_diff -= 2 * AD5933_PHASE_180;
+	}
+	else if(a_diff < -AD5933_PHASE_180) {
+		a_diff += 2 * AD5933_PHASE_180;
+	}
+
+	return a_diff;
+}
+
+/**
+ * @brief Linear interpolation, a_weight in 1/256
+ */
+static long ad5933_adapt_lerp( long a_from, long a_to, unsigned int a_weight ) {
+
+	long diff = a_to - a_from;
+
+	return a_from + (diff / 256) * (long)a_weight + ((diff % 256) * (long)a_weight) / 256;
+}
+
+/**
+ * @brief Distance of a point from the line through its neighbours
+ *
+ * @param a_adapt_p a adaptive sweep
+ * @param a_index a result index
+ *
+ * @return largest of the magnitude and phase distances in tolerances, 0 at the ends
+ * or next to a point without usable data
+ */
+static unsigned int ad5933_adapt_bend( const ad5933_adapt* a_adapt_p, unsigned int a_index ) {
+
+	const ad5933_record* records = a_adapt_p->records_p;
+	long mag[3], dev, dev_phase;
+	short phase[3];
+	unsigned int weight;
+	unsigned char i;
+
+	if((a_index == 0) || ((a_index + 1) >= a_adapt_p->num)) {
+		return 0;
+	}
+
+	for(i = 0; i < 3; i++) {
+		if(!ad5933_adapt_point(a_adapt_p, a_index + i - 1, &mag[i], &phase[i])) {
+			return 0;
+		}
+	}
+
+	weight = ((records[a_index].frequency_code - records[a_index - 1].frequency_code) << 8) /
+		(records[a_index + 1].frequency_code - records[a_index - 1].frequency_code);
+
+	dev = labs(mag[1] - ad5933_adapt_lerp(mag[0], mag[2], weight)) / ((mag[1] >> AD5933_ADAPT_MAG_SHIFT) + 1);
+
+	//Neighbours taken relative to the point, across the +-180 degree wrap
+	dev_phase = labs(ad5933_adapt_lerp(ad5933_adapt_wrap((long)phase[0] - phase[1]), ad5933_adapt_wrap((long)phase[2] - phase[1]), weight)) / AD5933_ADAPT_PHASE_TOL;
+
+	if(dev_phase > dev) {
+		dev = dev_phase;
+	}
+
+	return (dev > 0xfffe) ? 0xfffe : (unsigned int)dev;
+}
+
+/**
+ * @brief Feature score of the interval after a result point
+ *
+ * @param a_adapt_p a adaptive sweep
+ * @param a_index a result index
+ *
+ * @return 0xffff on a phase sign change, the largest bend of its ends otherwise, 0 when too narrow
+ */
+static unsigned int ad5933_adapt_score( const ad5933_adapt* a_adapt_p, unsigned int a_index ) {
+
+	const ad5933_record* records = a_adapt_p->records_p;
+	unsigned int low, high;
+	long mag;
+	short phase_low, phase_high;
+
+	//Room for one more point at the narrowest step
+	if((records[a_index + 1].frequency_code - records[a_index].frequency_code) < (2 * a_adapt_p->min_step)) {
+		return 0;
+	}
+
+	//Phase crossing zero, not the wrap at 180 degree
+	if(ad5933_adapt_point(a_adapt_p, a_index, &mag, &phase_low) && ad5933_adapt_point(a_adapt_p, a_index + 1, &mag, &phase_high) &&
+		((phase_low < 0) != (phase_high < 0)) && (abs(phase_low) < AD5933_PHASE_180 / 2) && (abs(phase_high) < AD5933_PHASE_180 / 2)) {
+		return 0xffff;
+	}
+
+	low = ad5933_adapt_bend(a_adapt_p, a_index);
+	high = ad5933_adapt_bend(a_adapt_p, a_index + 1);
+
+	return (low > high) ? low : high;
+}
+
+/**
+ * @brief Number the result in frequency order
+ *
+ * @param a_adapt_p a adaptive sweep
+ *
+ */
+static void ad5933_adapt_finish( ad5933_adapt* a_adapt_p ) {
+
+	unsigned int i;
+
+	for(i = 0; i < a_adapt_p->num; i++) {
+		a_adapt_p->records_p[i].index = i;
+	}
+
+	a_adapt_p->state = AD5933_ADAPT_DONE;
+}
+
+void ad5933_adapt_begin( ad5933_adapt* a_adapt_p, ad5933_dev* a_dev, ad5933_record* a_records_p, unsigned int a_size,
+	unsigned long a_start_hz, unsigned long a_stop_hz, unsigned int a_coarse_num, unsigned long a_min_step_hz, const ad5933_cal_table* a_cal_p ) {
+
+	unsigned long span;
+
+	a_adapt_p->records_p = a_records_p;
+	a_adapt_p->size = a_size;
+	a_adapt_p->num = 0;
+	a_adapt_p->cal_p = a_cal_p;
+	a_adapt_p->min_step = ad5933_freq_code(a_min_step_hz);
+	if(a_adapt_p->min_step == 0) {
+		a_adapt_p->min_step = 1;
+	}
+
+	if(a_coarse_num > a_size) {
+		a_coarse_num = a_size;
+	}
+	if(a_coarse_num > (AD5933_NUM_INC_MAX + 1)) {
+		a_coarse_num = AD5933_NUM_INC_MAX + 1;
+	}
+	if(a_coarse_num < 3) {
+		a_adapt_p->state = AD5933_ADAPT_DONE;
+		return;
+	}
+
+	//Coarse sweep over the whole span, its settling covers every sub-sweep
+	ad5933_set_plan(a_dev, NULL, 0, 0);
+	ad5933_set_frequency(a_dev, a_start_hz, (a_stop_hz - a_start_hz) / (a_coarse_num - 1), a_coarse_num - 1);
+
+	//Increment in frequency code, rounded so the last point is the stop code within the rounding
+	span = ad5933_freq_code(a_stop_hz) - a_dev->data.frequency_start;
+	a_dev->data.delta_frequency = (span + ((a_coarse_num - 1) / 2)) / (a_coarse_num - 1);
+	ad5933_config_measure(a_dev);
+
+	a_adapt_p->state = AD5933_ADAPT_SWEEP;
+	a_adapt_p->insert = 0;
+	a_adapt_p->sweep_num = 0;
+	a_adapt_p->sweeps = 1;
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+}
+
+unsigned char ad5933_adapt_proc( ad5933_adapt* a_adapt_p, ad5933_dev* a_dev ) {
+
+	ad5933_record record;
+	ad5933_record* slot;
+	unsigned long width, best_width = 0;
+	unsigned int i, n, score, best = 0, best_score = 0;
+
+	//Sub-sweep points go between the two ends of their interval
+	while((a_adapt_p->state == AD5933_ADAPT_SWEEP) && ad5933_read_records(a_dev, &record, 1)) {
+
+		if(a_adapt_p->num < a_adapt_p->size) {
+			slot = &a_adapt_p->records_p[a_adapt_p->insert + a_adapt_p->sweep_num];
+			memmove(slot + 1, slot, (a_adapt_p->num - (a_adapt_p->insert + a_adapt_p->sweep_num)) * sizeof(ad5933_record));
+			*slot = record;
+			a_adapt_p->num++;
+			a_adapt_p->sweep_num++;
+		}
+
+		//The driver stopped the sweep, keep what was measured
+		if(record.status & AD5933_REC_FAILED) {
+			ad5933_adapt_finish(a_adapt_p);
+		}
+	}
+
+	//Done, or never started
+	if(a_adapt_p->state != AD5933_ADAPT_SWEEP) {
+		return 1;
+	}
+
+	if(a_dev->data.measure_trigger != E_FLAGS_AD5933_IDLE) {
+		return 0;
+	}
+
+	//Largest feature, the wider interval first on a tie
+	for(i = 0; (i + 1) < a_adapt_p->num; i++) {
+		score = ad5933_adapt_score(a_adapt_p, i);
+		width = a_adapt_p->records_p[i + 1].frequency_code - a_adapt_p->records_p[i].frequency_code;
+		if(score && ((score > best_score) || ((score == best_score) && (width > best_width)))) {
+			best = i;
+			best_score = score;
+			best_width = width;
+		}
+	}
+
+	if((best_score == 0) || (a_adapt_p->num >= a_adapt_p->size)) {
+		ad5933_adapt_finish(a_adapt_p);
+		return 1;
+	}
+
+	//Evenly spaced points inside the interval, not closer than the narrowest step
+	n = AD5933_ADAPT_SUB_POINTS;
+	if(n > (best_width / a_adapt_p->min_step) - 1) {
+		n = (best_width / a_adapt_p->min_step) - 1;
+	}
+	if(n > (a_adapt_p->size - a_adapt_p->num)) {
+		n = a_adapt_p->size - a_adapt_p->num;
+	}
+
+	a_dev->data.delta_frequency = best_width / (n + 1);
+	a_dev->data.frequency_start = a_adapt_p->records_p[best].frequency_code + a_dev->data.delta_frequency;
+	a_dev->data.number_of_increments = n - 1;
+	ad5933_config_measure(a_dev);
+
+	a_adapt_p->insert = best + 1;
+	a_adapt_p->sweep_num = 0;
+	a_adapt_p->sweeps++;
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	return 0;
+}
@@ -0,0 +1,122 @@
+#ifndef AD5933_ADAPT_H_R6JD2WKS
+#define AD5933_ADAPT_H_R6JD2WKS
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_adapt.h 
+ *
+ * @brief Adaptive coarse to fine sweeps
+ *
+ * A coarse linear sweep is measured first. The interval with the largest
+ * feature is then filled by a dense linear sub-sweep, and so on until the
+ * point budget is used or no interval has a feature left. A feature is a
+ * point off the straight line through its neighbours, in magnitude or in
+ * phase, or a phase sign change. Intervals are not split below a minimum
+ * step, the resolution of the equivalent dense sweep. All the points are
+ * merged in one frequency ordered record array. Failed points, and with a
+ * calibration table points of another setting, are not used for features.
+ */
+
+#include "dev_ad5933.h"
+#include "ad5933_cal.h"
+
+/* Points of one refinement sub-sweep */
+#ifndef AD5933_ADAPT_SUB_POINTS
+#define AD5933_ADAPT_SUB_POINTS 8
+#endif
+
+/* Magnitude feature, off the line by 1/2^MAG_SHIFT of the magnitude */
+#ifndef AD5933_ADAPT_MAG_SHIFT
+#define AD5933_ADAPT_MAG_SHIFT 6
+#endif
+
+/* Phase feature, off the line by this in 0.01 degree */
+#ifndef AD5933_ADAPT_PHASE_TOL
+#define AD5933_ADAPT_PHASE_TOL 100
+#endif
+
+/* Adaptive sweep states, a zeroed ad5933_adapt is idle */
+#define AD5933_ADAPT_IDLE 0
+#define AD5933_ADAPT_SWEEP 1
+#define AD5933_ADAPT_DONE 2
+
+/**
+ * @brief Adaptive sweep
+ */
+typedef struct _ad5933_adapt {
+
+	// result of the application, sorted by frequency, and the point budget
+	ad5933_record* records_p;
+	unsigned int size;
+	unsigned int num;
+
+	// calibration table, NULL to look for features in the raw DFT data
+	const ad5933_cal_table* cal_p;
+
+	// narrowest sub-sweep step in frequency code
+	unsigned long min_step;
+
+	// state, result position of the running sweep and its points so far
+	unsigned char state;
+	unsigned int insert;
+	unsigned int sweep_num;
+
+	// sweeps run
+	unsigned int sweeps;
+
+} ad5933_adapt;
+
+/**
+ * @brief Start a adaptive sweep with its coarse sweep
+ *
+ * Replaces the frequency plan and the linear sweep of the device. The
+ * settling set for the whole span applies to every sub-sweep.
+ *
+ * @param a_adapt_p a adaptive sweep
+ * @param a_dev a device handle
+ * @param a_records_p a result array
+ * @param a_size a point budget, size of a_records_p
+ * @param a_start_hz a start frequency in Hz
+ * @param a_stop_hz a stop frequency in Hz
+ * @param a_coarse_num a number of coarse points, at least 3
+ * @param a_min_step_hz a narrowest step in Hz
+ * @param a_cal_p a calibration table, NULL for the raw DFT data
+ *
+ */
+void ad5933_adapt_begin( ad5933_adapt* a_adapt_p, ad5933_dev* a_dev, ad5933_record* a_records_p, unsigned int a_size,
+	unsigned long a_start_hz, unsigned long a_stop_hz, unsigned int a_coarse_num, unsigned long a_min_step_hz, const ad5933_cal_table* a_cal_p );
+
+/**
+ * @brief Merge the new records and start the next sub-sweep
+ *
+ * Call it from the main loop next to ad5933_sched_proc. Once done the
+ * records are numbered in frequency order. An idle adaptive sweep is
+ * reported done.
+ *
+ * @param a_adapt_p a adaptive sweep
+ * @param a_dev a device handle
+ *
+ * @return 1 when the adaptive sweep is done
+ */
+unsigned char ad5933_adapt_proc( ad5933_adapt* a_adapt_p, ad5933_dev* a_dev );
+
+
+#endif /* end of include guard: AD5933_ADAPT_H_R6JD2WKS */
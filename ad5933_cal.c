@@ -0,0 +1,405 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include <stddef.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "ad5933_cal.h"
+#include "ad5933_plan.h"
+
+/**
+ * @brief Sum of the bytes in front of a checksum
+ */
+static unsigned int ad5933_cal_checksum( const void* a_data_p, unsigned int a_len ) {
+
+	const unsigned char* data_p = (const unsigned char*)a_data_p;
+	unsigned int i;
+	unsigned int sum = 0;
+
+	for(i = 0; i < a_len; i++) {
+		sum += data_p[i];
+	}
+
+	return sum;
+}
+
+unsigned char ad5933_cal_run( ad5933_dev* a_dev, ad5933_cal_table* a_table_p, unsigned long a_z_cal_ohm ) {
+
+	ad5933_record record;
+	ad5933_cal_entry* entry;
+	unsigned int stride;
+	unsigned int last_index = 0;
+	unsigned char failed = 0;
+
+	//Keep the first, the last and evenly spaced points in between
+	stride = 1;
+	if(a_dev->data.number_of_increments >= AD5933_CAL_POINTS) {
+		stride = (a_dev->data.number_of_increments + AD5933_CAL_POINTS - 2) / (AD5933_CAL_POINTS - 1);
+	}
+
+	a_table_p->magic = 0;
+	a_table_p->setting = AD5933_SETTING(a_dev->cfg, a_dev->rfb);
+	a_table_p->num = 0;
+
+	ad5933_config_measure(a_dev);
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	while(a_dev->data.measure_trigger != E_FLAGS_AD5933_IDLE) {
+
+		ad5933_proc_data(a_dev);
+
+		while(ad5933_read_records(a_dev, &record, 1)) {
+
+			//A failed point has no data and ends the sweep early
+			if(record.status & AD5933_REC_FAILED) {
+				failed = 1;
+				continue;
+			}
+			if((record.index % stride) && !(record.status & AD5933_STAT_SWEEP_DONE)) {
+				continue;
+			}
+			if((a_table_p->num == AD5933_CAL_POINTS) || (a_table_p->num && (record.index == last_index))) {
+				continue;
+			}
+
+			entry = &a_table_p->entry[a_table_p->num++];
+			entry->frequency_code = record.frequency_code;
+			ad5933_calc_gain(&entry->gain, &record, a_z_cal_ohm);
+			last_index = record.index;
+		}
+
+		hal_idle();
+	}
+
+	if(failed) {
+		return 0;
+	}
+
+	if(a_table_p->num) {
+		a_table_p->magic = AD5933_CAL_MAGIC;
+	}
+
+	return a_table_p->num;
+}
+
+void ad5933_cal_store( ad5933_cal_table* a_table_p, unsigned char a_slot ) {
+
+	a_table_p->checksum = ad5933_cal_checksum(a_table_p, offsetof(ad5933_cal_table, checksum));
+
+	hal_eeprom_write(AD5933_CAL_EEPROM_BASE + a_slot * sizeof(ad5933_cal_table), a_table_p, sizeof(ad5933_cal_table));
+}
+
+unsigned char ad5933_cal_load( ad5933_cal_table* a_table_p, unsigned char a_slot ) {
+
+	hal_eeprom_read(AD5933_CAL_EEPROM_BASE + a_slot * sizeof(ad5933_cal_table), a_table_p, sizeof(ad5933_cal_table));
+
+	if((a_table_p->magic != AD5933_CAL_MAGIC) || (a_table_p->num == 0) || (a_table_p->num > AD5933_CAL_POINTS)) {
+		return 0;
+	}
+
+	return (a_table_p->checksum == ad5933_cal_checksum(a_table_p, offsetof(ad5933_cal_table, checksum)));
+}
+
+unsigned char ad5933_cal_find( ad5933_cal_table* a_table_p, unsigned char a_setting ) {
+
+	ad5933_cal_table table;
+	unsigned char slot;
+
+	//Slots are loaded into a scratch table, a miss keeps the caller's table
+	for(slot = 0; slot < AD5933_CAL_SLOTS; slot++) {
+		if(ad5933_cal_load(&table, slot) && (table.setting == a_setting)) {
+			*a_table_p = table;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Linear interpolation, a_weight in 1/256
+ */
+static long ad5933_cal_lerp( long a_from, long a_to, unsigned int a_weight ) {
+
+	long diff = a_to - a_from;
+
+	return a_from + (diff / 256) * (long)a_weight + ((diff % 256) * (long)a_weight) / 256;
+}
+
+void ad5933_cal_gain( const ad5933_cal_table* a_table_p, unsigned long a_freq_code, ad5933_gain* a_gain_p ) {
+
+	const ad5933_cal_entry* low;
+	const ad5933_cal_entry* high;
+	unsigned long num_low, num_high;
+	unsigned int weight;
+	long phase_diff, phase;
+	unsigned char i;
+
+	//No calibration points, a zero numerator gives a zero impedance
+	if(a_table_p->num == 0) {
+		a_gain_p->numerator = 0;
+		a_gain_p->shift = 0;
+		a_gain_p->phase = 0;
+		return;
+	}
+
+	//Clamp outside the calibrated band
+	if(a_freq_code <= a_table_p->entry[0].frequency_code) {
+		*a_gain_p = a_table_p->entry[0].gain;
+		return;
+	}
+	if(a_freq_code >= a_table_p->entry[a_table_p->num - 1].frequency_code) {
+		*a_gain_p = a_table_p->entry[a_table_p->num - 1].gain;
+		return;
+	}
+
+	for(i = 1; a_table_p->entry[i].frequency_code < a_freq_code; i++);
+	low = &a_table_p->entry[i - 1];
+	high = &a_table_p->entry[i];
+
+	weight = ((a_freq_code - low->frequency_code) << 8) / (high->frequency_code - low->frequency_code);
+
+	//Bring both numerators to the larger magnitude shift
+	a_gain_p->shift = (low->gain.shift > high->gain.shift) ? low->gain.shift : high->gain.shift;
+	num_low = low->gain.numerator >> (a_gain_p->shift - low->gain.shift);
+	num_high = high->gain.numerator >> (a_gain_p->shift - high->gain.shift);
+
+	//Interpolate on the unsigned range split in halves to stay inside long
+	a_gain_p->numerator = ((unsigned long)ad5933_cal_lerp(num_low >> 1, num_high >> 1, weight) << 1);
+
+	//Shortest way around the phase circle, the difference spans -360 to 360 degree
+	phase_diff = (long)high->gain.phase - low->gain.phase;
+	if(phase_diff > AD5933_PHASE_180) {
+		phase_diff -= 2 * AD5933_PHASE_180;
+	}
+	else if(phase_diff < -AD5933_PHASE_180) {
+		phase_diff += 2 * AD5933_PHASE_180;
+	}
+
+	//Back inside +-180 degree before narrowing
+	phase = low->gain.phase + (phase_diff * weight) / 256;
+	if(phase > AD5933_PHASE_180) {
+		phase -= 2 * AD5933_PHASE_180;
+	}
+	else if(phase < -AD5933_PHASE_180) {
+		phase += 2 * AD5933_PHASE_180;
+	}
+	a_gain_p->phase = (short)phase;
+}
+
+void ad5933_cal_impedance( const ad5933_cal_table* a_table_p, const ad5933_record* a_record_p, ad5933_impedance* a_z_p ) {
+
+	ad5933_gain gain;
+
+	ad5933_cal_gain(a_table_p, a_record_p->frequency_code, &gain);
+	ad5933_calc_impedance(&gain, a_record_p, a_z_p);
+}
+
+/**
+ * @brief Measure the point after one frequency increment
+ *
+ * @param a_dev a device
+ * @param a_freq_code a frequency code of the measured point
+ * @param a_cycles a number of settling cycles
+ * @param a_record_p a record result
+ *
+ * @return 1 if the point was measured
+ */
+static unsigned char ad5933_settle_point( ad5933_dev* a_dev, unsigned long a_freq_code, unsigned int a_cycles, ad5933_record* a_record_p ) {
+
+	ad5933_record record;
+	unsigned char found = 0;
+
+	a_dev->data.delta_frequency = a_freq_code >> AD5933_SETTLE_STEP_SHIFT;
+	a_dev->data.frequency_start = a_freq_code - a_dev->data.delta_frequency;
+	a_dev->data.number_of_increments = 1;
+	ad5933_set_settling(a_dev, a_cycles);
+
+	ad5933_config_measure(a_dev);
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	while(a_dev->data.measure_trigger != E_FLAGS_AD5933_IDLE) {
+
+		ad5933_proc_data(a_dev);
+
+		while(ad5933_read_records(a_dev, &record, 1)) {
+			if((record.index == 1) && !(record.status & AD5933_REC_FAILED)) {
+				*a_record_p = record;
+				found = 1;
+			}
+		}
+
+		hal_idle();
+	}
+
+	return found;
+}
+
+/**
+ * @brief Two measurements of a point agree within the settling tolerance
+ */
+static unsigned char ad5933_settle_close( const ad5933_record* a_a_p, const ad5933_record* a_b_p ) {
+
+	long diff, mag;
+
+	diff = labs((long)a_a_p->real - a_b_p->real) + labs((long)a_a_p->imaginary - a_b_p->imaginary);
+	mag = labs((long)a_b_p->real) + labs((long)a_b_p->imaginary);
+
+	return (diff <= (mag >> AD5933_SETTLE_TOL_SHIFT) + AD5933_SETTLE_NOISE);
+}
+
+/**
+ * @brief Fewest settling cycles of a point
+ *
+ * @param a_dev a device
+ * @param a_freq_code a frequency code
+ *
+ * @return number of settling cycles, 0 if the point could not be measured
+ */
+static unsigned int ad5933_settle_search( ad5933_dev* a_dev, unsigned long a_freq_code ) {
+
+	ad5933_record short_rec, long_rec;
+	unsigned int low, high, mid;
+	unsigned char i;
+
+	//Double until twice the settling gives the same point
+	high = AD5933_SETTLE_MIN;
+	if(!ad5933_settle_point(a_dev, a_freq_code, high, &short_rec)) {
+		return 0;
+	}
+	for(;;) {
+		if(2 * high > AD5933_SETTLE_MAX) {
+			return AD5933_SETTLE_MAX;
+		}
+		if(!ad5933_settle_point(a_dev, a_freq_code, 2 * high, &long_rec)) {
+			return 0;
+		}
+		if(ad5933_settle_close(&short_rec, &long_rec)) {
+			break;
+		}
+		high *= 2;
+		short_rec = long_rec;
+	}
+
+	if(high == AD5933_SETTLE_MIN) {
+		return high;
+	}
+
+	//Bisect between the last unsettled and the settled cycles
+	low = high / 2;
+	for(i = 0; (i < AD5933_SETTLE_BISECT) && (high - low > 1); i++) {
+		mid = (low + high) / 2;
+		if(!ad5933_settle_point(a_dev, a_freq_code, mid, &short_rec)) {
+			return 0;
+		}
+		if(ad5933_settle_close(&short_rec, &long_rec)) {
+			high = mid;
+		}
+		else {
+			low = mid;
+		}
+	}
+
+	return high;
+}
+
+unsigned char ad5933_settle_tune( ad5933_dev* a_dev, ad5933_settle_profile* a_profile_p, unsigned long a_start_hz, unsigned long a_stop_hz, unsigned char a_bands ) {
+
+	ad5933_platform_data data = a_dev->data;
+	const ad5933_settle_profile* settle_p = a_dev->settle_p;
+	const unsigned long* plan_p = a_dev->plan_p;
+	unsigned int plan_base = a_dev->plan_base;
+	unsigned long period = a_dev->period;
+	unsigned char autorange = a_dev->autorange;
+	unsigned char avg_max = a_dev->avg_max;
+	unsigned long edges[AD5933_SETTLE_BANDS + 1];
+	unsigned int cycles;
+	unsigned char i;
+
+	if(a_bands > AD5933_SETTLE_BANDS) {
+		a_bands = AD5933_SETTLE_BANDS;
+	}
+
+	a_profile_p->magic = 0;
+	a_profile_p->setting = AD5933_SETTING(a_dev->cfg, a_dev->rfb);
+	a_profile_p->num = 0;
+
+	if(a_bands == 0) {
+		return 0;
+	}
+
+	//Single points at the fixed range, outside any plan or schedule
+	a_dev->settle_p = NULL;
+	a_dev->plan_p = NULL;
+	a_dev->plan_base = 0;
+	a_dev->period = 0;
+	a_dev->autorange = 0;
+	a_dev->avg_max = 0;
+
+	ad5933_plan_log(edges, a_bands + 1, a_start_hz, a_stop_hz);
+
+	for(i = 0; i < a_bands; i++) {
+
+		cycles = ad5933_settle_search(a_dev, edges[i + 1]);
+		if(cycles == 0) {
+			break;
+		}
+
+		//Margin for the load and temperature drift
+		cycles += cycles >> 3;
+		if(cycles > AD5933_SETTLE_MAX) {
+			cycles = AD5933_SETTLE_MAX;
+		}
+
+		a_profile_p->band_top[i] = edges[i + 1];
+		a_profile_p->code[i] = AD5933_SETTLE_CODE(cycles);
+		a_profile_p->num++;
+	}
+
+	a_dev->data = data;
+	a_dev->settle_p = settle_p;
+	a_dev->plan_p = plan_p;
+	a_dev->plan_base = plan_base;
+	a_dev->period = period;
+	a_dev->autorange = autorange;
+	a_dev->avg_max = avg_max;
+
+	if(a_profile_p->num == a_bands) {
+		a_profile_p->magic = AD5933_SETTLE_MAGIC;
+	}
+
+	return a_profile_p->num;
+}
+
+void ad5933_settle_store( ad5933_settle_profile* a_profile_p ) {
+
+	a_profile_p->checksum = ad5933_cal_checksum(a_profile_p, offsetof(ad5933_settle_profile, checksum));
+
+	hal_eeprom_write(AD5933_SETTLE_EEPROM_BASE, a_profile_p, sizeof(ad5933_settle_profile));
+}
+
+unsigned char ad5933_settle_load( ad5933_settle_profile* a_profile_p ) {
+
+	hal_eeprom_read(AD5933_SETTLE_EEPROM_BASE, a_profile_p, sizeof(ad5933_settle_profile));
+
+	if((a_profile_p->magic != AD5933_SETTLE_MAGIC) || (a_profile_p->num == 0) || (a_profile_p->num > AD5933_SETTLE_BANDS)) {
+		return 0;
+	}
+
+	return (a_profile_p->checksum == ad5933_cal_checksum(a_profile_p, offsetof(ad5933_settle_profile, checksum)));
+}
@@ -0,0 +1,219 @@
+#ifndef AD5933_CAL_H_T8HB2XMZ
+#define AD5933_CAL_H_T8HB2XMZ
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_cal.h 
+ *
+ * @brief Per frequency AD5933 calibration kept in EEPROM
+ *
+ * A calibration sweep on a known impedance gives the gain factor and the
+ * system phase at up to AD5933_CAL_POINTS frequencies. Tables are stored
+ * in EEPROM slots, one per output range/PGA/ADG849 setting, loaded once at
+ * startup and linearly interpolated at the frequency of every record.
+ */
+
+#include "dev_ad5933.h"
+#include "ad5933_calc.h"
+
+/* Calibration points per table */
+#ifndef AD5933_CAL_POINTS
+#define AD5933_CAL_POINTS 16
+#endif
+
+/* EEPROM slots and their base address */
+#ifndef AD5933_CAL_SLOTS
+#define AD5933_CAL_SLOTS 4
+#endif
+#ifndef AD5933_CAL_EEPROM_BASE
+#define AD5933_CAL_EEPROM_BASE 0x0000
+#endif
+
+/* Valid table marker */
+#define AD5933_CAL_MAGIC 0xa5
+
+/* EEPROM address of the settling profile, after the calibration slots */
+#ifndef AD5933_SETTLE_EEPROM_BASE
+#define AD5933_SETTLE_EEPROM_BASE (AD5933_CAL_EEPROM_BASE + AD5933_CAL_SLOTS * sizeof(ad5933_cal_table))
+#endif
+
+/* Settling search, first and fewest cycles tried and bisection steps */
+#ifndef AD5933_SETTLE_MIN
+#define AD5933_SETTLE_MIN 4
+#endif
+#ifndef AD5933_SETTLE_BISECT
+#define AD5933_SETTLE_BISECT 3
+#endif
+
+/* Settled when within 1/2^TOL_SHIFT of the magnitude plus AD5933_SETTLE_NOISE counts */
+#ifndef AD5933_SETTLE_TOL_SHIFT
+#define AD5933_SETTLE_TOL_SHIFT 7
+#endif
+#ifndef AD5933_SETTLE_NOISE
+#define AD5933_SETTLE_NOISE 8
+#endif
+
+/* Frequency step before the measured point, 1/2^STEP_SHIFT of its code */
+#ifndef AD5933_SETTLE_STEP_SHIFT
+#define AD5933_SETTLE_STEP_SHIFT 3
+#endif
+
+/**
+ * @brief Calibration point
+ */
+typedef struct _ad5933_cal_entry {
+
+	// frequency code of the point
+	unsigned long frequency_code;
+
+	// gain factor and system phase
+	ad5933_gain gain;
+
+} ad5933_cal_entry;
+
+/**
+ * @brief Calibration table of one setting
+ */
+typedef struct _ad5933_cal_table {
+
+	// AD5933_CAL_MAGIC when valid
+	unsigned char magic;
+
+	// AD5933_SETTING of the calibration sweep
+	unsigned char setting;
+
+	// number of points, sorted by frequency
+	unsigned char num;
+
+	ad5933_cal_entry entry[AD5933_CAL_POINTS];
+
+	// sum of the bytes above
+	unsigned int checksum;
+
+} ad5933_cal_table;
+
+/**
+ * @brief Run a calibration sweep on a known impedance
+ *
+ * Sweeps with the device settings and ADG849 path currently selected and
+ * keeps evenly spaced points when the sweep is longer than the table.
+ * A sweep with a failed point leaves the table invalid.
+ *
+ * @param a_dev a device handle
+ * @param a_table_p a calibration table
+ * @param a_z_cal_ohm a calibration impedance in ohm
+ *
+ * @return number of calibration points, 0 if a point failed
+ */
+unsigned char ad5933_cal_run( ad5933_dev* a_dev, ad5933_cal_table* a_table_p, unsigned long a_z_cal_ohm );
+
+/**
+ * @brief Store a calibration table in a EEPROM slot
+ *
+ * @param a_table_p a calibration table
+ * @param a_slot a EEPROM slot
+ *
+ */
+void ad5933_cal_store( ad5933_cal_table* a_table_p, unsigned char a_slot );
+
+/**
+ * @brief Load a calibration table from a EEPROM slot
+ *
+ * @param a_table_p a calibration table
+ * @param a_slot a EEPROM slot
+ *
+ * @return 1 if the slot holds a valid table
+ */
+unsigned char ad5933_cal_load( ad5933_cal_table* a_table_p, unsigned char a_slot );
+
+/**
+ * @brief Load the calibration table of a setting
+ *
+ * a_table_p is only written when a table is found.
+ *
+ * @param a_table_p a calibration table
+ * @param a_setting a AD5933_SETTING key
+ *
+ * @return 1 if a table was found
+ */
+unsigned char ad5933_cal_find( ad5933_cal_table* a_table_p, unsigned char a_setting );
+
+/**
+ * @brief Gain factor and system phase interpolated at a frequency
+ *
+ * A table without points gives a zero gain, so a zero impedance.
+ *
+ * @param a_table_p a calibration table
+ * @param a_freq_code a frequency code
+ * @param a_gain_p a gain factor result
+ *
+ */
+void ad5933_cal_gain( const ad5933_cal_table* a_table_p, unsigned long a_freq_code, ad5933_gain* a_gain_p );
+
+/**
+ * @brief Calibrated impedance of a sweep record
+ *
+ * @param a_table_p a calibration table
+ * @param a_record_p a sweep record
+ * @param a_z_p a impedance result
+ *
+ */
+void ad5933_cal_impedance( const ad5933_cal_table* a_table_p, const ad5933_record* a_record_p, ad5933_impedance* a_z_p );
+
+/**
+ * @brief Find the settling cycles needed over a frequency range
+ *
+ * The range is split in logarithmic bands. At the top of each band a two
+ * point sweep measures the point reached by a frequency increment, the
+ * settling cycles are doubled until a longer settling no longer changes
+ * the result and the edge is then bisected. The profile keeps the cycles
+ * found plus 1/8 margin. Auto-range, averaging, the frequency plan and the
+ * schedule are suspended while tuning; call ad5933_config_measure afterwards.
+ *
+ * @param a_dev a device handle
+ * @param a_profile_p a settling profile result
+ * @param a_start_hz a lowest frequency in Hz
+ * @param a_stop_hz a highest frequency in Hz
+ * @param a_bands a number of bands, up to AD5933_SETTLE_BANDS
+ *
+ * @return number of bands tuned
+ */
+unsigned char ad5933_settle_tune( ad5933_dev* a_dev, ad5933_settle_profile* a_profile_p, unsigned long a_start_hz, unsigned long a_stop_hz, unsigned char a_bands );
+
+/**
+ * @brief Store a settling profile in EEPROM
+ *
+ * @param a_profile_p a settling profile
+ *
+ */
+void ad5933_settle_store( ad5933_settle_profile* a_profile_p );
+
+/**
+ * @brief Load the settling profile from EEPROM
+ *
+ * @param a_profile_p a settling profile
+ *
+ * @return 1 if a valid profile was found
+ */
+unsigned char ad5933_settle_load( ad5933_settle_profile* a_profile_p );
+
+
+#endif /* end of include guard: AD5933_CAL_H_T8HB2XMZ */
@@ -0,0 +1,147 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "ad5933_calc.h"
+
+/* CORDIC steps */
+#define AD5933_CORDIC_STEPS 15
+
+/**
+ * @brief atan(2^-i) in binary angle units, 65536 is a full turn
+ */
+static const unsigned int g_ad5933_cordic_atan[AD5933_CORDIC_STEPS] = {
+	8192, 4836, 2555, 1297, 651, 326, 163, 81, 41, 20, 10, 5, 3, 1, 1
+};
+
+
+unsigned int ad5933_isqrt(unsigned long a_value) {
+
+	unsigned long root = 0;
+	unsigned long bit = 1UL << 30;
+
+	//Digit by digit, two bits of the value per root bit
+	while(bit > a_value) {
+		bit >>= 2;
+	}
+
+	while(bit) {
+		if(a_value >= root + bit) {
+			a_value -= root + bit;
+			root = (root >> 1) + bit;
+		}
+		else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+
+	return (unsigned int)root;
+}
+
+unsigned int ad5933_calc_magnitude(short a_real, short a_imaginary) {
+
+	return ad5933_isqrt((unsigned long)((long)a_real * a_real) + (unsigned long)((long)a_imaginary * a_imaginary));
+}
+
+short ad5933_calc_phase(short a_real, short a_imaginary) {
+
+	long x = (long)a_real << 8;
+	long y = (long)a_imaginary << 8;
+	long t;
+	unsigned int angle = 0;
+	unsigned char i;
+
+	if((x == 0) && (y == 0)) {
+		return 0;
+	}
+
+	//Bring the vector to the right half plane
+	if(x < 0) {
+		x = -x;
+		y = -y;
+		angle = 32768U;
+	}
+
+	//Vectoring mode, rotate the vector onto the x axis
+	for(i = 0; i < AD5933_CORDIC_STEPS; i++) {
+		t = x;
+		if(y > 0) {
+			x += y >> i;
+			y -= t >> i;
+			angle += g_ad5933_cordic_atan[i];
+		}
+		else {
+			x -= y >> i;
+			y += t >> i;
+			angle -= g_ad5933_cordic_atan[i];
+		}
+	}
+
+	//Binary angle to 0.01 degree
+	return (short)(((long)(short)angle * 36000L) >> 16);
+}
+
+void ad5933_calc_gain(ad5933_gain* a_gain_p, const ad5933_record* a_record_p, unsigned long a_z_cal_ohm) {
+
+	unsigned int magnitude = ad5933_calc_magnitude(a_record_p->real, a_record_p->imaginary);
+
+	a_gain_p->shift = 0;
+
+	//Drop magnitude resolution until Zcal * Mcal fits in 32 bits
+	while(magnitude && (a_z_cal_ohm > (0xffffffffUL / magnitude))) {
+		magnitude >>= 1;
+		a_gain_p->shift++;
+	}
+
+	a_gain_p->numerator = a_z_cal_ohm * magnitude;
+	a_gain_p->phase = ad5933_calc_phase(a_record_p->real, a_record_p->imaginary);
+}
+
+void ad5933_calc_impedance(const ad5933_gain* a_gain_p, const ad5933_record* a_record_p, ad5933_impedance* a_z_p) {
+
+	unsigned int magnitude = ad5933_calc_magnitude(a_record_p->real, a_record_p->imaginary) >> a_gain_p->shift;
+	unsigned long quotient;
+	long phase;
+
+	if(magnitude == 0) {
+		a_z_p->magnitude = 0xffffffffUL;
+	}
+	else {
+		//Integer and fraction parts of Zcal * Mcal / M
+		quotient = a_gain_p->numerator / magnitude;
+
+		if(quotient >= (1UL << (32 - AD5933_Z_FRAC_BITS))) {
+			a_z_p->magnitude = 0xffffffffUL;
+		}
+		else {
+			a_z_p->magnitude = (quotient << AD5933_Z_FRAC_BITS) | (((a_gain_p->numerator % magnitude) << AD5933_Z_FRAC_BITS) / magnitude);
+		}
+	}
+
+	//Remove the system phase, the difference spans -360 to 360 degree
+	phase = (long)ad5933_calc_phase(a_record_p->real, a_record_p->imaginary) - a_gain_p->phase;
+
+	if(phase > AD5933_PHASE_180) {
+		phase -= 2 * AD5933_PHASE_180;
+	}
+	else if(phase < -AD5933_PHASE_180) {
+		phase += 2 * AD5933_PHASE_180;
+	}
+
+	a_z_p->phase = (short)phase;
+}
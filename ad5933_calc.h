@@ -0,0 +1,120 @@
+#ifndef AD5933_CALC_H_P4VN9QJD
+#define AD5933_CALC_H_P4VN9QJD
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_calc.h 
+ *
+ * @brief Integer impedance calculation for AD5933 sweep records
+ *
+ * Magnitude, phase and calibrated impedance without floating point. The
+ * magnitude is an integer square root, the phase a 15 step CORDIC and the
+ * impedance follows the datasheet gain factor flow:
+ * |Z| = 1 / (gain factor * magnitude) = Zcal * Mcal / magnitude.
+ */
+
+#include "dev_ad5933.h"
+
+/* Fraction bits of the impedance magnitude, 1/16 ohm resolution */
+#define AD5933_Z_FRAC_BITS 4
+
+/* Phase unit, 0.01 degree */
+#define AD5933_PHASE_180 18000
+
+/**
+ * @brief Gain factor and system phase from a calibration point
+ */
+typedef struct _ad5933_gain {
+
+	// calibration impedance times calibration magnitude
+	unsigned long numerator;
+
+	// magnitude right shift keeping numerator in 32 bits
+	unsigned char shift;
+
+	// system phase in 0.01 degree
+	short phase;
+
+} ad5933_gain;
+
+/**
+ * @brief Calibrated impedance
+ */
+typedef struct _ad5933_impedance {
+
+	// |Z| in 1/16 ohm
+	unsigned long magnitude;
+
+	// phase in 0.01 degree, -18000 to 18000
+	short phase;
+
+} ad5933_impedance;
+
+/**
+ * @brief Integer square root
+ *
+ * @param a_value a value
+ *
+ * @return floor of the square root
+ */
+unsigned int ad5933_isqrt(unsigned long a_value);
+
+/**
+ * @brief DFT magnitude of a real/imaginary pair
+ *
+ * @param a_real a real data
+ * @param a_imaginary a imaginary data
+ *
+ */
+unsigned int ad5933_calc_magnitude(short a_real, short a_imaginary);
+
+/**
+ * @brief DFT phase of a real/imaginary pair
+ *
+ * @param a_real a real data
+ * @param a_imaginary a imaginary data
+ *
+ * @return phase in 0.01 degree
+ */
+short ad5933_calc_phase(short a_real, short a_imaginary);
+
+/**
+ * @brief Gain factor and system phase from a point measured on a known resistor
+ *
+ * @param a_gain_p a gain factor
+ * @param a_record_p a calibration point
+ * @param a_z_cal_ohm a calibration resistor in ohm
+ *
+ */
+void ad5933_calc_gain(ad5933_gain* a_gain_p, const ad5933_record* a_record_p, unsigned long a_z_cal_ohm);
+
+/**
+ * @brief Calibrated impedance of a sweep record
+ *
+ * @param a_gain_p a gain factor
+ * @param a_record_p a sweep record
+ * @param a_z_p a impedance result
+ *
+ */
+void ad5933_calc_impedance(const ad5933_gain* a_gain_p, const ad5933_record* a_record_p, ad5933_impedance* a_z_p);
+
+
+#endif /* end of include guard: AD5933_CALC_H_P4VN9QJD */
@@ -0,0 +1,232 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_plan.c 
+ *
+ * @brief AD5933 frequency plans
+ */
+
+#include "ad5933_plan.h"
+
+/* Fraction bits of the fixed point log2 */
+#define AD5933_PLAN_LOG_FRAC 20
+
+/* 2^(2^-j) for j = 1..AD5933_PLAN_LOG_FRAC, 2.30 fixed point */
+static const unsigned long g_ad5933_plan_exp2[AD5933_PLAN_LOG_FRAC] = {
+	0x5A82799AUL, 0x4C1BF829UL, 0x45CAE0F2UL, 0x42D561B4UL, 0x4166C34CUL,
+	0x40B268FAUL, 0x4058F6A8UL, 0x402C6BE9UL, 0x4016321BUL, 0x400B1818UL,
+	0x40058BCEUL, 0x4002C5D8UL, 0x400162E8UL, 0x4000B173UL, 0x400058B9UL,
+	0x40002C5DUL, 0x4000162EUL, 0x40000B17UL, 0x4000058CUL, 0x400002C6UL
+};
+
+/**
+ * @brief Product of two 2.30 fixed point values below 2
+ *
+ * Built from 16 bit halves in 32 bit arithmetic, the dropped low bits
+ * leave the result up to 3 below the exact product.
+ *
+ * @param a_x a value below 2^31
+ * @param a_y a value below 2^31
+ *
+ * @return product in 2.30 fixed point
+ */
+static unsigned long ad5933_plan_mul30( unsigned long a_x, unsigned long a_y ) {
+
+	unsigned long x_hi = a_x >> 16;
+	unsigned long x_lo = a_x & 0xffff;
+	unsigned long y_hi = a_y >> 16;
+	unsigned long y_lo = a_y & 0xffff;
+
+	return ((x_hi * y_hi) << 2) + ((x_hi * y_lo) >> 14) + ((x_lo * y_hi) >> 14) + ((x_lo * y_lo) >> 30);
+}
+
+/**
+ * @brief log2 of a frequency code
+ *
+ * Bit by bit, squaring the 2.30 mantissa once per fraction bit.
+ *
+ * @param a_code a frequency code, at least 1
+ *
+ * @return log2 with AD5933_PLAN_LOG_FRAC fraction bits
+ */
+static unsigned long ad5933_plan_log2( unsigned long a_code ) {
+
+	unsigned long acc = 0;
+	unsigned long bit;
+
+	//Integer part, leaves the mantissa in [1, 2)
+	while(a_code >= (1UL << 31)) {
+		a_code >>= 1;
+		acc += (1UL << AD5933_PLAN_LOG_FRAC);
+	}
+	while(a_code < (1UL << 30)) {
+		a_code <<= 1;
+		acc -= (1UL << AD5933_PLAN_LOG_FRAC);
+	}
+	acc += (30UL << AD5933_PLAN_LOG_FRAC);
+
+	for(bit = (1UL << (AD5933_PLAN_LOG_FRAC - 1)); bit != 0; bit >>= 1) {
+		a_code = ad5933_plan_mul30(a_code, a_code);
+		if(a_code >= (1UL << 31)) {
+			a_code >>= 1;
+			acc |= bit;
+		}
+	}
+
+	return acc;
+}
+
+/**
+ * @brief Frequency code of a log2
+ *
+ * @param a_log log2 with AD5933_PLAN_LOG_FRAC fraction bits, below 30
+ *
+ * @return rounded frequency code
+ */
+static unsigned long ad5933_plan_exp2( unsigned long a_log ) {
+
+	unsigned long mant = (1UL << 30);
+	unsigned char shift = 30 - (unsigned char)(a_log >> AD5933_PLAN_LOG_FRAC);
+	unsigned char j;
+
+	for(j = 0; j < AD5933_PLAN_LOG_FRAC; j++) {
+		if(a_log & (1UL << (AD5933_PLAN_LOG_FRAC - 1 - j))) {
+			mant = ad5933_plan_mul30(mant, g_ad5933_plan_exp2[j]);
+		}
+	}
+
+	return (mant + (1UL << (shift - 1))) >> shift;
+}
+
+unsigned int ad5933_plan_segment( const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol, unsigned long* a_start_p, unsigned long* a_delta_p ) {
+
+	long lo = 0;
+	long hi = 0xffffffL;
+	long tol2 = 2 * (long)a_tol;
+	long step_lo, step_hi, diff, m_lo, m_hi, top, bottom, v;
+	unsigned int i, j, k;
+
+	for(i = 1; (i < a_num) && (i < AD5933_PLAN_SEGMENT_MAX); i++) {
+
+		//Increments keeping the first point and point i within the tolerance of one line,
+		//the hardware only steps up
+		diff = (long)a_codes_p[i] - (long)a_codes_p[0];
+		if((diff + tol2) < 0) {
+			break;
+		}
+		step_hi = (diff + tol2) / (long)i;
+		step_lo = ((diff - tol2) > 0) ? ((diff - tol2 + i - 1) / (long)i) : 0;
+		if(step_lo < lo) {
+			step_lo = lo;
+		}
+		if(step_hi > hi) {
+			step_hi = hi;
+		}
+
+		//Point i against every other point, the bounds times i - j built up by additions.
+		//step_hi * (i - j) stays below diff + tol2, so below 2^25
+		m_lo = 0;
+		m_hi = 0;
+		for(j = i - 1; (j > 0) && (step_lo <= step_hi); j--) {
+			k = i - j;
+			m_lo += step_lo;
+			m_hi += step_hi;
+			diff = (long)a_codes_p[i] - (long)a_codes_p[j];
+			if(m_hi > (diff + tol2)) {
+				if((diff + tol2) < 0) {
+					step_hi = -1;
+					break;
+				}
+				step_hi = (diff + tol2) / (long)k;
+				m_hi = step_hi * k;
+			}
+			if(m_lo < (diff - tol2)) {
+				step_lo = (diff - tol2 + k - 1) / (long)k;
+				m_lo = step_lo * k;
+			}
+		}
+
+		if(step_lo > step_hi) {
+			break;
+		}
+		lo = step_lo;
+		hi = step_hi;
+	}
+
+	//Middle of the allowed range spreads the error over the segment
+	*a_delta_p = (i > 1) ? (unsigned long)(lo + ((hi - lo) / 2)) : 0;
+
+	//Start code in the middle of the range left by every point of the segment
+	top = 0;
+	bottom = 0;
+	for(j = 0; j < i; j++) {
+		v = (long)a_codes_p[j] - (long)(*a_delta_p * j);
+		if((j == 0) || (v > top)) {
+			top = v;
+		}
+		if((j == 0) || (v < bottom)) {
+			bottom = v;
+		}
+	}
+	v = bottom + ((top - bottom) / 2);
+	*a_start_p = (v > 0) ? (unsigned long)v : 0;
+
+	return i;
+}
+
+unsigned int ad5933_plan_segments( const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol ) {
+
+	unsigned long start, delta;
+	unsigned int num = 0;
+	unsigned int i = 0;
+
+	while(i < a_num) {
+		i += ad5933_plan_segment(&a_codes_p[i], a_num - i, a_tol, &start, &delta);
+		num++;
+	}
+
+	return num;
+}
+
+void ad5933_plan_log( unsigned long* a_codes_p, unsigned int a_num, unsigned long a_start_hz, unsigned long a_stop_hz ) {
+
+	unsigned long start = ad5933_freq_code(a_start_hz);
+	unsigned long stop = ad5933_freq_code(a_stop_hz);
+	long span, step, rem;
+	unsigned long base;
+	unsigned int i;
+
+	if(a_num == 0) {
+		return;
+	}
+
+	//Step evenly in fixed point log2, no float math on the target
+	base = ad5933_plan_log2((start != 0) ? start : 1);
+	span = (long)ad5933_plan_log2((stop != 0) ? stop : 1) - (long)base;
+
+	//span * i / (a_num - 1) in 32 bit, whole steps plus the spread remainder
+	step = (a_num > 1) ? (span / (long)(a_num - 1)) : 0;
+	rem = (a_num > 1) ? (span % (long)(a_num - 1)) : 0;
+
+	a_codes_p[0] = start;
+	for(i = 1; i < a_num; i++) {
+		a_codes_p[i] = ad5933_plan_exp2(base + step * (long)i + (rem * (long)i) / (long)(a_num - 1));
+	}
+	a_codes_p[a_num - 1] = stop;
+}
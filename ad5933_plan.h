@@ -0,0 +1,88 @@
+#ifndef AD5933_PLAN_H_K3WQ7FZD
+#define AD5933_PLAN_H_K3WQ7FZD
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_plan.h 
+ *
+ * @brief AD5933 frequency plans
+ *
+ * The AD5933 only sweeps linear increments. A frequency plan is any
+ * ascending list of frequency codes, log spaced or custom, which the
+ * driver measures as a run of linear hardware segments. Consecutive
+ * points are joined in one segment while every point stays within a
+ * tolerance of the linear frequency. The split is greedy, each segment
+ * is made as long as possible. With a floating start any part of a
+ * segment is a segment too, so the greedy split has the fewest segments.
+ */
+
+#include "dev_ad5933.h"
+
+/* Max points of one hardware segment, limited by the 9 bit number_of_increments */
+#define AD5933_PLAN_SEGMENT_MAX (AD5933_NUM_INC_MAX + 1)
+
+/**
+ * @brief Longest linear segment at the start of a plan
+ *
+ * The start code and the increment both float, every point of the
+ * segment, the first one included, stays within a_tol. Point i is checked
+ * against every earlier point, so a segment of n points costs n^2 / 2
+ * additions.
+ *
+ * @param a_codes_p a ascending frequency code list
+ * @param a_num a number of codes
+ * @param a_tol a tolerance in frequency codes
+ * @param a_start_p a segment start code
+ * @param a_delta_p a segment increment code
+ *
+ * @return number of plan points in the segment
+ */
+unsigned int ad5933_plan_segment( const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol, unsigned long* a_start_p, unsigned long* a_delta_p );
+
+/**
+ * @brief Number of hardware segments of a plan
+ *
+ * Counts the greedy split of ad5933_plan_segment().
+ *
+ * @param a_codes_p a ascending frequency code list
+ * @param a_num a number of codes
+ * @param a_tol a tolerance in frequency codes
+ *
+ * @return number of segments
+ */
+unsigned int ad5933_plan_segments( const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol );
+
+/**
+ * @brief Fill a log spaced plan
+ *
+ * Steps evenly in a fixed point log2 of the frequency code. The first and
+ * last points are the exact start and stop codes.
+ *
+ * @param a_codes_p a frequency code list
+ * @param a_num a number of points
+ * @param a_start_hz a start frequency
+ * @param a_stop_hz a stop frequency
+ *
+ */
+void ad5933_plan_log( unsigned long* a_codes_p, unsigned int a_num, unsigned long a_start_hz, unsigned long a_stop_hz );
+
+
+#endif /* end of include guard: AD5933_PLAN_H_K3WQ7FZD */
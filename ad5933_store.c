@@ -0,0 +1,305 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_store.c 
+ *
+ * @brief Compact in-memory storage of a whole sweep
+ */
+
+#include <stddef.h>
+#include "ad5933_store.h"
+
+/**
+ * @brief Bytes taken by a value
+ *
+ * @param a_store_p a store
+ * @param a_value a value
+ * @param a_last a previous value
+ *
+ */
+static unsigned char ad5933_store_size( const ad5933_store* a_store_p, short a_value, short a_last ) {
+
+	long delta = (long)a_value - a_last;
+
+	if(!a_store_p->delta) {
+		return 2;
+	}
+
+	//-128 is the escape byte
+	return ((delta > -128) && (delta < 128)) ? 1 : 3;
+}
+
+/**
+ * @brief Write a value
+ *
+ * @param a_store_p a store
+ * @param a_value a value
+ * @param a_last a previous value
+ *
+ */
+static void ad5933_store_put( ad5933_store* a_store_p, short a_value, short a_last ) {
+
+	unsigned char* p = &a_store_p->buf_p[a_store_p->data_len];
+
+	if(ad5933_store_size(a_store_p, a_value, a_last) == 1) {
+		p[0] = (unsigned char)(signed char)(a_value - a_last);
+		a_store_p->data_len++;
+		return;
+	}
+
+	if(a_store_p->delta) {
+		*p++ = AD5933_STORE_ESCAPE;
+		a_store_p->data_len++;
+	}
+
+	p[0] = (unsigned short)a_value & 0xff;
+	p[1] = (unsigned short)a_value >> 8;
+	a_store_p->data_len += 2;
+}
+
+/**
+ * @brief Read a value
+ *
+ * @param a_store_p a store
+ * @param a_pos_p a data position
+ * @param a_last a previous value
+ *
+ * @return value
+ */
+static short ad5933_store_get( const ad5933_store* a_store_p, unsigned int* a_pos_p, short a_last ) {
+
+	const unsigned char* p = &a_store_p->buf_p[*a_pos_p];
+
+	if(a_store_p->delta) {
+		if(p[0] != AD5933_STORE_ESCAPE) {
+			(*a_pos_p)++;
+			return (short)(a_last + (signed char)p[0]);
+		}
+		p++;
+		(*a_pos_p)++;
+	}
+
+	*a_pos_p += 2;
+	return (short)(p[0] | (p[1] << 8));
+}
+
+/**
+ * @brief Stack a event down from the end of the buffer
+ *
+ * @param a_store_p a store
+ * @param a_size a event size
+ * @param a_tag a point number, with AD5933_STORE_EVENT_FREQ for a frequency event
+ *
+ * @return event bytes, the point number is in the last two
+ */
+static unsigned char* ad5933_store_event( ad5933_store* a_store_p, unsigned char a_size, unsigned int a_tag ) {
+
+	unsigned char* p;
+
+	a_store_p->event_len += a_size;
+	p = &a_store_p->buf_p[a_store_p->size - a_store_p->event_len];
+	p[a_size - 2] = a_tag & 0xff;
+	p[a_size - 1] = a_tag >> 8;
+
+	return p;
+}
+
+/**
+ * @brief Write a 24 bit frequency code or increment
+ */
+static void ad5933_store_put_code( unsigned char* a_p, unsigned long a_code ) {
+
+	a_p[0] = a_code & 0xff;
+	a_p[1] = (a_code >> 8) & 0xff;
+	a_p[2] = (a_code >> 16) & 0xff;
+}
+
+/**
+ * @brief Read a 24 bit frequency code or increment
+ */
+static unsigned long ad5933_store_get_code( const unsigned char* a_p ) {
+
+	return a_p[0] | ((unsigned long)a_p[1] << 8) | ((unsigned long)a_p[2] << 16);
+}
+
+void ad5933_store_init( ad5933_store* a_store_p, unsigned char* a_buf_p, unsigned int a_size, unsigned char a_delta ) {
+
+	a_store_p->buf_p = a_buf_p;
+	a_store_p->size = a_size;
+	a_store_p->delta = a_delta;
+	a_store_p->frequency_code = 0;
+	a_store_p->delta_frequency = 0;
+	a_store_p->freq_open = 0;
+	a_store_p->data_len = 0;
+	a_store_p->event_len = 0;
+	a_store_p->num = 0;
+	a_store_p->full = 0;
+	a_store_p->real = 0;
+	a_store_p->imaginary = 0;
+}
+
+void ad5933_store_begin( ad5933_store* a_store_p, ad5933_dev* a_dev ) {
+
+	ad5933_store_init(a_store_p, a_store_p->buf_p, a_store_p->size, a_store_p->delta);
+
+	//First point expected at the start of the sweep or of the first plan segment
+	a_store_p->frequency_code = a_dev->data.frequency_start - a_dev->data.delta_frequency;
+	a_store_p->delta_frequency = a_dev->data.delta_frequency;
+}
+
+unsigned char ad5933_store_add( ad5933_store* a_store_p, const ad5933_record* a_record_p ) {
+
+	unsigned char* p;
+	unsigned char event, freq;
+	unsigned int need;
+
+	event = (a_store_p->num == 0) || (a_record_p->status != a_store_p->status) || (a_record_p->setting != a_store_p->setting) ||
+		(a_record_p->samples != a_store_p->samples) || (a_record_p->temperature != a_store_p->temperature);
+
+	//Step change, unless the point only gives the increment of a open frequency event
+	freq = (a_store_p->num == 0) ||
+		(!a_store_p->freq_open && (a_record_p->frequency_code != (a_store_p->frequency_code + a_store_p->delta_frequency)));
+
+	need = ad5933_store_size(a_store_p, a_record_p->real, a_store_p->real) + ad5933_store_size(a_store_p, a_record_p->imaginary, a_store_p->imaginary);
+	if(event) {
+		need += AD5933_STORE_EVENT_SIZE;
+	}
+	if(freq) {
+		need += AD5933_STORE_FREQ_SIZE;
+	}
+
+	if(a_store_p->full || ((a_store_p->data_len + a_store_p->event_len + need) > a_store_p->size)) {
+		a_store_p->full = 1;
+		return 0;
+	}
+
+	if(a_store_p->num == 0) {
+		a_store_p->first_index = a_record_p->index;
+	}
+
+	//Second point of a segment, its increment completes the frequency event
+	if(a_store_p->freq_open) {
+		a_store_p->delta_frequency = a_record_p->frequency_code - a_store_p->frequency_code;
+		ad5933_store_put_code(&a_store_p->buf_p[a_store_p->size - a_store_p->freq_open + 3], a_store_p->delta_frequency);
+		a_store_p->freq_open = 0;
+	}
+
+	//Step change, the increment is known when the point is the one expected
+	if(freq) {
+		if(a_record_p->frequency_code != (a_store_p->frequency_code + a_store_p->delta_frequency)) {
+			a_store_p->delta_frequency = 0;
+		}
+		p = ad5933_store_event(a_store_p, AD5933_STORE_FREQ_SIZE, a_store_p->num | AD5933_STORE_EVENT_FREQ);
+		ad5933_store_put_code(&p[0], a_record_p->frequency_code);
+		ad5933_store_put_code(&p[3], a_store_p->delta_frequency);
+		if(a_store_p->delta_frequency == 0) {
+			a_store_p->freq_open = a_store_p->event_len;
+		}
+	}
+	a_store_p->frequency_code = a_record_p->frequency_code;
+
+	//Setting change
+	if(event) {
+		p = ad5933_store_event(a_store_p, AD5933_STORE_EVENT_SIZE, a_store_p->num);
+		p[0] = a_record_p->status;
+		p[1] = a_record_p->setting;
+		p[2] = a_record_p->samples;
+		p[3] = (unsigned short)a_record_p->temperature & 0xff;
+		p[4] = (unsigned short)a_record_p->temperature >> 8;
+
+		a_store_p->status = a_record_p->status;
+		a_store_p->setting = a_record_p->setting;
+		a_store_p->samples = a_record_p->samples;
+		a_store_p->temperature = a_record_p->temperature;
+	}
+
+	ad5933_store_put(a_store_p, a_record_p->real, a_store_p->real);
+	ad5933_store_put(a_store_p, a_record_p->imaginary, a_store_p->imaginary);
+	a_store_p->real = a_record_p->real;
+	a_store_p->imaginary = a_record_p->imaginary;
+	a_store_p->num++;
+
+	return 1;
+}
+
+unsigned char ad5933_store_proc( ad5933_store* a_store_p, ad5933_dev* a_dev ) {
+
+	ad5933_record record;
+
+	while(ad5933_peek_record(a_dev, &record)) {
+
+		if(!ad5933_store_add(a_store_p, &record)) {
+			return 1;
+		}
+
+		ad5933_read_records(a_dev, &record, 1);
+	}
+
+	return 0;
+}
+
+unsigned char ad5933_store_read( const ad5933_store* a_store_p, ad5933_store_cursor* a_cursor_p, ad5933_record* a_record_p ) {
+
+	const unsigned char* p;
+	ad5933_record* record = &a_cursor_p->record;
+	unsigned int tag;
+	unsigned char freq = 0;
+
+	if(a_cursor_p->num >= a_store_p->num) {
+		return 0;
+	}
+
+	//Events of this point, the point number is on top of each one
+	while(a_cursor_p->event < a_store_p->event_len) {
+		p = &a_store_p->buf_p[a_store_p->size - a_cursor_p->event - 2];
+		tag = p[0] | ((unsigned int)p[1] << 8);
+		if((tag & ~AD5933_STORE_EVENT_FREQ) != a_cursor_p->num) {
+			break;
+		}
+
+		if(tag & AD5933_STORE_EVENT_FREQ) {
+			a_cursor_p->event += AD5933_STORE_FREQ_SIZE;
+			p = &a_store_p->buf_p[a_store_p->size - a_cursor_p->event];
+			record->frequency_code = ad5933_store_get_code(&p[0]);
+			a_cursor_p->delta_frequency = ad5933_store_get_code(&p[3]);
+			freq = 1;
+		}
+		else {
+			a_cursor_p->event += AD5933_STORE_EVENT_SIZE;
+			p = &a_store_p->buf_p[a_store_p->size - a_cursor_p->event];
+			record->status = p[0];
+			record->setting = p[1];
+			record->samples = p[2];
+			record->temperature = (short)(p[3] | (p[4] << 8));
+		}
+	}
+
+	if(!freq) {
+		record->frequency_code += a_cursor_p->delta_frequency;
+	}
+
+	record->real = ad5933_store_get(a_store_p, &a_cursor_p->pos, record->real);
+	record->imaginary = ad5933_store_get(a_store_p, &a_cursor_p->pos, record->imaginary);
+	record->index = a_store_p->first_index + a_cursor_p->num;
+
+	a_cursor_p->num++;
+	*a_record_p = *record;
+
+	return 1;
+}
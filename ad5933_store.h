@@ -0,0 +1,168 @@
+#ifndef AD5933_STORE_H_P8VN4TQC
+#define AD5933_STORE_H_P8VN4TQC
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_store.h 
+ *
+ * @brief Compact in-memory storage of a whole sweep
+ *
+ * A 511 increment sweep does not fit in the record buffer, nor as
+ * ad5933_record in the SRAM of a ATmega328. The store keeps only the
+ * Real and Imaginary data of each point in a buffer of the application,
+ * as packed 16 bit values (4 bytes per point) or delta coded against the
+ * previous point (1 byte per value when it moved by less than 128 codes,
+ * 3 bytes otherwise, about 2 to 3 bytes per point on a smooth sweep).
+ * On a ATmega328 only delta coding keeps a full 512 point sweep in 2 KB,
+ * about 1 KB. Packed it takes 2 KB of data alone, the whole SRAM.
+ *
+ * Status, setting, samples and temperature are stored as events at the
+ * end of the buffer, only when they change. The points are consecutive
+ * and step by a frequency increment. A frequency event stores the code
+ * and increment where the step changes, at the start and at every plan
+ * segment, so the points keep the codes actually programmed.
+ */
+
+#include "dev_ad5933.h"
+
+/* Delta byte announcing a 16 bit value, little endian */
+#define AD5933_STORE_ESCAPE 0x80
+
+/* Setting event, status, setting, samples, temperature, point number */
+#define AD5933_STORE_EVENT_SIZE 7
+
+/* Frequency event, code, increment, point number with AD5933_STORE_EVENT_FREQ */
+#define AD5933_STORE_FREQ_SIZE 8
+#define AD5933_STORE_EVENT_FREQ 0x8000
+
+/**
+ * @brief Sweep store
+ */
+typedef struct _ad5933_store {
+
+	// application buffer, data from the start and events from the end
+	unsigned char* buf_p;
+	unsigned int size;
+	unsigned int data_len;
+	unsigned int event_len;
+
+	// delta coding enable
+	unsigned char delta;
+
+	// points stored and index of the first one
+	unsigned int num;
+	unsigned int first_index;
+
+	// set by the first record that did not fit, the points stay consecutive
+	unsigned char full;
+
+	// frequency code and increment of the last point, frequency event waiting for its increment
+	unsigned long frequency_code;
+	unsigned long delta_frequency;
+	unsigned int freq_open;
+
+	// last point, reference of the deltas and of the events
+	short real;
+	short imaginary;
+	short temperature;
+	unsigned char status;
+	unsigned char setting;
+	unsigned char samples;
+
+} ad5933_store;
+
+/**
+ * @brief Read position inside a store
+ */
+typedef struct _ad5933_store_cursor {
+
+	// point number, data position and event bytes read
+	unsigned int num;
+	unsigned int pos;
+	unsigned int event;
+
+	// frequency increment of the last point read
+	unsigned long delta_frequency;
+
+	// last point read
+	ad5933_record record;
+
+} ad5933_store_cursor;
+
+/**
+ * @brief Attach a buffer to a store
+ *
+ * @param a_store_p a store
+ * @param a_buf_p a buffer
+ * @param a_size a buffer size
+ * @param a_delta a 1 for delta coding, 0 for packed 16 bit values
+ *
+ */
+void ad5933_store_init( ad5933_store* a_store_p, unsigned char* a_buf_p, unsigned int a_size, unsigned char a_delta );
+
+/**
+ * @brief Empty the store before a sweep
+ *
+ * Takes the first increment from the device, call it after the
+ * configuration and before the start.
+ *
+ * @param a_store_p a store
+ * @param a_dev a device handle
+ *
+ */
+void ad5933_store_begin( ad5933_store* a_store_p, ad5933_dev* a_dev );
+
+/**
+ * @brief Append a record
+ *
+ * @param a_store_p a store
+ * @param a_record_p a record, next point of the sweep
+ *
+ * @return 1 when stored, 0 when this or an earlier record did not fit
+ */
+unsigned char ad5933_store_add( ad5933_store* a_store_p, const ad5933_record* a_record_p );
+
+/**
+ * @brief Move the records of a device to the store
+ *
+ * Call it from the main loop next to ad5933_sched_proc. Records that do
+ * not fit stay in the device, which holds the sweep.
+ *
+ * @param a_store_p a store
+ * @param a_dev a device handle
+ *
+ * @return 1 when the store is full
+ */
+unsigned char ad5933_store_proc( ad5933_store* a_store_p, ad5933_dev* a_dev );
+
+/**
+ * @brief Read the points in order
+ *
+ * @param a_store_p a store
+ * @param a_cursor_p a cursor, zeroed to start from the first point
+ * @param a_record_p a record
+ *
+ * @return 1 when a record is read, 0 after the last one
+ */
+unsigned char ad5933_store_read( const ad5933_store* a_store_p, ad5933_store_cursor* a_cursor_p, ad5933_record* a_record_p );
+
+
+#endif /* end of include guard: AD5933_STORE_H_P8VN4TQC */
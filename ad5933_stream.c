@@ -0,0 +1,208 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_stream.c 
+ *
+ * @brief Binary streaming of sweep records to a host
+ */
+
+#include "hal.h"
+#include "ad5933_stream.h"
+
+/**
+ * @brief COBS encoder writing straight into a frame buffer
+ */
+typedef struct _ad5933_cobs {
+
+	// frame buffer and bytes written
+	unsigned char* frame_p;
+	unsigned char len;
+
+	// position and value of the pending code byte
+	unsigned char code_pos;
+	unsigned char code;
+
+	// CRC of the payload bytes
+	unsigned int crc;
+
+} ad5933_cobs;
+
+/**
+ * @brief Frames, one on the wire and one being filled
+ */
+static unsigned char g_stream_frame[2][AD5933_STREAM_FRAME_MAX];
+static unsigned char g_stream_fill;
+static unsigned char g_stream_len;
+
+/**
+ * @brief Next device served by the round robin
+ */
+static unsigned char g_stream_dev;
+
+/**
+ * @brief Start a frame
+ */
+static void ad5933_cobs_begin( ad5933_cobs* a_cobs_p, unsigned char* a_frame_p ) {
+
+	a_cobs_p->frame_p = a_frame_p;
+	a_cobs_p->code_pos = 0;
+	a_cobs_p->code = 1;
+	a_cobs_p->len = 1;
+	a_cobs_p->crc = 0xffff;
+}
+
+/**
+ * @brief Add a byte to the frame, zero bytes close the current block
+ */
+static void ad5933_cobs_put( ad5933_cobs* a_cobs_p, unsigned char a_data ) {
+
+	if(a_data != 0) {
+		a_cobs_p->frame_p[a_cobs_p->len++] = a_data;
+		a_cobs_p->code++;
+	}
+
+	//Zero byte or full block, write the code byte and open a new block
+	if((a_data == 0) || (a_cobs_p->code == 0xff)) {
+		a_cobs_p->frame_p[a_cobs_p->code_pos] = a_cobs_p->code;
+		a_cobs_p->code_pos = a_cobs_p->len++;
+		a_cobs_p->code = 1;
+	}
+}
+
+/**
+ * @brief Add a payload byte, covered by the CRC
+ */
+static void ad5933_cobs_data( ad5933_cobs* a_cobs_p, unsigned char a_data ) {
+
+	a_cobs_p->crc = ad5933_stream_crc(a_cobs_p->crc, a_data);
+	ad5933_cobs_put(a_cobs_p, a_data);
+}
+
+/**
+ * @brief Append the CRC and the delimiter
+ *
+ * @return frame size
+ */
+static unsigned char ad5933_cobs_end( ad5933_cobs* a_cobs_p ) {
+
+	unsigned int crc = a_cobs_p->crc;
+
+	ad5933_cobs_put(a_cobs_p, crc & 0xff);
+	ad5933_cobs_put(a_cobs_p, crc >> 8);
+
+	a_cobs_p->frame_p[a_cobs_p->code_pos] = a_cobs_p->code;
+	a_cobs_p->frame_p[a_cobs_p->len++] = 0;
+
+	return a_cobs_p->len;
+}
+
+void ad5933_stream_init( unsigned long a_baud ) {
+
+	g_stream_fill = 0;
+	g_stream_len = 0;
+	g_stream_dev = 0;
+
+	hal_uart_init(a_baud);
+}
+
+unsigned int ad5933_stream_crc( unsigned int a_crc, unsigned char a_data ) {
+
+	unsigned char i;
+
+	a_crc ^= (unsigned int)a_data << 8;
+
+	for(i = 0; i < 8; i++) {
+		if(a_crc & 0x8000) {
+			a_crc = (a_crc << 1) ^ 0x1021;
+		}
+		else {
+			a_crc <<= 1;
+		}
+	}
+
+	return a_crc & 0xffff;
+}
+
+unsigned char ad5933_stream_pack( unsigned char a_dev_id, const ad5933_record* a_record_p, unsigned char a_num, unsigned char* a_frame_p ) {
+
+	ad5933_cobs cobs;
+	unsigned char i;
+
+	if(a_num > AD5933_STREAM_RECORDS) {
+		a_num = AD5933_STREAM_RECORDS;
+	}
+
+	ad5933_cobs_begin(&cobs, a_frame_p);
+
+	ad5933_cobs_data(&cobs, AD5933_STREAM_TYPE_RECORDS);
+	ad5933_cobs_data(&cobs, a_dev_id);
+	ad5933_cobs_data(&cobs, a_num);
+
+	for(i = 0; i < a_num; i++, a_record_p++) {
+		ad5933_cobs_data(&cobs, a_record_p->index & 0xff);
+		ad5933_cobs_data(&cobs, a_record_p->index >> 8);
+		ad5933_cobs_data(&cobs, a_record_p->frequency_code & 0xff);
+		ad5933_cobs_data(&cobs, (a_record_p->frequency_code >> 8) & 0xff);
+		ad5933_cobs_data(&cobs, (a_record_p->frequency_code >> 16) & 0xff);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->real & 0xff);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->real >> 8);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->imaginary & 0xff);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->imaginary >> 8);
+		ad5933_cobs_data(&cobs, a_record_p->status);
+		ad5933_cobs_data(&cobs, a_record_p->setting);
+		ad5933_cobs_data(&cobs, a_record_p->samples);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->temperature & 0xff);
+		ad5933_cobs_data(&cobs, (unsigned short)a_record_p->temperature >> 8);
+	}
+
+	return ad5933_cobs_end(&cobs);
+}
+
+unsigned char ad5933_stream_proc( ad5933_dev* const* a_dev_p, unsigned char a_dev_num ) {
+
+	ad5933_record records[AD5933_STREAM_RECORDS];
+	unsigned char i, dev, num;
+	unsigned char busy = hal_uart_busy();
+
+	//Fill the free frame, small frames only when the port would be idle
+	for(i = 0; (i < a_dev_num) && (g_stream_len == 0); i++) {
+
+		dev = (g_stream_dev + i) % a_dev_num;
+
+		if(busy && (ad5933_records_available(a_dev_p[dev]) < AD5933_STREAM_RECORDS)) {
+			continue;
+		}
+
+		num = ad5933_read_records(a_dev_p[dev], records, AD5933_STREAM_RECORDS);
+		if(num) {
+			g_stream_len = ad5933_stream_pack(dev, records, num, g_stream_frame[g_stream_fill]);
+			g_stream_dev = dev + 1;
+		}
+	}
+
+	//Swap the frames once the previous one is out
+	if(g_stream_len && !busy) {
+		hal_uart_send(g_stream_frame[g_stream_fill], g_stream_len);
+		g_stream_fill ^= 1;
+		g_stream_len = 0;
+		busy = 1;
+	}
+
+	return (g_stream_len != 0) || busy;
+}
@@ -0,0 +1,105 @@
+#ifndef AD5933_STREAM_H_Q6JX2MRB
+#define AD5933_STREAM_H_Q6JX2MRB
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_stream.h 
+ *
+ * @brief Binary streaming of sweep records to a host
+ *
+ * Records are packed in frames sent on the serial port by the transmit
+ * interrupt. One frame is on the wire while the next one is filled.
+ *
+ * Frame, before COBS encoding:
+ *
+ *	type (AD5933_STREAM_TYPE_RECORDS), device, record count,
+ *	count x 14 byte record, CRC-16/CCITT of the previous bytes
+ *
+ * Record, little endian: index (2), frequency code (3), real (2),
+ * imaginary (2), status (1), setting (1), samples (1), temperature (2).
+ *
+ * The COBS encoded frame has no zero byte, a zero byte ends it.
+ * host/ad5933_host.h decodes the stream.
+ */
+
+#include "dev_ad5933.h"
+
+/* Max records per frame */
+#ifndef AD5933_STREAM_RECORDS
+#define AD5933_STREAM_RECORDS 8
+#endif
+
+/* Frame contents */
+#define AD5933_STREAM_TYPE_RECORDS 0x01
+#define AD5933_STREAM_HEADER_SIZE 3
+#define AD5933_STREAM_RECORD_SIZE 14
+#define AD5933_STREAM_CRC_SIZE 2
+
+/* Largest frame on the wire, COBS code bytes and the zero delimiter included */
+#define AD5933_STREAM_PAYLOAD_MAX (AD5933_STREAM_HEADER_SIZE + (AD5933_STREAM_RECORDS * AD5933_STREAM_RECORD_SIZE) + AD5933_STREAM_CRC_SIZE)
+#define AD5933_STREAM_FRAME_MAX (AD5933_STREAM_PAYLOAD_MAX + (AD5933_STREAM_PAYLOAD_MAX / 254) + 2)
+
+/**
+ * @brief initialize the serial port used by the stream
+ *
+ * @param a_baud a baud rate
+ *
+ */
+void ad5933_stream_init( unsigned long a_baud );
+
+/**
+ * @brief CRC-16/CCITT, polynomial 0x1021, initial value 0xffff
+ *
+ * @param a_crc a running CRC
+ * @param a_data a data byte
+ *
+ * @return updated CRC
+ */
+unsigned int ad5933_stream_crc( unsigned int a_crc, unsigned char a_data );
+
+/**
+ * @brief Pack records in a COBS encoded frame
+ *
+ * @param a_dev_id a device number sent with the records
+ * @param a_record_p a record array
+ * @param a_num a number of records, up to AD5933_STREAM_RECORDS
+ * @param a_frame_p a frame buffer of AD5933_STREAM_FRAME_MAX bytes
+ *
+ * @return frame size
+ */
+unsigned char ad5933_stream_pack( unsigned char a_dev_id, const ad5933_record* a_record_p, unsigned char a_num, unsigned char* a_frame_p );
+
+/**
+ * @brief Move the records of several devices to the serial port
+ *
+ * Call it from the main loop next to ad5933_sched_proc. A frame is packed
+ * when the port is idle or when a device has a full frame of records, and
+ * sent as soon as the previous frame is out. It never waits for the port.
+ *
+ * @param a_dev_p a device handle array, device numbers are array positions
+ * @param a_dev_num a number of devices
+ *
+ * @return 1 while a frame is waiting or on the wire
+ */
+unsigned char ad5933_stream_proc( ad5933_dev* const* a_dev_p, unsigned char a_dev_num );
+
+
+#endif /* end of include guard: AD5933_STREAM_H_Q6JX2MRB */
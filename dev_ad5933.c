@@ -1,5 +1,10 @@
+#include <stddef.h>
+#include <string.h>
 #include "pca.h"
+#include "twi.h"
+#include "hal.h"
 #include "dev_ad5933.h"
+#include "ad5933_plan.h"
 
 /* Copyright (C) 
  * 2014 - Gabriel Durante
@@ -20,179 +25,517 @@
  */
  
  /**
- * @brief AD5933 platform data
+ * @brief I2C mux channel currently connected to the bus
  */
-static ad5933_platform_data g_ad5933_platform_data;
+static unsigned char g_ad5933_mux_channel = AD5933_MUX_NONE;
 
+/**
+ * @brief Failed transactions so far
+ *
+ * A failed mux select sends the next transactions to another device, so
+ * a tracked pointer location is only trusted while no error happened
+ * since it was set. 32 bits, so the count can not wrap back to a stale
+ * snapshot in the lifetime of a device.
+ */
+static unsigned long g_ad5933_bus_errors;
+
+/**
+ * @brief Pointer command parking the pointer on the status register
+ */
+static const unsigned char g_ad5933_park_cmd[2] = { AD5933_ADDR_PTR, AD5933_STATUS };
+
+/**
+ * @brief MCU time awake and in each sleep depth, end of the last sleep
+ */
+static unsigned long long g_ad5933_mcu_us[3];
+static unsigned long g_ad5933_mcu_since;
+
+/* Step kinds replayed after a failure */
+#define AD5933_OP_COMMAND 0x00
+#define AD5933_OP_READ 0x01
+#define AD5933_OP_SHADOW 0x02
+
+#ifdef AD5933_STATS
+#define AD5933_STAT_ADD(a_dev, a_field, a_num) ((a_dev)->stats.a_field += (a_num))
+#else
+#define AD5933_STAT_ADD(a_dev, a_field, a_num)
+#endif
+
+/**
+ * @brief Auto-range gain ladder, AD5933_SETTING keys from the lowest to the highest gain
+ */
+static const unsigned char g_ad5933_range_ladder[] = {
+	AD5933_SETTING(AD5933_VRANGE_200mV | AD5933_PGA_1X, HAL_RFB_20R),
+	AD5933_SETTING(AD5933_VRANGE_400mV | AD5933_PGA_1X, HAL_RFB_20R),
+	AD5933_SETTING(AD5933_VRANGE_1V | AD5933_PGA_1X, HAL_RFB_20R),
+	AD5933_SETTING(AD5933_VRANGE_2V | AD5933_PGA_1X, HAL_RFB_20R),
+	AD5933_SETTING(AD5933_VRANGE_2V | AD5933_PGA_5X, HAL_RFB_20R),
+	AD5933_SETTING(AD5933_VRANGE_200mV | AD5933_PGA_1X, HAL_RFB_100K),
+	AD5933_SETTING(AD5933_VRANGE_400mV | AD5933_PGA_1X, HAL_RFB_100K),
+	AD5933_SETTING(AD5933_VRANGE_1V | AD5933_PGA_1X, HAL_RFB_100K),
+	AD5933_SETTING(AD5933_VRANGE_2V | AD5933_PGA_1X, HAL_RFB_100K),
+	AD5933_SETTING(AD5933_VRANGE_2V | AD5933_PGA_5X, HAL_RFB_100K)
+};
+
+#define AD5933_RANGE_STEPS (sizeof(g_ad5933_range_ladder) / sizeof(g_ad5933_range_ladder[0]))
 
-volatile ad5933_platform_data* ad5933_init(void) {
+
+volatile ad5933_platform_data* ad5933_init( ad5933_dev* a_dev, unsigned char a_mux_channel ) {
 
 	//Init TWI at 250KHz
 	twi_init(E_TWI_SCL_250K);
 	
 	//ADG849 control -> Default pull-up select 20 ohm resistor, write logic low to select 100K ohm
-	DDRD |= _BV(DDD6);
-	//PORTD &= ~_BV(AD5933_IO_PORT); //Enable 100K ohms
-	PORTD |= _BV(AD5933_IO_PORT); //Enable 20 ohms
+	hal_init();
+	
+	a_dev->mux_channel = a_mux_channel;
+	a_dev->cfg = AD5933_BASE_CFG;
+	a_dev->autorange = 0;
+	a_dev->avg_max = 0;
+	a_dev->plan_p = NULL;
+	a_dev->plan_base = 0;
+	a_dev->settle_p = NULL;
+	a_dev->track_state = AD5933_TRACK_OFF;
+	a_dev->track_p = NULL;
+	a_dev->track_size = 0;
+	a_dev->track_head = 0;
+	a_dev->track_tail = 0;
+	a_dev->track_count = 0;
+	ad5933_set_rfb(a_dev, HAL_RFB_20R);
+	a_dev->record_head = 0;
+	a_dev->record_tail = 0;
+	a_dev->xfer_num = 0;
+	a_dev->pointer = AD5933_PTR_UNKNOWN;
+	a_dev->retry_num = 0;
+	a_dev->retry_wait = 0;
+	a_dev->point_flags = 0;
+	a_dev->temperature = AD5933_TEMP_UNKNOWN;
+	a_dev->temp_max_age = 0;
+	a_dev->period = 0;
+	a_dev->power = AD5933_POWER_DOWN;
+	a_dev->power_since = hal_time_us();
+	memset(a_dev->power_us, 0, sizeof(a_dev->power_us));
+	a_dev->energy_points = 0;
 	
-	//Reset DA5933
-	ad5933_write_byte(AD5933_CTRL_LOW, AD5933_RESET);
+	//Reset DA5933 and select the system clock
+	ad5933_write_byte(a_dev, AD5933_CTRL_LOW, AD5933_RESET|AD5933_CLK_CFG);
+	
+	//Register contents unknown, program all of them on the next configuration
+	a_dev->shadow_dirty = (1 << AD5933_SHADOW_SIZE) - 1;
 	
 	//Set start frequency 30KHz, delta frequency 1KHz, number of sweeps 10
-	ad5933_set_frequency(30000,1000,10);
+	ad5933_set_frequency(a_dev, 30000,1000,10);
 	
 	//Set measure trigger to IDLE
-	g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_IDLE;
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_IDLE;
 	
-	return &g_ad5933_platform_data;
+	return &a_dev->data;
 }
 
-void ad5933_set_pointer( unsigned char a_reg_loc ) {
+/**
+ * @brief Forget the mux channel and every tracked pointer location after a failed transaction
+ * @param none.
+ *
+ */
+static void ad5933_bus_error( void ) {
 
-	//Send a Start condition on the bus
-	twi_send_start();
-	
-	//Send address SLA+R/W
- 	twi_send_address(SLA_W);
-	
-	//Write the pointer command code
-	twi_send_byte(AD5933_ADDR_PTR);	
-	
-	//Write a register location
-	twi_send_byte(a_reg_loc);
-	
-	//Send a Stop condition on the bus
-	twi_send_stop();
+	g_ad5933_mux_channel = AD5933_MUX_NONE;
+	g_ad5933_bus_errors++;
 }
 
-void ad5933_write_byte( unsigned char a_reg_addr, unsigned char a_data ) {
+/**
+ * @brief Check the tracked pointer location
+ *
+ * @param a_dev a device
+ * @param a_reg_loc a register location
+ *
+ * @return 1 when the pointer is known to be at a_reg_loc
+ */
+static unsigned char ad5933_pointer_at( ad5933_dev* a_dev, unsigned char a_reg_loc ) {
 
-	//Send a Start condition on the bus
-	twi_send_start();
-	
-	//Send address SLA+R/W
- 	twi_send_address(SLA_W);
-	
-	//Send register
-    twi_send_byte(a_reg_addr);
-	
-	//Send data
-   	twi_send_byte(a_data);
-	
-	//Send a Stop condition on the bus
-   	twi_send_stop();
+	return (a_dev->pointer == a_reg_loc) && (a_dev->pointer_errors == g_ad5933_bus_errors);
+}
+
+/**
+ * @brief Record the pointer location, set when the transaction moving it is queued
+ *
+ * @param a_dev a device
+ * @param a_reg_loc a register location
+ *
+ */
+static void ad5933_pointer_track( ad5933_dev* a_dev, unsigned char a_reg_loc ) {
+
+	a_dev->pointer = a_reg_loc;
+	a_dev->pointer_errors = g_ad5933_bus_errors;
 }
 
-void ad5933_write_block( unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p ) {
+/**
+ * @brief Connect the device to the bus through the I2C mux
+ *
+ * The mux keeps its channel between transactions, it is only written when
+ * another device was used last.
+ *
+ * @param a_dev a device
+ *
+ * @return E_TWI_XFER_DONE or E_TWI_XFER_ERROR
+ */
+static unsigned char ad5933_mux_select( ad5933_dev* a_dev ) {
+
+	twi_xfer xfer;
+	unsigned char a_mask;
 
-	unsigned char i, a_data;
-	
-	//set the pointer location
-	ad5933_set_pointer(a_reg_loc);	
-	
-	//Send a Start condition on the bus
-	twi_send_start();
+	if((a_dev->mux_channel == AD5933_MUX_NONE) || (a_dev->mux_channel == g_ad5933_mux_channel)) {
+		return E_TWI_XFER_DONE;
+	}
+
+	a_mask = 1 << a_dev->mux_channel;
+
+	xfer.sla = AD5933_MUX_SLA_W;
+	xfer.write_buf = &a_mask;
+	xfer.write_len = 1;
+	xfer.read_buf = 0;
+	xfer.read_len = 0;
+	xfer.callback = 0;
+	xfer.chain = 0;
+
+	//Channel is known once the select is queued, the bus keeps the order
+	g_ad5933_mux_channel = a_dev->mux_channel;
+
+	return twi_transfer(&xfer);
+}
+
+/**
+ * @brief Wait before retrying a blocking transaction
+ *
+ * @param a_retry a retry number
+ *
+ */
+static void ad5933_backoff( unsigned char a_retry ) {
+
+	unsigned long end = hal_time_us() + (AD5933_RETRY_BACKOFF_US << a_retry);
+
+	while((long)(hal_time_us() - end) < 0) {
+		hal_idle();
+	}
+}
+
+/**
+ * @brief Run a blocking AD5933 transaction on the TWI engine
+ *
+ * A failed transaction is retried up to AD5933_RETRY_MAX times with a
+ * growing delay.
+ *
+ * @param a_dev a device
+ * @param a_wr_p bytes to be sent
+ * @param a_wr_num number of bytes to be sent
+ * @param a_rd_p receive buffer
+ * @param a_rd_num number of bytes to be received
+ *
+ */
+static unsigned char ad5933_transfer( ad5933_dev* a_dev, const unsigned char* a_wr_p, unsigned char a_wr_num, unsigned char* a_rd_p, unsigned char a_rd_num ) {
+
+	twi_xfer xfer;
+	unsigned char status;
+	unsigned char retry;
+
+	xfer.sla = SLA_W;
+	xfer.write_buf = a_wr_p;
+	xfer.write_len = a_wr_num;
+	xfer.read_buf = a_rd_p;
+	xfer.read_len = a_rd_num;
+	xfer.callback = 0;
+	xfer.chain = 0;
+
+	for(retry = 0; ; retry++) {
+
+		//No transaction to the device unless its channel is connected
+		status = ad5933_mux_select(a_dev);
+		if(status == E_TWI_XFER_DONE) {
+			status = twi_transfer(&xfer);
+		}
+
+		if((status == E_TWI_XFER_DONE) || (retry >= AD5933_RETRY_MAX)) {
+			break;
+		}
+
+		ad5933_bus_error();
+		ad5933_backoff(retry);
+	}
+
+	if(status != E_TWI_XFER_DONE) {
+		ad5933_bus_error();
+	}
+
+	return status;
+}
+
+/**
+ * @brief Add a transaction to the current step of the device
+ *
+ * @param a_dev a device
+ * @param a_sla a slave address + write bit
+ * @param a_wr_p bytes to be sent, kept in the device
+ * @param a_wr_num number of bytes to be sent
+ * @param a_rd_p receive buffer, kept in the device
+ * @param a_rd_num number of bytes to be received
+ *
+ */
+static void ad5933_async_add( ad5933_dev* a_dev, unsigned char a_sla, const unsigned char* a_wr_p, unsigned char a_wr_num, unsigned char* a_rd_p, unsigned char a_rd_num ) {
+
+	twi_xfer* xfer = &a_dev->xfer[a_dev->xfer_num++];
+
+	xfer->sla = a_sla;
+	xfer->write_buf = a_wr_p;
+	xfer->write_len = a_wr_num;
+	xfer->read_buf = a_rd_p;
+	xfer->read_len = a_rd_num;
+	xfer->callback = 0;
+
+	//Nothing of the step is sent after a failed transaction, e.g. the mux select
+	xfer->chain = (a_dev->xfer_num > 1);
+}
+
+/**
+ * @brief Start a new step, with the mux select when another device used the bus last
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_async_begin( ad5933_dev* a_dev ) {
+
+	a_dev->xfer_num = 0;
+
+	if((a_dev->mux_channel != AD5933_MUX_NONE) && (a_dev->mux_channel != g_ad5933_mux_channel)) {
+		a_dev->mux_mask = 1 << a_dev->mux_channel;
+		ad5933_async_add(a_dev, AD5933_MUX_SLA_W, &a_dev->mux_mask, 1, 0, 0);
+		g_ad5933_mux_channel = a_dev->mux_channel;
+	}
+}
+
+/**
+ * @brief Queue the transactions of the step on the TWI engine
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_async_submit( ad5933_dev* a_dev ) {
+
+	unsigned char i;
+
+	for(i = 0; i < a_dev->xfer_num; i++) {
+		twi_submit(&a_dev->xfer[i]);
+	}
+}
+
+/**
+ * @brief Status of the step transactions
+ *
+ * The engine runs them in order, the step is over when the last one is.
+ *
+ * @param a_dev a device
+ *
+ * @return E_TWI_XFER_PENDING, E_TWI_XFER_DONE or E_TWI_XFER_ERROR
+ */
+static unsigned char ad5933_async_status( ad5933_dev* a_dev ) {
+
+	unsigned char i;
+
+	if(a_dev->xfer_num == 0) {
+		return E_TWI_XFER_DONE;
+	}
+
+	if(a_dev->xfer[a_dev->xfer_num - 1].status == E_TWI_XFER_PENDING) {
+		return E_TWI_XFER_PENDING;
+	}
+
+	for(i = 0; i < a_dev->xfer_num; i++) {
+		if(a_dev->xfer[i].status == E_TWI_XFER_ERROR) {
+			return E_TWI_XFER_ERROR;
+		}
+	}
+
+	return E_TWI_XFER_DONE;
+}
+
+/**
+ * @brief Queue a control register function
+ *
+ * @param a_dev a device
+ * @param a_command a control register function
+ *
+ */
+static void ad5933_async_command( ad5933_dev* a_dev, unsigned char a_command ) {
+
+	a_dev->op = AD5933_OP_COMMAND;
+	a_dev->op_arg[0] = a_command;
+
+	a_dev->tx_buf[0] = AD5933_CTRL_HIGH;
+	a_dev->tx_buf[1] = a_dev->cfg|a_command;
+
+	ad5933_async_begin(a_dev);
+	ad5933_async_add(a_dev, SLA_W, a_dev->tx_buf, 2, 0, 0);
+	ad5933_async_submit(a_dev);
+}
+
+/**
+ * @brief Queue a register read, pointer set then a block read or a receive byte
+ *
+ * The pointer set is skipped when the pointer is already there. Reads
+ * of other registers park the pointer back on the status register, so
+ * every status poll is a single receive byte.
+ *
+ * @param a_dev a device
+ * @param a_reg_loc a first register location
+ * @param a_byte_num a data size
+ *
+ */
+static void ad5933_async_read( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num ) {
+
+	a_dev->op = AD5933_OP_READ;
+	a_dev->op_arg[0] = a_reg_loc;
+	a_dev->op_arg[1] = a_byte_num;
+
+	ad5933_async_begin(a_dev);
+
+	if(!ad5933_pointer_at(a_dev, a_reg_loc)) {
+		a_dev->ptr_cmd[0] = AD5933_ADDR_PTR;
+		a_dev->ptr_cmd[1] = a_reg_loc;
+		ad5933_async_add(a_dev, SLA_W, a_dev->ptr_cmd, 2, 0, 0);
+	}
+
+	if(a_byte_num > 1) {
+		a_dev->tx_buf[0] = AD5933_BLOCK_RD;
+		a_dev->tx_buf[1] = a_byte_num;
+		ad5933_async_add(a_dev, SLA_W, a_dev->tx_buf, 2, a_dev->rx_buf, a_byte_num);
+	}
+	else {
+		ad5933_async_add(a_dev, SLA_W, 0, 0, a_dev->rx_buf, 1);
+	}
+
+	if(a_reg_loc != AD5933_STATUS) {
+		ad5933_async_add(a_dev, SLA_W, g_ad5933_park_cmd, 2, 0, 0);
+	}
+	ad5933_pointer_track(a_dev, AD5933_STATUS);
+
+	ad5933_async_submit(a_dev);
+}
+
+/**
+ * @brief Account the time of the current power state and move to a new one
+ *
+ * @param a_dev a device
+ * @param a_power a AD5933_POWER state
+ *
+ */
+static void ad5933_power_set( ad5933_dev* a_dev, unsigned char a_power ) {
+
+	unsigned long now = hal_time_us();
+
+	a_dev->power_us[a_dev->power] += now - a_dev->power_since;
+	a_dev->power_since = now;
+	a_dev->power = a_power;
+}
+
+void ad5933_set_pointer( ad5933_dev* a_dev, unsigned char a_reg_loc ) {
+
+	unsigned char a_cmd[2];
+
+	//Pointer command code and register location
+	a_cmd[0] = AD5933_ADDR_PTR;
+	a_cmd[1] = a_reg_loc;
+
+	ad5933_pointer_track(a_dev, a_reg_loc);
+	ad5933_transfer(a_dev, a_cmd, 2, 0, 0);
+}
+
+void ad5933_write_byte( ad5933_dev* a_dev, unsigned char a_reg_addr, unsigned char a_data ) {
+
+	unsigned char a_cmd[2];
+
+	//Register address and data
+	a_cmd[0] = a_reg_addr;
+	a_cmd[1] = a_data;
+
+	ad5933_transfer(a_dev, a_cmd, 2, 0, 0);
+}
+
+void ad5933_write_block( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p ) {
+
+	unsigned char i;
+	unsigned char a_cmd[AD5933_SHADOW_SIZE + 2];
 	
-	//Send address SLA+R/W
- 	twi_send_address(SLA_W);
+	if(a_byte_num > AD5933_SHADOW_SIZE) {
+		a_byte_num = AD5933_SHADOW_SIZE;
+	}
 	
-	//Block write command code
-	twi_send_byte(AD5933_BLOCK_WR);
+	//set the pointer location, it stays there after block transfers
+	if(!ad5933_pointer_at(a_dev, a_reg_loc)) {
+		ad5933_set_pointer(a_dev, a_reg_loc);
+	}
 	
-	//Num of data to be sent
-	twi_send_byte(a_byte_num);	
+	//Block write command code and num of data to be sent
+	a_cmd[0] = AD5933_BLOCK_WR;
+	a_cmd[1] = a_byte_num;
     
-	//Send the data bytes
+	//Copy the data bytes
 	for(i = 0; i < a_byte_num; i++) {
-		a_data = *(a_data_p+i);
-		twi_send_byte(a_data);					
+		a_cmd[i + 2] = *(a_data_p+i);
 	}
 	
-	//Send a Stop condition on the bus
-	twi_send_stop();
+	ad5933_transfer(a_dev, a_cmd, a_byte_num + 2, 0, 0);
 }
 
-unsigned char ad5933_read_byte( unsigned char a_reg_loc ) {
+unsigned char ad5933_read_byte( ad5933_dev* a_dev, unsigned char a_reg_loc ) {
+
+	unsigned char a_data = 0;
 
 	//set the pointer location
-	ad5933_set_pointer(a_reg_loc);	
-	
-	//Send a Start condition on the bus
-	twi_send_start();
-	
-	//Send address SLA+R/W
- 	twi_send_address(SLA_R);	
-	
-	//Clear int flag to send byte 
-	TWCR = _BV(TWINT) | _BV(TWEN);
-	
-	//Wait for TWI interrupt flag set
-	twi_wait_interrupt(); 	
+	if(!ad5933_pointer_at(a_dev, a_reg_loc)) {
+		ad5933_set_pointer(a_dev, a_reg_loc);
+	}
 	
-	//Send a Stop condition on the bus
-	twi_send_stop();
+	//Receive a single byte from the pointer location
+	ad5933_transfer(a_dev, 0, 0, &a_data, 1);
 	
-	return TWDR;
+	return a_data;
 }
 
-unsigned long ad5933_read_block( unsigned char a_reg_loc, unsigned char a_byte_num ) {
+void ad5933_read_regs( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p ) {
 
-	unsigned char i;
-	unsigned long a_data_buf[AD5933_DATA_BUFFER_SIZE];
-	unsigned long a_data;
+	unsigned char a_cmd[2];
 	
 	//Set the pointer location
-	ad5933_set_pointer(a_reg_loc);	
-    
-	//Send a Start condition on the bus
-	twi_send_start();
-	
-	//Send address SLA+R/W
-	twi_send_address(SLA_W);
-	
-	//Block read command
- 	twi_send_byte(AD5933_BLOCK_RD);	
-	
-	//Num of data to be received
- 	twi_send_byte(a_byte_num);
- 	
-	//Send a Start condition on the bus
- 	twi_send_start();
-	
-	//Send address SLA+R/W
- 	twi_send_address(SLA_R);
-	
-	//Receive all the bytes
- 	for(i = 0;i < a_byte_num;i++) {
-		
-		//Clear int flag and enable acknowledge to receive data
-		TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN);
-		
-		//Wait for TWI interrupt flag set
-		twi_wait_interrupt();
-		
-		a_data_buf[i]=TWDR;
+	if(!ad5933_pointer_at(a_dev, a_reg_loc)) {
+		ad5933_set_pointer(a_dev, a_reg_loc);
 	}
+    
+	//Block read command and num of data to be received
+	a_cmd[0] = AD5933_BLOCK_RD;
+	a_cmd[1] = a_byte_num;
 	
-	//Clear int flag to send byte
-	TWCR = _BV(TWINT) | _BV(TWEN);	
+	//Repeated start and receive all the bytes
+	ad5933_transfer(a_dev, a_cmd, 2, a_data_p, a_byte_num);
+}
 
-	//Wait for TWI interrupt flag set
-	twi_wait_interrupt();		
+unsigned long ad5933_read_block( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num ) {
 
-	//Save Last byte
-	a_data_buf[i]=TWDR;		
+	unsigned char a_data_buf[AD5933_DATA_BUFFER_SIZE];
+	unsigned long a_data;
+	
+	if(a_byte_num > AD5933_DATA_BUFFER_SIZE) {
+		a_byte_num = AD5933_DATA_BUFFER_SIZE;
+	}
 	
-	//Send a Stop condition on the bus
- 	twi_send_stop();
+	ad5933_read_regs(a_dev, a_reg_loc, a_byte_num, a_data_buf);
 	
 	//Reassemble data
 	switch(a_byte_num){
 	case 2:
-		a_data = ((a_data_buf[0] << 8) | (a_data_buf[1]));
+		a_data = (((unsigned long)a_data_buf[0] << 8) | (a_data_buf[1]));
 		break;
 	case 3:
-		a_data = ((a_data_buf[0] << 16) | (a_data_buf[1] << 8) | (a_data_buf[2]));
+		a_data = (((unsigned long)a_data_buf[0] << 16) | ((unsigned long)a_data_buf[1] << 8) | (a_data_buf[2]));
+		break;
 	default:
 		a_data = (a_data_buf[0]);
 		break;
@@ -202,163 +545,1493 @@ unsigned long ad5933_read_block( unsigned char a_reg_loc, unsigned char a_byte_n
  	return a_data;
 }
 
-void ad5933_get_temperature( void ) {
+/**
+ * @brief Store a temperature register value in the cache
+ *
+ * @param a_dev a device
+ * @param a_raw a TEMP_HIGH, TEMP_LOW value, 14 bit two's complement in 1/32 degree C
+ *
+ */
+static void ad5933_temp_store( ad5933_dev* a_dev, unsigned short a_raw ) {
+
+	short temperature = a_raw & 0x3fff;
+
+	if(temperature >= 8192) {
+		temperature -= 16384;
+	}
+
+	a_dev->temperature = temperature;
+	a_dev->temp_time = hal_time_us();
+	a_dev->temp_try = a_dev->temp_time;
+	a_dev->data.temperature = (char)(temperature / 32);
+}
+
+void ad5933_get_temperature( ad5933_dev* a_dev ) {
 
 	unsigned char reg_val;
-	short temperature;
+	unsigned long end;
 
-	ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_MEASURE_TEMP);
+	ad5933_write_byte(a_dev, AD5933_CTRL_HIGH, AD5933_MEASURE_TEMP);
 	
-	reg_val = ad5933_read_byte(AD5933_STATUS);
-		
-	while((reg_val & AD5933_STAT_TEMP_VALID) != AD5933_STAT_TEMP_VALID); // Wait temperature trigger
+	//Wait temperature trigger, the previous temperature is kept on timeout
+	end = hal_time_us() + AD5933_TEMP_TIMEOUT_US;
+	do {
+		if((long)(hal_time_us() - end) >= 0) {
+			return;
+		}
+		reg_val = ad5933_read_byte(a_dev, AD5933_STATUS);
+	} while((reg_val & AD5933_STAT_TEMP_VALID) != AD5933_STAT_TEMP_VALID);
 
-	temperature = ad5933_read_block(AD5933_TEMP_HIGH,2);
-	
-	if(temperature < 8192) {
-        temperature /= 32;
-    }
-    else {
-        temperature -= 16384;
-        temperature /= 32;
-    }
+	ad5933_temp_store(a_dev, ad5933_read_block(a_dev, AD5933_TEMP_HIGH,2));
+}
+
+void ad5933_set_temperature_refresh( ad5933_dev* a_dev, unsigned long a_max_age_ms ) {
+
+	a_dev->temp_max_age = a_max_age_ms * 1000UL;
 	
-	g_ad5933_platform_data.temperature = (char)temperature;
+	//Due at once
+	a_dev->temp_try = hal_time_us() - a_dev->temp_max_age;
 }
 
-void ad5933_set_frequency( unsigned long int a_start_freq_hz, unsigned long int a_delta_freq_hz, unsigned char a_nof_increments ) {
+short ad5933_temperature( ad5933_dev* a_dev, unsigned long* a_age_ms_p ) {
+
+	if(a_age_ms_p != NULL) {
+		*a_age_ms_p = (hal_time_us() - a_dev->temp_time) / 1000UL;
+	}
 
-	g_ad5933_platform_data.frequency_start = (a_start_freq_hz * AD5933_INT_OSC_FREQ_RATIO);
-	g_ad5933_platform_data.delta_frequency = (a_delta_freq_hz * AD5933_INT_OSC_FREQ_RATIO);
-	g_ad5933_platform_data.number_of_increments = a_nof_increments;
-	g_ad5933_platform_data.delay_value = ((a_start_freq_hz + (a_delta_freq_hz * a_nof_increments))/1000);
+	return a_dev->temperature;
 }
 
-void ad5933_config_measure( void ) {
+/**
+ * @brief Start a temperature measurement when the refresh period is over
+ *
+ * The state machine goes through the temperature states and comes back
+ * to the current state.
+ *
+ * @param a_dev a device
+ *
+ * @return 1 when the measurement is started
+ */
+static unsigned char ad5933_temp_refresh( ad5933_dev* a_dev ) {
 
-	unsigned char a_data_buf[AD5933_DATA_BUFFER_SIZE];
-	
-	_delay_ms(150);
-	
-	//Convert start frequency data to register map
-	a_data_buf[0]=(0x000000ff & (g_ad5933_platform_data.frequency_start>>16));
-	a_data_buf[1]=(0x000000ff & (g_ad5933_platform_data.frequency_start>>8));
-	a_data_buf[2]=(0x000000ff & g_ad5933_platform_data.frequency_start);
-	
-	//Program start frequency
-	ad5933_write_block(AD5933_FREQ_HIGH, 3, &a_data_buf[0]);
-	
-	//Convert delta frequency data to register map
-	a_data_buf[0]=(0x000000ff & (g_ad5933_platform_data.delta_frequency>>16));
-	a_data_buf[1]=(0x000000ff & (g_ad5933_platform_data.delta_frequency>>8));
-	a_data_buf[2]=(0x000000ff & g_ad5933_platform_data.delta_frequency);
-	
-	//Program delta frequency
-	ad5933_write_block(AD5933_FREQ_INC_HIGH, 3, &a_data_buf[0]);
-	
-	//Convert number of increments data to register map
-	a_data_buf[0]=(0x000000ff & (g_ad5933_platform_data.number_of_increments>>8));
-	a_data_buf[1]=(0x000000ff & g_ad5933_platform_data.number_of_increments);
-	
-	//Program number of increments
-	ad5933_write_block(AD5933_NUM_INC_HIGH, 2, &a_data_buf[0]);
-	
-	//Convert delay data to register map
-	a_data_buf[0]=(0x000000ff & (g_ad5933_platform_data.delay_value>>8));
-	a_data_buf[1]=(0x000000ff & g_ad5933_platform_data.delay_value);
-	
-	//Program delay
-	ad5933_write_block(AD5933_NUM_SETTLE_HIGH, 2, &a_data_buf[0]);
-	
-	//Place AD5933 in Stand-by mode
-	ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_STANDBY);
-	
-	//Set measure trigger to IDLE
-	g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_IDLE;
+	if((a_dev->temp_max_age == 0) || ((hal_time_us() - a_dev->temp_try) < a_dev->temp_max_age)) {
+		return 0;
+	}
+
+	a_dev->temp_return = a_dev->data.measure_trigger;
+	ad5933_async_command(a_dev, AD5933_MEASURE_TEMP);
+	a_dev->deadline = hal_time_us() + AD5933_CMD_TIME_US + AD5933_TEMP_TIME_US;
+	a_dev->temp_end = a_dev->deadline + AD5933_TEMP_TIMEOUT_US;
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_TEMP_WAIT;
+
+	return 1;
+}
+
+/**
+ * @brief Give up the temperature measurement, the old value is kept
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_temp_abort( ad5933_dev* a_dev ) {
+
+	a_dev->temp_try = hal_time_us();
+	a_dev->data.measure_trigger = a_dev->temp_return;
 }
 
-void ad5933_proc_data( void ) {
+void ad5933_set_rfb( ad5933_dev* a_dev, unsigned char a_rfb ) {
 
-	unsigned char reg_val = 0;
-	
-	//Start measure
-	if(g_ad5933_platform_data.measure_trigger == E_FLAGS_AD5933_START_MEASURE) {
-		
-		//Init AD5933 with Start frequency, 2Vpp and PGA x1
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_INIT);
+	a_dev->rfb = a_rfb;
+	hal_rfb_select(a_dev->mux_channel, a_rfb);
+}
 
-		//Wait several ms
-		_delay_ms(300);
-	
-		//Send a frequency sweep command
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_SWEEP);
-		
-		reg_val = 0;
-		
-		//Check for DFT conversion
-		while((reg_val & AD5933_STAT_DATA_VALID) != AD5933_STAT_DATA_VALID) {
-			reg_val = ad5933_read_byte(AD5933_STATUS);
-		}
-	
-		//Read Imaginary and Real registers
-		g_ad5933_platform_data.data_imaginary = ad5933_read_block(AD5933_IMAG_HIGH, 2);
-		g_ad5933_platform_data.data_real = ad5933_read_block(AD5933_REAL_HIGH, 2);
-		
-		//Convert 16 bit 2's complement format data to decimal value
-		if (g_ad5933_platform_data.data_real > 0x7fff) {
-		
-			//Negative data
-			g_ad5933_platform_data.data_real = (0x10000 - g_ad5933_platform_data.data_real) * -1;
+void ad5933_set_autorange( ad5933_dev* a_dev, unsigned char a_enable ) {
+
+	unsigned char i;
+	unsigned char setting = AD5933_SETTING(a_dev->cfg, a_dev->rfb);
+
+	a_dev->autorange = a_enable;
+	a_dev->range_step = 0;
+
+	//Start from the ladder step of the current setting, or the closest one below it
+	for(i = 0; i < AD5933_RANGE_STEPS; i++) {
+		if(g_ad5933_range_ladder[i] == setting) {
+			a_dev->range_step = i;
+			break;
 		}
-		
-		if (g_ad5933_platform_data.data_imaginary > 0x7fff) {
-		
-			//Negative data
-			g_ad5933_platform_data.data_imaginary = (0x10000 - g_ad5933_platform_data.data_imaginary) * -1;
+		if((g_ad5933_range_ladder[i] >> 7) == (setting >> 7)) {
+			a_dev->range_step = i;
 		}
-		
-		//Send a standby command
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_STANDBY);
-		
-		//Set trigger to next Sweep frequency
-		g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_DFT_COMPLETE;
 	}
-	
-	//Increment frequency
-	if(g_ad5933_platform_data.measure_trigger == E_FLAGS_AD5933_FREQUENCY_SWEEP_NEXT) {
-	
-		//Generate next frequency
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_INCFREQ);
-		
-		//Set trigger to Start a new measure
-		g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+}
+
+void ad5933_set_averaging( ad5933_dev* a_dev, unsigned char a_max_samples, unsigned char a_noise ) {
+
+	if(a_max_samples > AD5933_AVG_MAX_SAMPLES) {
+		a_max_samples = AD5933_AVG_MAX_SAMPLES;
 	}
-	
-	//Repeat frequency
-	if(g_ad5933_platform_data.measure_trigger == E_FLAGS_AD5933_FREQUENCY_REPEAT) {
-	
-		//Generate next frequency
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_REPEAT_FREQ);
-		
-		//Set trigger to Start a new measure
-		g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	a_dev->avg_max = a_max_samples;
+	a_dev->avg_noise = a_noise;
+	a_dev->avg_num = 0;
+}
+
+unsigned long ad5933_freq_code( unsigned long a_freq_hz ) {
+
+	unsigned long code = 0;
+	unsigned long rem = a_freq_hz;
+	unsigned char bits = 29;
+	unsigned char step;
+
+	//Long division of f * 2^29 by MCLK, the remainder stays below 2^24
+	while(bits) {
+		step = (bits > 8) ? 8 : bits;
+		rem <<= step;
+		code = (code << step) | (rem / AD5933_MCLK_HZ);
+		rem %= AD5933_MCLK_HZ;
+		bits -= step;
 	}
-	
-	//Check if sweep is done
-	if((reg_val & AD5933_STAT_SWEEP_DONE) == AD5933_STAT_SWEEP_DONE) {
-	
-		//Set trigger to stop mode
-		g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_STOP_MEASURE;
+
+	//Round to nearest
+	if(rem >= (AD5933_MCLK_HZ - rem)) {
+		code++;
 	}
-	
-	//Stop measure process
-	if(g_ad5933_platform_data.measure_trigger == E_FLAGS_AD5933_STOP_MEASURE) {
-	
-		//Power down the part
-		ad5933_write_byte(AD5933_CTRL_HIGH, AD5933_BASE_CFG|AD5933_PWR_DWN);
-		
-		//Set trigger to stop mode
-		g_ad5933_platform_data.measure_trigger = E_FLAGS_AD5933_IDLE;
+
+	return code & 0x00ffffff;
+}
+
+void ad5933_set_frequency( ad5933_dev* a_dev, unsigned long int a_start_freq_hz, unsigned long int a_delta_freq_hz, unsigned int a_nof_increments ) {
+
+	if(a_nof_increments > AD5933_NUM_INC_MAX) {
+		a_nof_increments = AD5933_NUM_INC_MAX;
+	}
+
+	a_dev->data.frequency_start = ad5933_freq_code(a_start_freq_hz);
+	a_dev->data.delta_frequency = ad5933_freq_code(a_delta_freq_hz);
+	a_dev->data.number_of_increments = a_nof_increments;
+	ad5933_set_settling(a_dev, (a_start_freq_hz + (a_delta_freq_hz * a_nof_increments))/1000);
+}
+
+void ad5933_set_settling( ad5933_dev* a_dev, unsigned int a_cycles ) {
+
+	if(a_cycles > AD5933_SETTLE_MAX) {
+		a_cycles = AD5933_SETTLE_MAX;
 	}
+
+	a_dev->data.delay_value = AD5933_SETTLE_CODE(a_cycles);
 }
 
+void ad5933_set_settle_profile( ad5933_dev* a_dev, const ad5933_settle_profile* a_profile_p ) {
+
+	a_dev->settle_p = a_profile_p;
+}
+
+/**
+ * @brief Profile band of a frequency, the last band above its top
+ *
+ * @param a_dev a device
+ * @param a_freq_code a frequency code
+ *
+ */
+static unsigned char ad5933_settle_band( ad5933_dev* a_dev, unsigned long a_freq_code ) {
+
+	unsigned char i;
+
+	for(i = 0; (i + 1) < a_dev->settle_p->num; i++) {
+		if(a_freq_code <= a_dev->settle_p->band_top[i]) {
+			break;
+		}
+	}
+
+	return i;
+}
+
+/**
+ * @brief Largest profile settling of a frequency range
+ *
+ * @param a_dev a device
+ * @param a_low_code a lowest frequency code
+ * @param a_high_code a highest frequency code
+ *
+ * @return NUM_SETTLE value
+ */
+static unsigned int ad5933_settle_profile_code( ad5933_dev* a_dev, unsigned long a_low_code, unsigned long a_high_code ) {
+
+	unsigned char i = ad5933_settle_band(a_dev, a_low_code);
+	unsigned char last = ad5933_settle_band(a_dev, a_high_code);
+	unsigned int code = a_dev->settle_p->code[i];
+
+	for(i++; i <= last; i++) {
+		if(AD5933_SETTLE_CYCLES(a_dev->settle_p->code[i]) > AD5933_SETTLE_CYCLES(code)) {
+			code = a_dev->settle_p->code[i];
+		}
+	}
+
+	return code;
+}
+
+/**
+ * @brief Update a sweep register in the shadow map
+ *
+ * @param a_reg_addr a register address
+ * @param a_data a data byte
+ *
+ */
+static void ad5933_shadow_set( ad5933_dev* a_dev, unsigned char a_reg_addr, unsigned char a_data ) {
+
+	unsigned char i = a_reg_addr - AD5933_SHADOW_FIRST;
+
+	if(a_dev->shadow[i] != a_data) {
+		a_dev->shadow[i] = a_data;
+		a_dev->shadow_dirty |= (1 << i);
+	}
+}
+
+/**
+ * @brief Take the next run of dirty sweep registers
+ *
+ * Dirty registers closer than AD5933_SHADOW_MERGE_GAP clean registers are
+ * sent in the same block write, rewriting the clean ones in between is
+ * cheaper than a new pointer and block write transaction.
+ *
+ * @param a_dev a device
+ * @param a_first_p a first register of the run, shadow index
+ *
+ * @return number of registers in the run
+ */
+static unsigned char ad5933_shadow_run( ad5933_dev* a_dev, unsigned char* a_first_p ) {
+
+	unsigned char first, last, i;
+
+	//Find the first dirty register
+	for(i = 0; !(a_dev->shadow_dirty & (1 << i)); i++);
+	first = i;
+	last = i;
+
+	//Extend the run over dirty registers and short clean gaps
+	for(i = first + 1; i < AD5933_SHADOW_SIZE; i++) {
+		if(a_dev->shadow_dirty & (1 << i)) {
+			last = i;
+		}
+		else if((i - last) > AD5933_SHADOW_MERGE_GAP) {
+			break;
+		}
+	}
+
+	for(i = first; i <= last; i++) {
+		a_dev->shadow_dirty &= ~(1 << i);
+	}
+
+	*a_first_p = first;
+	return last - first + 1;
+}
+
+/**
+ * @brief Write the dirty sweep registers to the AD5933
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_shadow_flush( ad5933_dev* a_dev ) {
+
+	unsigned char first, num;
+
+	while(a_dev->shadow_dirty) {
+		num = ad5933_shadow_run(a_dev, &first);
+		ad5933_write_block(a_dev, AD5933_SHADOW_FIRST + first, num, &a_dev->shadow[first]);
+	}
+}
+
+/**
+ * @brief Queue the write of the next run of dirty sweep registers
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_async_shadow( ad5933_dev* a_dev ) {
+
+	unsigned char first, num, i;
+
+	num = ad5933_shadow_run(a_dev, &first);
+
+	a_dev->op = AD5933_OP_SHADOW;
+	a_dev->op_arg[0] = first;
+	a_dev->op_arg[1] = num;
+
+	a_dev->ptr_cmd[0] = AD5933_ADDR_PTR;
+	a_dev->ptr_cmd[1] = AD5933_SHADOW_FIRST + first;
+	a_dev->tx_buf[0] = AD5933_BLOCK_WR;
+	a_dev->tx_buf[1] = num;
+	for(i = 0; i < num; i++) {
+		a_dev->tx_buf[i + 2] = a_dev->shadow[first + i];
+	}
+
+	ad5933_async_begin(a_dev);
+	if(!ad5933_pointer_at(a_dev, a_dev->ptr_cmd[1])) {
+		ad5933_async_add(a_dev, SLA_W, a_dev->ptr_cmd, 2, 0, 0);
+		ad5933_pointer_track(a_dev, a_dev->ptr_cmd[1]);
+	}
+	ad5933_async_add(a_dev, SLA_W, a_dev->tx_buf, num + 2, 0, 0);
+	ad5933_async_submit(a_dev);
+}
+
+/**
+ * @brief Load the sweep settings in the shadow map
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_shadow_sweep( ad5933_dev* a_dev ) {
+
+	//Convert start frequency data to register map
+	ad5933_shadow_set(a_dev, AD5933_FREQ_HIGH, (0x000000ff & (a_dev->data.frequency_start>>16)));
+	ad5933_shadow_set(a_dev, AD5933_FREQ_MID, (0x000000ff & (a_dev->data.frequency_start>>8)));
+	ad5933_shadow_set(a_dev, AD5933_FREQ_LOW, (0x000000ff & a_dev->data.frequency_start));
+	
+	//Convert delta frequency data to register map
+	ad5933_shadow_set(a_dev, AD5933_FREQ_INC_HIGH, (0x000000ff & (a_dev->data.delta_frequency>>16)));
+	ad5933_shadow_set(a_dev, AD5933_FREQ_INC_MID, (0x000000ff & (a_dev->data.delta_frequency>>8)));
+	ad5933_shadow_set(a_dev, AD5933_FREQ_INC_LOW, (0x000000ff & a_dev->data.delta_frequency));
+	
+	//Convert number of increments data to register map
+	ad5933_shadow_set(a_dev, AD5933_NUM_INC_HIGH, (0x000000ff & (a_dev->data.number_of_increments>>8)));
+	ad5933_shadow_set(a_dev, AD5933_NUM_INC_LOW, (0x000000ff & a_dev->data.number_of_increments));
+	
+	//Settling of the bands covered by the sweep
+	if(a_dev->settle_p && a_dev->settle_p->num) {
+		a_dev->data.delay_value = ad5933_settle_profile_code(a_dev, a_dev->data.frequency_start,
+			a_dev->data.frequency_start + (a_dev->data.delta_frequency * a_dev->data.number_of_increments));
+	}
+	
+	//Convert delay data to register map
+	ad5933_shadow_set(a_dev, AD5933_NUM_SETTLE_HIGH, (0x000000ff & (a_dev->data.delay_value>>8)));
+	ad5933_shadow_set(a_dev, AD5933_NUM_SETTLE_LOW, (0x000000ff & a_dev->data.delay_value));
+}
+
+/**
+ * @brief Load the plan segment starting at plan_base in the sweep settings
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_plan_load( ad5933_dev* a_dev ) {
+
+	unsigned int num;
+	unsigned char band;
+
+	num = ad5933_plan_segment(&a_dev->plan_p[a_dev->plan_base], a_dev->plan_num - a_dev->plan_base, a_dev->plan_tol,
+		&a_dev->data.frequency_start, &a_dev->data.delta_frequency);
+
+	//End the segment at the settling band edge, the start and increment still fit the shorter segment
+	if(a_dev->settle_p && a_dev->settle_p->num) {
+		band = ad5933_settle_band(a_dev, a_dev->plan_p[a_dev->plan_base]);
+		while((num > 1) && (ad5933_settle_band(a_dev, a_dev->plan_p[a_dev->plan_base + num - 1]) != band)) {
+			num--;
+		}
+	}
+
+	a_dev->data.number_of_increments = num - 1;
+}
+
+void ad5933_set_plan( ad5933_dev* a_dev, const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol ) {
+
+	a_dev->plan_p = (a_num > 0) ? a_codes_p : NULL;
+	a_dev->plan_num = a_num;
+	a_dev->plan_tol = a_tol;
+	a_dev->plan_base = 0;
+
+	if(a_dev->plan_p) {
+		ad5933_plan_load(a_dev);
+	}
+}
+
+void ad5933_config_measure( ad5933_dev* a_dev ) {
+
+	//Back to the first plan segment
+	if(a_dev->plan_p) {
+		a_dev->plan_base = 0;
+		ad5933_plan_load(a_dev);
+	}
+
+	ad5933_shadow_sweep(a_dev);
+
+	//Program the changed registers
+	ad5933_shadow_flush(a_dev);
+	
+	//Place AD5933 in Stand-by mode
+	ad5933_write_byte(a_dev, AD5933_CTRL_HIGH, a_dev->cfg|AD5933_STANDBY);
+	ad5933_power_set(a_dev, AD5933_POWER_STANDBY);
+	
+	//Set measure trigger to IDLE
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_IDLE;
+}
+
+void ad5933_config_sweep( ad5933_dev* a_dev, const ad5933_sweep_config* a_config_p ) {
+
+	ad5933_sweep_config config;
+	unsigned char i;
+
+	hal_flash_read(&config, a_config_p, sizeof(config));
+
+	//Registers straight from the image
+	for(i = 0; i < AD5933_SHADOW_SIZE; i++) {
+		ad5933_shadow_set(a_dev, AD5933_SHADOW_FIRST + i, config.regs[i]);
+	}
+
+	//Sweep settings for the records and the timing
+	a_dev->data.frequency_start = ((unsigned long)config.regs[AD5933_FREQ_HIGH - AD5933_SHADOW_FIRST] << 16) |
+		((unsigned long)config.regs[AD5933_FREQ_MID - AD5933_SHADOW_FIRST] << 8) | config.regs[AD5933_FREQ_LOW - AD5933_SHADOW_FIRST];
+	a_dev->data.delta_frequency = ((unsigned long)config.regs[AD5933_FREQ_INC_HIGH - AD5933_SHADOW_FIRST] << 16) |
+		((unsigned long)config.regs[AD5933_FREQ_INC_MID - AD5933_SHADOW_FIRST] << 8) | config.regs[AD5933_FREQ_INC_LOW - AD5933_SHADOW_FIRST];
+	a_dev->data.number_of_increments = ((unsigned int)(config.regs[AD5933_NUM_INC_HIGH - AD5933_SHADOW_FIRST] & 0x01) << 8) | config.regs[AD5933_NUM_INC_LOW - AD5933_SHADOW_FIRST];
+	a_dev->data.delay_value = ((unsigned int)(config.regs[AD5933_NUM_SETTLE_HIGH - AD5933_SHADOW_FIRST] & 0x07) << 8) | config.regs[AD5933_NUM_SETTLE_LOW - AD5933_SHADOW_FIRST];
+	a_dev->plan_p = NULL;
+	a_dev->plan_base = 0;
+
+	a_dev->cfg = config.cfg & AD5933_CFG_MASK;
+	if(a_dev->rfb != config.rfb) {
+		ad5933_set_rfb(a_dev, config.rfb);
+	}
+
+	//Program the changed registers
+	ad5933_shadow_flush(a_dev);
+	
+	//Place AD5933 in Stand-by mode
+	ad5933_write_byte(a_dev, AD5933_CTRL_HIGH, a_dev->cfg|AD5933_STANDBY);
+	ad5933_power_set(a_dev, AD5933_POWER_STANDBY);
+	
+	//Set measure trigger to IDLE
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_IDLE;
+}
+
+/**
+ * @brief Output bias settling time of a output range
+ *
+ * @param a_cfg a control register configuration
+ *
+ */
+static unsigned long ad5933_bias_time_us( unsigned char a_cfg ) {
+
+	switch(a_cfg & AD5933_VRANGE_1V) {
+	case AD5933_VRANGE_200mV:
+		return AD5933_BIAS_SETTLE_US_200mV;
+	case AD5933_VRANGE_400mV:
+		return AD5933_BIAS_SETTLE_US_400mV;
+	case AD5933_VRANGE_1V:
+		return AD5933_BIAS_SETTLE_US_1V;
+	default:
+		return AD5933_BIAS_SETTLE_US_2V;
+	}
+}
+
+/**
+ * @brief Duration of the programmed settling cycles
+ *
+ * @param a_dev a device
+ * @param a_freq_code a frequency code
+ *
+ */
+static unsigned long ad5933_cycles_time_us( ad5933_dev* a_dev, unsigned long a_freq_code ) {
+
+	unsigned long khz_code;
+
+	//Settling cycles period in us, cycles * 1000 / f_KHz
+	khz_code = a_freq_code / 1000;
+	if(khz_code == 0) {
+		khz_code = 1;
+	}
+
+	return ((unsigned long)AD5933_SETTLE_CYCLES(a_dev->data.delay_value) * AD5933_CODE_PER_KHZ) / khz_code;
+}
+
+/**
+ * @brief Excitation settling time needed after INIT
+ *
+ * Output bias settling of the selected range plus the programmed settling
+ * cycles at the start frequency.
+ *
+ * @param a_dev a device
+ *
+ */
+static unsigned long ad5933_settle_time_us( ad5933_dev* a_dev ) {
+
+	return ad5933_bias_time_us(a_dev->cfg) + ad5933_cycles_time_us(a_dev, a_dev->data.frequency_start);
+}
+
+/**
+ * @brief Start the DFT of the current point
+ *
+ * The status is not polled before the settling cycles and the DFT of the
+ * point are over, leaving the bus to the other devices.
+ *
+ * @param a_dev a device
+ * @param a_command a control register function
+ *
+ */
+static void ad5933_start_point( ad5933_dev* a_dev, unsigned char a_command ) {
+
+	unsigned long freq_code;
+
+	ad5933_async_command(a_dev, a_command);
+	AD5933_STAT_ADD(a_dev, conversions, 1);
+	a_dev->point_time = hal_time_us();
+
+	freq_code = a_dev->data.frequency_start + (a_dev->data.delta_frequency * a_dev->sweep_index);
+	a_dev->deadline = hal_time_us() + AD5933_CMD_TIME_US + ad5933_cycles_time_us(a_dev, freq_code) + AD5933_DFT_TIME_US;
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_DFT_WAIT;
+}
+
+/**
+ * @brief Start the excitation at the start frequency
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_sweep_init( ad5933_dev* a_dev ) {
+
+	//Init AD5933 with Start frequency, 2Vpp and PGA x1
+	ad5933_async_command(a_dev, AD5933_INIT);
+	ad5933_power_set(a_dev, AD5933_POWER_ON);
+
+	//Schedule the sweep once the excitation is settled
+	a_dev->deadline = hal_time_us() + ad5933_settle_time_us(a_dev);
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_SETTLING;
+}
+
+/**
+ * @brief Move the device to a step of the gain ladder
+ *
+ * The control register is written with a no operation function, the
+ * sweep keeps its current frequency.
+ *
+ * @param a_dev a device
+ * @param a_step a ladder step
+ *
+ */
+static void ad5933_range_apply( ad5933_dev* a_dev, unsigned char a_step ) {
+
+	unsigned char setting = g_ad5933_range_ladder[a_step];
+
+	a_dev->range_step = a_step;
+	a_dev->cfg = setting & AD5933_CFG_MASK;
+
+	if(a_dev->rfb != (setting >> 7)) {
+		ad5933_set_rfb(a_dev, setting >> 7);
+	}
+
+	ad5933_async_command(a_dev, AD5933_NOP);
+}
+
+/**
+ * @brief Check the point just read against the auto-range limits
+ *
+ * @param a_dev a device
+ *
+ * @return 1 when the range was changed and the point must be measured again
+ */
+static unsigned char ad5933_autorange( ad5933_dev* a_dev ) {
+
+	long real = a_dev->data.data_real;
+	long imaginary = a_dev->data.data_imaginary;
+	unsigned long magnitude;
+	signed char dir = 0;
+
+	magnitude = (unsigned long)(real * real) + (unsigned long)(imaginary * imaginary);
+
+	//Saturated or close to, less gain
+	if((real >= AD5933_RANGE_SAT_LEVEL) || (real <= -AD5933_RANGE_SAT_LEVEL) || (imaginary >= AD5933_RANGE_SAT_LEVEL) || (imaginary <= -AD5933_RANGE_SAT_LEVEL) ||
+		(magnitude > ((unsigned long)AD5933_RANGE_MAG_HIGH * AD5933_RANGE_MAG_HIGH))) {
+		if(a_dev->range_step > 0) {
+			dir = -1;
+		}
+	}
+	//Close to the noise floor, more gain
+	else if(magnitude < ((unsigned long)AD5933_RANGE_MAG_LOW * AD5933_RANGE_MAG_LOW)) {
+		if(a_dev->range_step < (AD5933_RANGE_STEPS - 1)) {
+			dir = 1;
+		}
+	}
+
+	if((dir == 0) || (a_dev->range_changes >= AD5933_RANGE_RETRIES)) {
+		return 0;
+	}
+
+	//Turning back means no step fits, settle on the lower gain one
+	if(a_dev->range_dir && (dir != a_dev->range_dir)) {
+		a_dev->range_changes = AD5933_RANGE_RETRIES;
+		if(dir > 0) {
+			return 0;
+		}
+	}
+	else {
+		a_dev->range_changes++;
+	}
+
+	a_dev->range_dir = dir;
+	ad5933_range_apply(a_dev, a_dev->range_step + dir);
+
+	//Samples taken on the old range are dropped
+	a_dev->avg_num = 0;
+
+	//Let the output bias settle before the repeat
+	a_dev->deadline = hal_time_us() + ad5933_bias_time_us(a_dev->cfg);
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_RANGE_SETTLING;
+
+	return 1;
+}
+
+/**
+ * @brief Check the spread of one averaged component
+ *
+ * The squared deviations around the mean must stay below the target
+ * standard error of the mean, noise^2 * n * (n - 1).
+ *
+ * @param a_sum a sum of the deviations from the first sample
+ * @param a_sq a sum of the squared deviations
+ * @param a_num a number of samples
+ * @param a_noise a target standard error of the mean
+ *
+ * @return 1 when the target is reached
+ */
+static unsigned char ad5933_avg_settled( long a_sum, unsigned long a_sq, unsigned char a_num, unsigned char a_noise ) {
+
+	unsigned long m2;
+	
+	m2 = a_sq - (unsigned long)((a_sum / a_num) * a_sum);
+
+	return (m2 <= ((unsigned long)a_noise * a_noise * a_num * (a_num - 1)));
+}
+
+/**
+ * @brief Add the point just read to the running average
+ *
+ * The sums are kept around the first sample so they fit in 32 bit. When
+ * averaging is done the mean is left in the device data.
+ *
+ * @param a_dev a device
+ *
+ * @return 1 when the point needs more samples
+ */
+static unsigned char ad5933_average( ad5933_dev* a_dev ) {
+
+	long d_real, d_imag;
+
+	if(a_dev->avg_num == 0) {
+		a_dev->avg_real0 = (short)a_dev->data.data_real;
+		a_dev->avg_imag0 = (short)a_dev->data.data_imaginary;
+		a_dev->avg_sum_real = 0;
+		a_dev->avg_sum_imag = 0;
+		a_dev->avg_sq_real = 0;
+		a_dev->avg_sq_imag = 0;
+	}
+
+	d_real = a_dev->data.data_real - a_dev->avg_real0;
+	d_imag = a_dev->data.data_imaginary - a_dev->avg_imag0;
+
+	//Outliers are clamped, they still show as a large variance
+	if(d_real > AD5933_AVG_DEV_LIMIT) d_real = AD5933_AVG_DEV_LIMIT;
+	if(d_real < -AD5933_AVG_DEV_LIMIT) d_real = -AD5933_AVG_DEV_LIMIT;
+	if(d_imag > AD5933_AVG_DEV_LIMIT) d_imag = AD5933_AVG_DEV_LIMIT;
+	if(d_imag < -AD5933_AVG_DEV_LIMIT) d_imag = -AD5933_AVG_DEV_LIMIT;
+
+	a_dev->avg_num++;
+	a_dev->avg_sum_real += d_real;
+	a_dev->avg_sum_imag += d_imag;
+	a_dev->avg_sq_real += (unsigned long)(d_real * d_real);
+	a_dev->avg_sq_imag += (unsigned long)(d_imag * d_imag);
+
+	if(a_dev->avg_num < a_dev->avg_max) {
+		
+		if(a_dev->avg_num < AD5933_AVG_MIN_SAMPLES) {
+			return 1;
+		}
+
+		if(!ad5933_avg_settled(a_dev->avg_sum_real, a_dev->avg_sq_real, a_dev->avg_num, a_dev->avg_noise) ||
+			!ad5933_avg_settled(a_dev->avg_sum_imag, a_dev->avg_sq_imag, a_dev->avg_num, a_dev->avg_noise)) {
+			return 1;
+		}
+	}
+
+	//Rounded mean
+	a_dev->data.data_real = a_dev->avg_real0 + (a_dev->avg_sum_real + ((a_dev->avg_sum_real < 0) ? -(a_dev->avg_num / 2) : (a_dev->avg_num / 2))) / a_dev->avg_num;
+	a_dev->data.data_imaginary = a_dev->avg_imag0 + (a_dev->avg_sum_imag + ((a_dev->avg_sum_imag < 0) ? -(a_dev->avg_num / 2) : (a_dev->avg_num / 2))) / a_dev->avg_num;
+
+	return 0;
+}
+
+/**
+ * @brief Start a new sweep point, clears the range and averaging state
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_new_point( ad5933_dev* a_dev ) {
+
+	a_dev->range_changes = 0;
+	a_dev->range_dir = 0;
+	a_dev->avg_num = 0;
+}
+
+/**
+ * @brief Append the current point to the record buffer
+ *
+ * @param a_dev a device
+ * @param a_status a AD5933 status register value
+ *
+ */
+static void ad5933_store_record( ad5933_dev* a_dev, unsigned char a_status ) {
+
+	ad5933_record* record = &a_dev->records[a_dev->record_head & (AD5933_RECORD_BUFFER_SIZE - 1)];
+
+	record->index = a_dev->plan_base + a_dev->sweep_index;
+	record->frequency_code = a_dev->data.frequency_start + (a_dev->data.delta_frequency * a_dev->sweep_index);
+	record->real = (short)a_dev->data.data_real;
+	record->imaginary = (short)a_dev->data.data_imaginary;
+	record->status = a_status | a_dev->point_flags;
+	record->setting = AD5933_SETTING(a_dev->cfg, a_dev->rfb);
+	record->samples = (a_dev->avg_max > 1) ? a_dev->avg_num : 1;
+	record->temperature = a_dev->temperature;
+	if((a_dev->temperature == AD5933_TEMP_UNKNOWN) || (a_dev->temp_max_age && ((hal_time_us() - a_dev->temp_time) > a_dev->temp_max_age))) {
+		record->status |= AD5933_REC_TEMP_STALE;
+	}
+	a_dev->record_head++;
+	a_dev->energy_points++;
+	a_dev->point_flags = 0;
+	AD5933_STAT_ADD(a_dev, points, 1);
+}
+
+/**
+ * @brief Append the current point to the tracking ring
+ *
+ * @param a_dev a device
+ * @param a_status a AD5933 status register value
+ *
+ */
+static void ad5933_track_store( ad5933_dev* a_dev, unsigned char a_status ) {
+
+	ad5933_sample* sample = &a_dev->track_p[a_dev->track_head & (a_dev->track_size - 1)];
+
+	sample->time_us = a_dev->point_time;
+	sample->real = (short)a_dev->data.data_real;
+	sample->imaginary = (short)a_dev->data.data_imaginary;
+	sample->status = a_status | a_dev->point_flags;
+	sample->setting = AD5933_SETTING(a_dev->cfg, a_dev->rfb);
+	a_dev->track_head++;
+
+	if(a_dev->track_count == 0) {
+		a_dev->track_first = a_dev->point_time;
+	}
+	a_dev->track_last = a_dev->point_time;
+	a_dev->track_count++;
+
+	a_dev->energy_points++;
+	a_dev->point_flags = 0;
+	AD5933_STAT_ADD(a_dev, points, 1);
+}
+
+/**
+ * @brief Store the point read by the burst as a sweep record
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_measure_point( ad5933_dev* a_dev ) {
+
+	unsigned char reg_val = a_dev->poll_status;
+	unsigned char* a_data_buf = a_dev->rx_buf;
+
+	//16 bit 2's complement format data
+	a_dev->data.data_real = (short)((a_data_buf[AD5933_REAL_HIGH - AD5933_BURST_START] << 8) | a_data_buf[AD5933_REAL_LOW - AD5933_BURST_START]);
+	a_dev->data.data_imaginary = (short)((a_data_buf[AD5933_IMAG_HIGH - AD5933_BURST_START] << 8) | a_data_buf[AD5933_IMAG_LOW - AD5933_BURST_START]);
+
+#ifdef AD5933_BURST_STATUS
+	//Status read with the data
+	reg_val = a_data_buf[0];
+#endif
+
+	//Measure the point again on a better range
+	if(a_dev->autorange && ad5933_autorange(a_dev)) {
+		return;
+	}
+
+	//Same frequency again until the average is good enough
+	if((a_dev->avg_max > 1) && ad5933_average(a_dev)) {
+		ad5933_start_point(a_dev, AD5933_REPEAT_FREQ);
+		return;
+	}
+
+	//Tracking, the excitation keeps running at the same frequency
+	if(a_dev->track_state != AD5933_TRACK_OFF) {
+		ad5933_track_store(a_dev, reg_val);
+
+		if(a_dev->track_state == AD5933_TRACK_RUN) {
+			ad5933_new_point(a_dev);
+			ad5933_start_point(a_dev, AD5933_REPEAT_FREQ);
+		}
+		else {
+			a_dev->track_state = AD5933_TRACK_OFF;
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_STOP_MEASURE;
+		}
+		return;
+	}
+
+	//Append the point to the record buffer
+	ad5933_store_record(a_dev, reg_val);
+
+	//Check if sweep is done
+	if((reg_val & AD5933_STAT_SWEEP_DONE) == AD5933_STAT_SWEEP_DONE) {
+	
+		//Next plan segment or stop mode
+		if(a_dev->plan_p && ((a_dev->plan_base + a_dev->sweep_index + 1) < a_dev->plan_num)) {
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_PLAN_NEXT;
+		}
+		else {
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_STOP_MEASURE;
+		}
+	}
+	else {
+	
+		//Set trigger to next Sweep frequency
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_FREQUENCY_SWEEP_NEXT;
+	}
+}
+
+/**
+ * @brief Queue the failed step again
+ *
+ * @param a_dev a device
+ *
+ */
+static void ad5933_async_replay( ad5933_dev* a_dev ) {
+
+	if(a_dev->op == AD5933_OP_COMMAND) {
+		ad5933_async_command(a_dev, a_dev->op_arg[0]);
+	}
+	else if(a_dev->op == AD5933_OP_READ) {
+		ad5933_async_read(a_dev, a_dev->op_arg[0], a_dev->op_arg[1]);
+	}
+	else {
+		//Mark the run dirty again
+		a_dev->shadow_dirty |= ((1 << a_dev->op_arg[1]) - 1) << a_dev->op_arg[0];
+		ad5933_async_shadow(a_dev);
+	}
+}
+
+/**
+ * @brief Handle a failed step
+ *
+ * The step is queued again after AD5933_RETRY_BACKOFF_US, doubled on
+ * every retry. Once AD5933_RETRY_MAX retries failed, the point is stored
+ * with AD5933_REC_FAILED and the sweep stopped.
+ *
+ * @param a_dev a device
+ *
+ * @return 1 while the step is retried
+ */
+static unsigned char ad5933_async_retry( ad5933_dev* a_dev ) {
+
+	unsigned char i;
+
+	if(a_dev->retry_wait) {
+		if((long)(hal_time_us() - a_dev->retry_at) < 0) {
+			return 1;
+		}
+
+		a_dev->retry_wait = 0;
+		a_dev->retry_num++;
+		ad5933_async_replay(a_dev);
+		return 1;
+	}
+
+	//Mux state and pointer locations unknown after a failed transaction
+	ad5933_bus_error();
+
+	for(i = 0; i < a_dev->xfer_num; i++) {
+		if((a_dev->xfer[i].status == E_TWI_XFER_ERROR) && (a_dev->xfer[i].twsr == TWI_TWSR_TIMEOUT)) {
+			a_dev->point_flags |= AD5933_REC_TIMEOUT;
+		}
+	}
+
+	if(a_dev->retry_num < AD5933_RETRY_MAX) {
+		a_dev->point_flags |= AD5933_REC_RETRIED;
+		a_dev->retry_at = hal_time_us() + (AD5933_RETRY_BACKOFF_US << a_dev->retry_num);
+		a_dev->retry_wait = 1;
+		return 1;
+	}
+
+	//Give up, the failed step is forgotten
+	a_dev->xfer_num = 0;
+	a_dev->retry_num = 0;
+
+	//A failed temperature measurement does not stop the sweep
+	if((a_dev->data.measure_trigger >= E_FLAGS_AD5933_TEMP_WAIT) && (a_dev->data.measure_trigger <= E_FLAGS_AD5933_TEMP_READ)) {
+		ad5933_temp_abort(a_dev);
+	}
+	else if((a_dev->data.measure_trigger != E_FLAGS_AD5933_IDLE) && (a_dev->data.measure_trigger != E_FLAGS_AD5933_STOP_MEASURE)) {
+		a_dev->data.data_real = 0;
+		a_dev->data.data_imaginary = 0;
+		a_dev->point_flags |= AD5933_REC_FAILED;
+		if(a_dev->track_state != AD5933_TRACK_OFF) {
+			ad5933_track_store(a_dev, 0);
+			a_dev->track_state = AD5933_TRACK_OFF;
+		}
+		else {
+			ad5933_store_record(a_dev, 0);
+		}
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_STOP_MEASURE;
+	}
+
+	return 0;
+}
+
+unsigned char ad5933_records_available( ad5933_dev* a_dev ) {
+
+	return (unsigned char)(a_dev->record_head - a_dev->record_tail);
+}
+
+unsigned char ad5933_peek_record( ad5933_dev* a_dev, ad5933_record* a_record_p ) {
+
+	if(a_dev->record_tail == a_dev->record_head) {
+		return 0;
+	}
+
+	*a_record_p = a_dev->records[a_dev->record_tail & (AD5933_RECORD_BUFFER_SIZE - 1)];
+	return 1;
+}
+
+unsigned char ad5933_read_records( ad5933_dev* a_dev, ad5933_record* a_record_p, unsigned char a_max_num ) {
+
+	unsigned char i;
+	
+	for(i = 0; (i < a_max_num) && (a_dev->record_tail != a_dev->record_head); i++) {
+		a_record_p[i] = a_dev->records[a_dev->record_tail & (AD5933_RECORD_BUFFER_SIZE - 1)];
+		a_dev->record_tail++;
+	}
+	
+	return i;
+}
+
+unsigned char ad5933_track_start( ad5933_dev* a_dev, unsigned long a_freq_hz, ad5933_sample* a_buf_p, unsigned int a_size ) {
+
+	//A running sweep keeps its plan, registers and trigger
+	if((a_dev->data.measure_trigger != E_FLAGS_AD5933_IDLE) || (a_size == 0)) {
+		return 0;
+	}
+
+	//The ring is indexed with a mask, keep the highest power of two
+	while(a_size & (a_size - 1)) {
+		a_size &= a_size - 1;
+	}
+
+	a_dev->track_p = a_buf_p;
+	a_dev->track_size = a_size;
+	a_dev->track_head = 0;
+	a_dev->track_tail = 0;
+	a_dev->track_count = 0;
+	a_dev->track_state = AD5933_TRACK_RUN;
+
+	//One point, no increment, START writes the changed registers
+	a_dev->plan_p = NULL;
+	a_dev->plan_base = 0;
+	a_dev->data.frequency_start = ad5933_freq_code(a_freq_hz);
+	a_dev->data.delta_frequency = 0;
+	a_dev->data.number_of_increments = 0;
+	ad5933_shadow_sweep(a_dev);
+
+	a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	return 1;
+}
+
+void ad5933_track_stop( ad5933_dev* a_dev ) {
+
+	if(a_dev->track_state == AD5933_TRACK_RUN) {
+		a_dev->track_state = AD5933_TRACK_STOP;
+	}
+}
+
+unsigned int ad5933_track_read( ad5933_dev* a_dev, ad5933_sample* a_sample_p, unsigned int a_max_num ) {
+
+	unsigned int i;
+
+	for(i = 0; (i < a_max_num) && (a_dev->track_tail != a_dev->track_head); i++) {
+		a_sample_p[i] = a_dev->track_p[a_dev->track_tail & (a_dev->track_size - 1)];
+		a_dev->track_tail++;
+	}
+
+	return i;
+}
+
+unsigned long ad5933_track_rate( ad5933_dev* a_dev ) {
+
+	if((a_dev->track_count < 2) || (a_dev->track_last == a_dev->track_first)) {
+		return 0;
+	}
+
+	return ((a_dev->track_count - 1) * 1000000ULL) / (a_dev->track_last - a_dev->track_first);
+}
+
+void ad5933_proc_data( ad5933_dev* a_dev ) {
+
+	unsigned char status;
+
+	//Hold the sweep on the current point while the record buffer is full
+	if(ad5933_records_available(a_dev) >= AD5933_RECORD_BUFFER_SIZE) {
+		return;
+	}
+	
+	//Hold the tracking while the sample ring is full
+	if((a_dev->track_state != AD5933_TRACK_OFF) && ((unsigned int)(a_dev->track_head - a_dev->track_tail) >= a_dev->track_size)) {
+		return;
+	}
+	
+	//Bus transactions of the last step still running
+	status = ad5933_async_status(a_dev);
+	if(status == E_TWI_XFER_PENDING) {
+		twi_check_timeout();
+		return;
+	}
+	
+	//Failed step, queued again after a delay or the point given up
+	if(status == E_TWI_XFER_ERROR) {
+		if(ad5933_async_retry(a_dev)) {
+			return;
+		}
+	}
+	else {
+		a_dev->retry_num = 0;
+	}
+	
+	//Start measure
+	if(a_dev->data.measure_trigger == E_FLAGS_AD5933_START_MEASURE) {
+		
+		//Sweep registers changed since the configuration, one run per step
+		if(a_dev->shadow_dirty) {
+			ad5933_async_shadow(a_dev);
+			return;
+		}
+		
+		//Temperature first when it is due, the start comes back afterwards
+		if(ad5933_temp_refresh(a_dev)) {
+			return;
+		}
+		
+#ifdef AD5933_STATS
+		memset(&a_dev->stats, 0, sizeof(a_dev->stats));
+		a_dev->stats.start_us = hal_time_us();
+		twi_stats_get(&a_dev->stats_bus);
+#endif
+
+		a_dev->point_flags = 0;
+
+		//Out of power down through standby, INIT once awake
+		if(a_dev->power == AD5933_POWER_DOWN) {
+			ad5933_async_command(a_dev, AD5933_STANDBY);
+			ad5933_power_set(a_dev, AD5933_POWER_STANDBY);
+			a_dev->deadline = hal_time_us() + AD5933_CMD_TIME_US + AD5933_WAKE_US;
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_WAKE;
+			return;
+		}
+
+		ad5933_sweep_init(a_dev);
+	}
+	
+	//Wait the wake up from power down
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_WAKE) {
+	
+		if((long)(hal_time_us() - a_dev->deadline) < 0) {
+			return;
+		}
+		
+		ad5933_sweep_init(a_dev);
+	}
+	
+	//Wait excitation settling
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_SETTLING) {
+	
+		if((long)(hal_time_us() - a_dev->deadline) < 0) {
+			return;
+		}
+	
+		//Send a frequency sweep command
+		a_dev->sweep_index = 0;
+		ad5933_new_point(a_dev);
+		ad5933_start_point(a_dev, AD5933_SWEEP);
+	}
+	
+	//Wait output bias after a range change, then measure the point again
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_RANGE_SETTLING) {
+	
+		if((long)(hal_time_us() - a_dev->deadline) < 0) {
+			return;
+		}
+		
+		ad5933_start_point(a_dev, AD5933_REPEAT_FREQ);
+	}
+	
+	//Wait DFT conversion, then poll the status
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_DFT_WAIT) {
+	
+		if((long)(hal_time_us() - a_dev->deadline) < 0) {
+			return;
+		}
+		
+		ad5933_async_read(a_dev, AD5933_STATUS, 1);
+		AD5933_STAT_ADD(a_dev, polls, 1);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_POLL;
+	}
+	
+	//Status read, burst read the data once the DFT is complete
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_POLL) {
+	
+		a_dev->poll_status = a_dev->rx_buf[0];
+		
+		if((a_dev->poll_status & AD5933_STAT_DATA_VALID) != AD5933_STAT_DATA_VALID) {
+			a_dev->deadline = hal_time_us() + AD5933_POLL_INTERVAL_US;
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_DFT_WAIT;
+			return;
+		}
+		
+		//Read Real and Imaginary registers in one burst
+		ad5933_async_read(a_dev, AD5933_BURST_START, AD5933_BURST_SIZE);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_READ;
+	}
+	
+	//Data read, store the point
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_READ) {
+	
+		ad5933_measure_point(a_dev);
+	}
+	
+	//Increment frequency
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_FREQUENCY_SWEEP_NEXT) {
+	
+		//Generate next frequency
+		a_dev->sweep_index++;
+		ad5933_new_point(a_dev);
+		ad5933_start_point(a_dev, AD5933_INCFREQ);
+	}
+	
+	//Next segment of the frequency plan
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_PLAN_NEXT) {
+	
+		a_dev->plan_base += a_dev->sweep_index + 1;
+		ad5933_plan_load(a_dev);
+		ad5933_shadow_sweep(a_dev);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_PLAN_LOAD;
+	}
+	
+	//Write the segment registers, one run per step
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_PLAN_LOAD) {
+	
+		if(a_dev->shadow_dirty) {
+			ad5933_async_shadow(a_dev);
+			return;
+		}
+
+		//Segment boundary, the only place inside a plan where the temperature is refreshed
+		if(ad5933_temp_refresh(a_dev)) {
+			return;
+		}
+
+		//Restart at the new start frequency, the output bias is already settled
+		ad5933_async_command(a_dev, AD5933_INIT);
+		a_dev->deadline = hal_time_us() + ad5933_cycles_time_us(a_dev, a_dev->data.frequency_start);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_SETTLING;
+	}
+	
+	//Repeat frequency
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_FREQUENCY_REPEAT) {
+	
+		//Measure the current frequency again
+		ad5933_new_point(a_dev);
+		ad5933_start_point(a_dev, AD5933_REPEAT_FREQ);
+	}
+	
+	//Wait temperature conversion, then poll the status
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_TEMP_WAIT) {
+	
+		if((long)(hal_time_us() - a_dev->deadline) < 0) {
+			return;
+		}
+		
+		ad5933_async_read(a_dev, AD5933_STATUS, 1);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_TEMP_POLL;
+	}
+	
+	//Status read, read the temperature once valid
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_TEMP_POLL) {
+	
+		if((a_dev->rx_buf[0] & AD5933_STAT_TEMP_VALID) != AD5933_STAT_TEMP_VALID) {
+			if((long)(hal_time_us() - a_dev->temp_end) >= 0) {
+				ad5933_temp_abort(a_dev);
+				return;
+			}
+			a_dev->deadline = hal_time_us() + AD5933_POLL_INTERVAL_US;
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_TEMP_WAIT;
+			return;
+		}
+		
+		ad5933_async_read(a_dev, AD5933_TEMP_HIGH, 2);
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_TEMP_READ;
+	}
+	
+	//Temperature read, back to the interrupted state
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_TEMP_READ) {
+	
+		ad5933_temp_store(a_dev, ((unsigned short)a_dev->rx_buf[0] << 8) | a_dev->rx_buf[1]);
+		a_dev->data.measure_trigger = a_dev->temp_return;
+	}
+	
+	//Periodic sweeps and temperature refresh between sweeps
+	else if(a_dev->data.measure_trigger == E_FLAGS_AD5933_IDLE) {
+	
+		if(a_dev->period && ((hal_time_us() - a_dev->period_start) >= a_dev->period)) {
+			
+			//Skip the periods missed by a long sweep
+			a_dev->period_start += a_dev->period;
+			if((hal_time_us() - a_dev->period_start) >= a_dev->period) {
+				a_dev->period_start = hal_time_us();
+			}
+			
+			//Back to the first plan segment, START writes the changed registers
+			if(a_dev->plan_p) {
+				a_dev->plan_base = 0;
+				ad5933_plan_load(a_dev);
+				ad5933_shadow_sweep(a_dev);
+			}
+			
+			a_dev->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+		}
+		else {
+			ad5933_temp_refresh(a_dev);
+		}
+	}
+	
+	//Stop measure process
+	if(a_dev->data.measure_trigger == E_FLAGS_AD5933_STOP_MEASURE) {
+	
+		//Power down the part, standby when the next periodic sweep is closer than the wake up
+		if(a_dev->period && ((long)(a_dev->period_start + a_dev->period - hal_time_us()) < (long)AD5933_WAKE_US)) {
+			ad5933_async_command(a_dev, AD5933_STANDBY);
+			ad5933_power_set(a_dev, AD5933_POWER_STANDBY);
+		}
+		else {
+			ad5933_async_command(a_dev, AD5933_PWR_DWN);
+			ad5933_power_set(a_dev, AD5933_POWER_DOWN);
+		}
+
+#ifdef AD5933_STATS
+		ad5933_get_sweep_stats(a_dev, &a_dev->stats);
+#endif
+		
+		//Set trigger to stop mode
+		a_dev->data.measure_trigger = E_FLAGS_AD5933_IDLE;
+	}
+}
+
+#ifdef AD5933_STATS
+void ad5933_get_sweep_stats( ad5933_dev* a_dev, ad5933_sweep_stats* a_stats_p ) {
+
+	twi_stats bus;
+
+	*a_stats_p = a_dev->stats;
+
+	//Finished sweeps keep their figures
+	if(a_dev->data.measure_trigger == E_FLAGS_AD5933_IDLE) {
+		return;
+	}
+
+	twi_stats_get(&bus);
+
+	a_stats_p->duration_us = hal_time_us() - a_dev->stats.start_us;
+	a_stats_p->bus.transactions = bus.transactions - a_dev->stats_bus.transactions;
+	a_stats_p->bus.bytes = bus.bytes - a_dev->stats_bus.bytes;
+	a_stats_p->bus.starts = bus.starts - a_dev->stats_bus.starts;
+	a_stats_p->bus.stops = bus.stops - a_dev->stats_bus.stops;
+	a_stats_p->bus.nacks = bus.nacks - a_dev->stats_bus.nacks;
+	a_stats_p->bus.bus_us = bus.bus_us - a_dev->stats_bus.bus_us;
+	a_stats_p->bus.wait_us = bus.wait_us - a_dev->stats_bus.wait_us;
+}
+
+unsigned long ad5933_stats_points_per_s( const ad5933_sweep_stats* a_stats_p ) {
+
+	if(a_stats_p->duration_us == 0) {
+		return 0;
+	}
+
+	return (a_stats_p->points * 1000000ULL) / a_stats_p->duration_us;
+}
+
+unsigned char ad5933_stats_bus_load( const ad5933_sweep_stats* a_stats_p ) {
+
+	if(a_stats_p->duration_us == 0) {
+		return 0;
+	}
+
+	return (a_stats_p->bus.bus_us * 100ULL) / a_stats_p->duration_us;
+}
+#endif
+
+unsigned char ad5933_sched_proc( ad5933_dev* const* a_dev_p, unsigned char a_dev_num ) {
+
+	unsigned char i;
+	unsigned char busy = 0;
+
+	//One step of every device, a device waiting for settling or DFT returns at once
+	for(i = 0; i < a_dev_num; i++) {
+
+		ad5933_proc_data(a_dev_p[i]);
+
+		if(a_dev_p[i]->data.measure_trigger != E_FLAGS_AD5933_IDLE) {
+			busy++;
+		}
+	}
+
+	return busy;
+}
+
+void ad5933_set_period( ad5933_dev* a_dev, unsigned long a_period_ms ) {
+
+	a_dev->period = a_period_ms * 1000UL;
+
+	//First sweep at once
+	a_dev->period_start = hal_time_us() - a_dev->period;
+}
+
+/**
+ * @brief Time of the next step of a device
+ *
+ * Settling, conversion and wake up waits are timed by the time base, the
+ * watchdog period is too loose for them.
+ *
+ * @param a_dev a device
+ * @param a_time_p a wake up time
+ * @param a_deep_p a 1 when the wait allows deep sleep
+ *
+ * @return 1 when the device waits for a_time_p, 0 when a step is due now
+ */
+static unsigned char ad5933_wake_time( ad5933_dev* a_dev, unsigned long* a_time_p, unsigned char* a_deep_p ) {
+
+	unsigned char trigger = a_dev->data.measure_trigger;
+	unsigned char status = ad5933_async_status(a_dev);
+	unsigned long now = hal_time_us();
+
+	*a_time_p = now + AD5933_SLEEP_MAX_US;
+	*a_deep_p = 0;
+
+	//Completed from TWI_vect, which wakes the MCU
+	if(status == E_TWI_XFER_PENDING) {
+		return 1;
+	}
+
+	if(status == E_TWI_XFER_ERROR) {
+		*a_time_p = a_dev->retry_at;
+		return a_dev->retry_wait;
+	}
+
+	if((trigger == E_FLAGS_AD5933_SETTLING) || (trigger == E_FLAGS_AD5933_RANGE_SETTLING) || (trigger == E_FLAGS_AD5933_DFT_WAIT) ||
+		(trigger == E_FLAGS_AD5933_TEMP_WAIT) || (trigger == E_FLAGS_AD5933_WAKE)) {
+		*a_time_p = a_dev->deadline;
+		return 1;
+	}
+
+	if(trigger != E_FLAGS_AD5933_IDLE) {
+		return 0;
+	}
+
+	//Next periodic sweep or temperature refresh
+	*a_deep_p = 1;
+	if(a_dev->period && ((long)(a_dev->period_start + a_dev->period - *a_time_p) < 0)) {
+		*a_time_p = a_dev->period_start + a_dev->period;
+	}
+	if(a_dev->temp_max_age && ((long)(a_dev->temp_try + a_dev->temp_max_age - *a_time_p) < 0)) {
+		*a_time_p = a_dev->temp_try + a_dev->temp_max_age;
+	}
+
+	return 1;
+}
+
+unsigned char ad5933_sched_sleep( ad5933_dev* const* a_dev_p, unsigned char a_dev_num ) {
+
+	unsigned char i;
+	unsigned char depth;
+	unsigned char deep = 1;
+	unsigned char dev_deep;
+	unsigned long now = hal_time_us();
+	unsigned long wake = now + AD5933_SLEEP_MAX_US;
+	unsigned long time;
+
+	for(i = 0; i < a_dev_num; i++) {
+
+		if(!ad5933_wake_time(a_dev_p[i], &time, &dev_deep)) {
+			return 0;
+		}
+		deep &= dev_deep;
+
+		if((long)(time - wake) < 0) {
+			wake = time;
+		}
+	}
+
+	if((long)(wake - now) <= 0) {
+		return 0;
+	}
+
+	//Deep sleep stops the bus and the serial port, only between sweeps
+	depth = hal_sleep_until(wake, deep && !twi_busy() && !hal_uart_busy());
+
+	g_ad5933_mcu_us[0] += now - g_ad5933_mcu_since;
+	g_ad5933_mcu_since = hal_time_us();
+	g_ad5933_mcu_us[depth] += g_ad5933_mcu_since - now;
+
+	return depth;
+}
+
+void ad5933_energy_reset( ad5933_dev* const* a_dev_p, unsigned char a_dev_num ) {
+
+	unsigned char i;
+
+	memset(g_ad5933_mcu_us, 0, sizeof(g_ad5933_mcu_us));
+	g_ad5933_mcu_since = hal_time_us();
+
+	for(i = 0; i < a_dev_num; i++) {
+		ad5933_power_set(a_dev_p[i], a_dev_p[i]->power);
+		memset(a_dev_p[i]->power_us, 0, sizeof(a_dev_p[i]->power_us));
+		a_dev_p[i]->energy_points = 0;
+	}
+}
+
+void ad5933_energy_get( ad5933_dev* const* a_dev_p, unsigned char a_dev_num, ad5933_energy* a_energy_p ) {
+
+	unsigned char i, j;
+	unsigned long long charge;
+
+	memset(a_energy_p, 0, sizeof(*a_energy_p));
+
+	a_energy_p->mcu_us[0] = g_ad5933_mcu_us[0] + (hal_time_us() - g_ad5933_mcu_since);
+	a_energy_p->mcu_us[HAL_SLEEP_IDLE] = g_ad5933_mcu_us[HAL_SLEEP_IDLE];
+	a_energy_p->mcu_us[HAL_SLEEP_DEEP] = g_ad5933_mcu_us[HAL_SLEEP_DEEP];
+
+	for(i = 0; i < a_dev_num; i++) {
+
+		//Time of the current state up to now
+		ad5933_power_set(a_dev_p[i], a_dev_p[i]->power);
+
+		for(j = 0; j < AD5933_POWER_NUM; j++) {
+			a_energy_p->dev_us[j] += a_dev_p[i]->power_us[j];
+		}
+		a_energy_p->points += a_dev_p[i]->energy_points;
+	}
+
+	//Charge in pC, uA times us
+	charge = a_energy_p->mcu_us[0] * AD5933_MCU_ACTIVE_UA + a_energy_p->mcu_us[HAL_SLEEP_IDLE] * AD5933_MCU_IDLE_UA +
+		a_energy_p->mcu_us[HAL_SLEEP_DEEP] * AD5933_MCU_DEEP_UA + a_energy_p->dev_us[AD5933_POWER_ON] * AD5933_ON_UA +
+		a_energy_p->dev_us[AD5933_POWER_STANDBY] * AD5933_STANDBY_UA + a_energy_p->dev_us[AD5933_POWER_DOWN] * AD5933_PWR_DWN_UA;
+
+	a_energy_p->energy_uj = (charge * AD5933_SUPPLY_MV) / 1000000000ULL;
+
+	if(a_energy_p->energy_uj) {
+		a_energy_p->points_per_j = (a_energy_p->points * 1000000ULL) / a_energy_p->energy_uj;
+	}
+}
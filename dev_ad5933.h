@@ -21,6 +21,7 @@
  
 #include <config.h>
 #include <common.h>
+#include "twi.h"
 
  /**
  * @file dev_ad5933.h 
@@ -42,6 +43,8 @@
 #define AD5933_PWR_DWN 0xa0					//Power down mode
 #define AD5933_STANDBY 0xb0					//Standby mode
 #define AD5933_RESET 0x10					//Reset Command
+#define AD5933_NOP 0x00						//No operation, loads range and PGA
+#define AD5933_EXT_CLK 0x08					//External system clock, control low byte
 
 #define AD5933_VRANGE_200mV 0x02 			//Output Voltage range 200mV
 #define AD5933_VRANGE_400mV 0x04 			//Output Voltage range 400mV
@@ -51,16 +54,63 @@
 #define AD5933_PGA_1X 0x01					//PGA gain x1
 #define AD5933_PGA_5X 0x00					//PGA gain x5
 
+#ifndef AD5933_BASE_CFG
 #define AD5933_BASE_CFG (AD5933_VRANGE_2V | AD5933_PGA_1X) //2Vpp and PGA x1
+#endif
+#define AD5933_CFG_MASK (AD5933_VRANGE_1V | AD5933_PGA_1X) //Range and PGA bits
+
+/* Range/PGA/ADG849 setting key */
+#define AD5933_SETTING(cfg, rfb) (((cfg) & AD5933_CFG_MASK) | ((rfb) << 7))
 
 #define AD5933_INT_OSC_FREQ_RATIO 32.002319	//Internal MCLK = 16.776 MHz
 #define AD5933_EXT_OSC_FREQ_RATIO 33.554432	//External MCLK = 16.000 MHz
 
+/* System clock, the internal oscillator unless AD5933_EXT_OSC_HZ is given, max 16.776 MHz */
+#ifdef AD5933_EXT_OSC_HZ
+#define AD5933_MCLK_HZ AD5933_EXT_OSC_HZ
+#define AD5933_CLK_CFG AD5933_EXT_CLK
+#else
+#define AD5933_MCLK_HZ 16776000UL
+#define AD5933_CLK_CFG 0x00
+#endif
+
+/* Frequency code, f * 2^27 / (MCLK / 4) rounded, constant folded for constant frequencies */
+#define AD5933_FREQ_CODE(hz) ((unsigned long)((((unsigned long long)(hz) << 29) + (AD5933_MCLK_HZ / 2)) / AD5933_MCLK_HZ))
+#define AD5933_CODE_PER_KHZ AD5933_FREQ_CODE(1000)
+
+/* NUM_SETTLE multiplier bits and longest settling, 511 cycles x4 */
+#define AD5933_SETTLE_X2 0x0200
+#define AD5933_SETTLE_X4 0x0600
+#define AD5933_SETTLE_MAX 2044
+
+/* NUM_SETTLE value of at least the given settling cycles, up to AD5933_SETTLE_MAX */
+#define AD5933_SETTLE_CODE(cycles) (((cycles) <= 511) ? (cycles) : \
+	((cycles) <= 1022) ? (AD5933_SETTLE_X2 | (((cycles) + 1) / 2)) : (AD5933_SETTLE_X4 | (((cycles) + 3) / 4)))
+
+/* Settling cycles of a NUM_SETTLE value */
+#define AD5933_SETTLE_CYCLES(code) (((code) & 0x1ff) * ((((code) & AD5933_SETTLE_X4) == AD5933_SETTLE_X4) ? 4 : ((code) & AD5933_SETTLE_X2) ? 2 : 1))
+
+/* Sweep register image, FREQ_HIGH to NUM_SETTLE_LOW, settling cycles up to AD5933_SETTLE_MAX */
+#define AD5933_SWEEP_IMAGE(start_hz, delta_hz, n_inc, settle) { \
+	(AD5933_FREQ_CODE(start_hz) >> 16) & 0xff, (AD5933_FREQ_CODE(start_hz) >> 8) & 0xff, AD5933_FREQ_CODE(start_hz) & 0xff, \
+	(AD5933_FREQ_CODE(delta_hz) >> 16) & 0xff, (AD5933_FREQ_CODE(delta_hz) >> 8) & 0xff, AD5933_FREQ_CODE(delta_hz) & 0xff, \
+	((n_inc) >> 8) & 0x01, (n_inc) & 0xff, \
+	(AD5933_SETTLE_CODE(settle) >> 8) & 0x07, AD5933_SETTLE_CODE(settle) & 0xff }
+
+/* Fixed sweep configuration, register image, range/PGA and ADG849 path */
+#define AD5933_SWEEP_CONFIG(start_hz, delta_hz, n_inc, settle, cfg, rfb) { AD5933_SWEEP_IMAGE(start_hz, delta_hz, n_inc, settle), (cfg), (rfb) }
+
 /* AD5933 status definitions */
 #define AD5933_STAT_TEMP_VALID 0x01
 #define AD5933_STAT_DATA_VALID 0x02
 #define AD5933_STAT_SWEEP_DONE 0x04
 
+/* Driver flags added to the record status, the AD5933 only uses bits 0 to 2 */
+#define AD5933_REC_TEMP_STALE 0x10			//Record temperature unknown or older than the refresh period
+#define AD5933_REC_RETRIED 0x20				//Bus transactions of the point retried
+#define AD5933_REC_TIMEOUT 0x40				//Bus recovered from a stuck transaction
+#define AD5933_REC_FAILED 0x80				//Retries exhausted, no data, sweep stopped
+
 /* AD5933 registers definitions */
 #define AD5933_CTRL_HIGH 0x80 			//RW 2 bytes
 #define AD5933_CTRL_LOW 0x81			//RW 2 bytes
@@ -72,6 +122,7 @@
 #define AD5933_FREQ_INC_LOW 0x87		
 #define AD5933_NUM_INC_HIGH 0x88		//RW 2 bytes, 9 bit
 #define AD5933_NUM_INC_LOW 0x89
+#define AD5933_NUM_INC_MAX 511
 #define AD5933_NUM_SETTLE_HIGH 0x8a		//RW 2 bytes
 #define AD5933_NUM_SETTLE_LOW 0x8b
 #define AD5933_STATUS 0x8f				//R 1 byte
@@ -85,11 +136,109 @@
 /* Max buffer size from AD5933 registers - 3 bytes */
 #define AD5933_DATA_BUFFER_SIZE 3
 
-/* Number of samples to av*/
+/* Sweep registers kept in the driver shadow map, FREQ_HIGH to NUM_SETTLE_LOW */
+#define AD5933_SHADOW_FIRST AD5933_FREQ_HIGH
+#define AD5933_SHADOW_SIZE (AD5933_NUM_SETTLE_LOW - AD5933_FREQ_HIGH + 1)
+
+/* Max clean registers rewritten to join two dirty ones in a block write */
+#define AD5933_SHADOW_MERGE_GAP 2
+
+/* Point burst read, Real and Imaginary or, with AD5933_BURST_STATUS, Status to Imaginary */
+#ifdef AD5933_BURST_STATUS
+#define AD5933_BURST_START AD5933_STATUS
+#else
+#define AD5933_BURST_START AD5933_REAL_HIGH
+#endif
+#define AD5933_BURST_SIZE (AD5933_IMAG_LOW - AD5933_BURST_START + 1)
+
+/* Repeat averaging, samples before the first variance check and max samples per point */
+#define AD5933_AVG_MIN_SAMPLES 3
+#define AD5933_AVG_MAX_SAMPLES 64
+
+/* Max deviation from the first sample kept in the averaging sums, keeps them in 32 bit */
+#define AD5933_AVG_DEV_LIMIT 4095
+
+/* Output bias settling after INIT, depends on the output range and the board coupling */
+#ifndef AD5933_BIAS_SETTLE_US_2V
+#define AD5933_BIAS_SETTLE_US_2V 2000UL
+#define AD5933_BIAS_SETTLE_US_1V 1000UL
+#define AD5933_BIAS_SETTLE_US_400mV 500UL
+#define AD5933_BIAS_SETTLE_US_200mV 250UL
+#endif
+
+/* Auto-range limits on the raw DFT data */
+#ifndef AD5933_RANGE_SAT_LEVEL
+#define AD5933_RANGE_SAT_LEVEL 32000		//Real or Imaginary close to full scale
+#define AD5933_RANGE_MAG_HIGH 30000			//Magnitude above it steps the gain down
+#define AD5933_RANGE_MAG_LOW 1500			//Magnitude below it steps the gain up
+#endif
+
+/* Max range changes while measuring one point */
+#define AD5933_RANGE_RETRIES 3
+
+/* Sweep records buffered by the driver, power of 2 */
+#ifndef AD5933_RECORD_BUFFER_SIZE
+#define AD5933_RECORD_BUFFER_SIZE 16
+#endif
 
 /* SF1 ctrl I/O port */
 #define AD5933_IO_PORT PORTD6
 
+/* I2C mux in front of the AD5933 devices, the AD5933 address is fixed */
+#define AD5933_MUX_SLA_W 0xe0
+#define AD5933_MUX_NONE 0xff
+
+/* Status poll period once the expected DFT time is over */
+#define AD5933_POLL_INTERVAL_US 100UL
+
+/* Bus transactions of one state machine step, mux select, pointer, data and pointer back to the status */
+#define AD5933_XFER_NUM 4
+
+/* Retries of a failed step and delay before the first one, doubled on each retry */
+#define AD5933_RETRY_MAX 3
+#define AD5933_RETRY_BACKOFF_US 200UL
+
+/* Temperature conversion time and timeout */
+#define AD5933_TEMP_TIME_US 800UL
+#define AD5933_TEMP_TIMEOUT_US 2000UL
+
+/* Cached temperature before the first measurement, in 1/32 degree C */
+#define AD5933_TEMP_UNKNOWN ((short)0x8000)
+
+/* Address pointer location not known, not a register location */
+#define AD5933_PTR_UNKNOWN 0x00
+
+/* DFT conversion time, 1024 samples at MCLK/16 */
+#define AD5933_DFT_TIME_US 977UL
+
+/* Bus time of a control register write at 250 kHz, the conversion starts once it reached the device */
+#define AD5933_CMD_TIME_US 116UL
+
+/* Wake up from power down in standby before INIT */
+#ifndef AD5933_WAKE_US
+#define AD5933_WAKE_US 1000UL
+#endif
+
+/* AD5933 power states */
+#define AD5933_POWER_ON 0x00
+#define AD5933_POWER_STANDBY 0x01
+#define AD5933_POWER_DOWN 0x02
+#define AD5933_POWER_NUM 3
+
+/* Longest MCU sleep when no device waits for a time */
+#define AD5933_SLEEP_MAX_US 1000000UL
+
+/* Supply of the energy estimate, currents in uA, AD5933 and ATmega328 at 8 MHz typicals */
+#ifndef AD5933_SUPPLY_MV
+#define AD5933_SUPPLY_MV 3300ULL
+#define AD5933_ON_UA 10000ULL
+#define AD5933_STANDBY_UA 7000ULL
+#define AD5933_PWR_DWN_UA 1ULL
+#define AD5933_MCU_ACTIVE_UA 3000ULL
+#define AD5933_MCU_IDLE_UA 1000ULL
+#define AD5933_MCU_DEEP_UA 5ULL
+#endif
+
 /**
  * @brief available flags used by the AD5933 API
  */
@@ -100,7 +249,18 @@ typedef enum _e_ad5933_flags {
 	E_FLAGS_AD5933_FREQUENCY_SWEEP_NEXT,
 	E_FLAGS_AD5933_FREQUENCY_REPEAT,
 	E_FLAGS_AD5933_DFT_COMPLETE,
-	E_FLAGS_AD5933_IDLE
+	E_FLAGS_AD5933_IDLE,
+	E_FLAGS_AD5933_SETTLING,
+	E_FLAGS_AD5933_DFT_WAIT,
+	E_FLAGS_AD5933_RANGE_SETTLING,
+	E_FLAGS_AD5933_PLAN_NEXT,
+	E_FLAGS_AD5933_PLAN_LOAD,
+	E_FLAGS_AD5933_POLL,
+	E_FLAGS_AD5933_READ,
+	E_FLAGS_AD5933_TEMP_WAIT,
+	E_FLAGS_AD5933_TEMP_POLL,
+	E_FLAGS_AD5933_TEMP_READ,
+	E_FLAGS_AD5933_WAKE
 	
 } e_ad5933_flags;
 
@@ -110,10 +270,10 @@ typedef enum _e_ad5933_flags {
 typedef struct _ad5933_platform_data {
 	
 	// imaginary data
-	long data_imaginary;
+	short data_imaginary;
 	
 	// real data
-	long data_real;
+	short data_real;
 	
 	// temperature data
 	char temperature;
@@ -124,100 +284,722 @@ typedef struct _ad5933_platform_data {
 	// delta frequency data
 	unsigned long delta_frequency;
 	
-	// sweep number of increments
-	unsigned char number_of_increments;
+	// sweep number of increments, 9 bit
+	unsigned int number_of_increments;
 	
-	// delay data
-	unsigned char delay_value;
+	// NUM_SETTLE value, 9 bit settling cycles and multiplier bits
+	unsigned int delay_value;
 	
 	// measure trigger
 	unsigned char measure_trigger;
 
 } ad5933_platform_data;
 
+/**
+ * @brief Sweep instrumentation, built only with AD5933_STATS defined
+ *
+ * The bus figures come from the twi.c counters, so TWI_STATS is needed
+ * too. They cover every device sharing the bus during the sweep.
+ */
+#ifdef AD5933_STATS
+#ifndef TWI_STATS
+#error "AD5933_STATS needs TWI_STATS"
+#endif
+
+typedef struct _ad5933_sweep_stats {
+
+	// start of the sweep and time up to its end, or up to now while running
+	unsigned long start_us;
+	unsigned long duration_us;
+
+	// records stored, DFT conversions started and status reads
+	unsigned int points;
+	unsigned int conversions;
+	unsigned int polls;
+
+	// bus counters over the sweep
+	twi_stats bus;
+
+} ad5933_sweep_stats;
+#endif
+
+/* Bands of a settling profile */
+#ifndef AD5933_SETTLE_BANDS
+#define AD5933_SETTLE_BANDS 8
+#endif
+
+/* Valid settling profile marker */
+#define AD5933_SETTLE_MAGIC 0x5a
+
+/**
+ * @brief Settling cycles needed per frequency band, made by ad5933_settle_tune
+ */
+typedef struct _ad5933_settle_profile {
+
+	// AD5933_SETTLE_MAGIC when valid
+	unsigned char magic;
+
+	// AD5933_SETTING of the tuning sweeps
+	unsigned char setting;
+
+	// number of bands
+	unsigned char num;
+
+	// highest frequency code of each band, ascending, and its NUM_SETTLE value
+	unsigned long band_top[AD5933_SETTLE_BANDS];
+	unsigned int code[AD5933_SETTLE_BANDS];
+
+	// sum of the bytes above
+	unsigned int checksum;
+
+} ad5933_settle_profile;
+
+/**
+ * @brief Energy estimate since the last ad5933_energy_reset
+ */
+typedef struct _ad5933_energy {
+
+	// MCU time awake, in HAL_SLEEP_IDLE and in HAL_SLEEP_DEEP
+	unsigned long long mcu_us[3];
+
+	// AD5933 time in each power state, summed over the devices
+	unsigned long long dev_us[AD5933_POWER_NUM];
+
+	// records stored
+	unsigned long points;
+
+	// energy and records per joule
+	unsigned long energy_uj;
+	unsigned long points_per_j;
+
+} ad5933_energy;
+
+/**
+ * @brief AD5933 sweep point record, largest fields first so it has no padding
+ */
+typedef struct _ad5933_record {
+
+	// frequency code of the point
+	unsigned long frequency_code;
+
+	// point index inside the sweep or frequency plan
+	unsigned int index;
+
+	// real data
+	short real;
+
+	// imaginary data
+	short imaginary;
+
+	// cached temperature in 1/32 degree C, AD5933_TEMP_UNKNOWN before the first measurement
+	short temperature;
+
+	// AD5933 status register read with the point and AD5933_REC flags
+	unsigned char status;
+
+	// AD5933_SETTING used for the point
+	unsigned char setting;
+
+	// samples averaged into the point
+	unsigned char samples;
+
+} ad5933_record;
+
+/**
+ * @brief Sample of the single frequency tracking mode
+ */
+typedef struct _ad5933_sample {
+
+	// hal_time_us when the conversion was started
+	unsigned long time_us;
+
+	// real and imaginary data
+	short real;
+	short imaginary;
+
+	// AD5933 status register read with the sample and AD5933_REC flags
+	unsigned char status;
+
+	// AD5933_SETTING used for the sample
+	unsigned char setting;
+
+} ad5933_sample;
+
+/* Tracking mode states */
+#define AD5933_TRACK_OFF 0
+#define AD5933_TRACK_RUN 1
+#define AD5933_TRACK_STOP 2
+
+/**
+ * @brief Fixed sweep configuration, built with AD5933_SWEEP_CONFIG and kept in HAL_FLASH
+ */
+typedef struct _ad5933_sweep_config {
+
+	// sweep registers, FREQ_HIGH to NUM_SETTLE_LOW
+	unsigned char regs[AD5933_SHADOW_SIZE];
+
+	// control register range and PGA bits
+	unsigned char cfg;
+
+	// ADG849 path
+	unsigned char rfb;
+
+} ad5933_sweep_config;
+
+/**
+ * @brief AD5933 device handle
+ */
+typedef struct _ad5933_dev {
+
+	// measurement settings and last point
+	ad5933_platform_data data;
+
+	// I2C mux channel, AD5933_MUX_NONE when wired to the bus
+	unsigned char mux_channel;
+
+	// ADG849 path, HAL_RFB_20R or HAL_RFB_100K
+	unsigned char rfb;
+
+	// control register range and PGA bits
+	unsigned char cfg;
+
+	// auto-range enable, position on the gain ladder and changes on the current point
+	unsigned char autorange;
+	unsigned char range_step;
+	unsigned char range_changes;
+	signed char range_dir;
+
+	// repeat averaging limits, 0 or 1 max samples disables it
+	unsigned char avg_max;
+	unsigned char avg_noise;
+
+	// samples of the current point, first sample and sums of the deviations from it
+	unsigned char avg_num;
+	short avg_real0;
+	short avg_imag0;
+	long avg_sum_real;
+	long avg_sum_imag;
+	unsigned long avg_sq_real;
+	unsigned long avg_sq_imag;
+
+	// increment index of the point being measured
+	unsigned int sweep_index;
+
+	// frequency plan, NULL for a single linear sweep
+	const unsigned long* plan_p;
+	unsigned int plan_num;
+	unsigned long plan_tol;
+
+	// plan index of the first point of the current segment
+	unsigned int plan_base;
+
+	// settling profile, NULL to keep delay_value
+	const ad5933_settle_profile* settle_p;
+
+	// end of the current settling or DFT wait
+	unsigned long deadline;
+
+	// sweep records waiting for the application
+	ad5933_record records[AD5933_RECORD_BUFFER_SIZE];
+	volatile unsigned char record_head;
+	volatile unsigned char record_tail;
+
+	// shadow of the sweep registers and their dirty bits
+	unsigned char shadow[AD5933_SHADOW_SIZE];
+	unsigned int shadow_dirty;
+
+	// bus transactions of the current step and their buffers
+	twi_xfer xfer[AD5933_XFER_NUM];
+	unsigned char xfer_num;
+	unsigned char mux_mask;
+	unsigned char ptr_cmd[2];
+	unsigned char tx_buf[AD5933_SHADOW_SIZE + 2];
+	unsigned char rx_buf[AD5933_BURST_SIZE];
+
+	// status read by the last poll
+	unsigned char poll_status;
+
+	// address pointer location and bus error count when it was set
+	unsigned char pointer;
+	unsigned long pointer_errors;
+
+	// last queued step and its arguments, queued again when it fails
+	unsigned char op;
+	unsigned char op_arg[2];
+
+	// retries of the failed step, backoff wait and its end
+	unsigned char retry_num;
+	unsigned char retry_wait;
+	unsigned long retry_at;
+
+	// AD5933_REC flags of the point being measured
+	unsigned char point_flags;
+
+	// cached temperature in 1/32 degree C, time of the measurement and of the last attempt
+	short temperature;
+	unsigned long temp_time;
+	unsigned long temp_try;
+
+	// refresh period, 0 disables the refresh
+	unsigned long temp_max_age;
+
+	// state resumed after the measurement and end of the status poll
+	unsigned char temp_return;
+	unsigned long temp_end;
+
+	// sweep period, 0 for sweeps started by the application, and start of the current period
+	unsigned long period;
+	unsigned long period_start;
+
+	// AD5933 power state, time of its last change, time in each state and records stored
+	unsigned char power;
+	unsigned long power_since;
+	unsigned long long power_us[AD5933_POWER_NUM];
+	unsigned long energy_points;
+
+	// hal_time_us when the conversion of the current point was started
+	unsigned long point_time;
+
+	// tracking state and sample ring, its size a power of two
+	unsigned char track_state;
+	ad5933_sample* track_p;
+	unsigned int track_size;
+	volatile unsigned int track_head;
+	volatile unsigned int track_tail;
+
+	// samples since ad5933_track_start, time of the first and of the last one
+	unsigned long track_count;
+	unsigned long track_first;
+	unsigned long track_last;
+
+#ifdef AD5933_STATS
+	// counters of the last sweep and bus counters at its start
+	ad5933_sweep_stats stats;
+	twi_stats stats_bus;
+#endif
+
+} ad5933_dev;
+
 /**
  * @brief initialize AD5933
+ *
+ * @param a_dev a device handle
+ * @param a_mux_channel a I2C mux channel or AD5933_MUX_NONE
+ *
  */
-volatile ad5933_platform_data* ad5933_init(void);
+volatile ad5933_platform_data* ad5933_init( ad5933_dev* a_dev, unsigned char a_mux_channel );
 
 /**
  * @brief Set AD5933 pointer register address
  *
+ * @param a_dev a device handle
  * @param a_reg_loc a register pointer
  *
  */
-void ad5933_set_pointer( unsigned char a_reg_loc );
+void ad5933_set_pointer( ad5933_dev* a_dev, unsigned char a_reg_loc );
 
 /**
  * @brief Write a byte to AD5933
  *
+ * @param a_dev a device handle
  * @param a_reg_addr a register address
  * @param a_data a data byte
  *
  */
-void ad5933_write_byte( unsigned char a_reg_addr, unsigned char a_data );
+void ad5933_write_byte( ad5933_dev* a_dev, unsigned char a_reg_addr, unsigned char a_data );
 
 /**
  * @brief Write a byte block to AD5933
  *
+ * @param a_dev a device handle
  * @param a_reg_loc a register pointer
  * @param a_byte_num a data size
  * @param a_data_p a data pointer
  *
  */
-void ad5933_write_block( unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p );
+void ad5933_write_block( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p );
 
 /**
  * @brief Read a byte from AD5933
  *
+ * @param a_dev a device handle
  * @param a_reg_loc a register pointer
  * @param a_data a data byte
  *
  */
-unsigned char ad5933_read_byte( unsigned char a_reg_loc );
+unsigned char ad5933_read_byte( ad5933_dev* a_dev, unsigned char a_reg_loc );
 
 /**
  * @brief Read a byte from AD5933
  *
+ * @param a_dev a device handle
  * @param a_reg_loc a register location
  * @param a_byte_num a data size
  *
  */
-unsigned long ad5933_read_block( unsigned char a_reg_loc, unsigned char a_byte_num );
+unsigned long ad5933_read_block( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num );
+
+/**
+ * @brief Burst read consecutive AD5933 registers in a single block read
+ *
+ * @param a_dev a device handle
+ * @param a_reg_loc a first register location
+ * @param a_byte_num a data size
+ * @param a_data_p a data buffer
+ *
+ */
+void ad5933_read_regs( ad5933_dev* a_dev, unsigned char a_reg_loc, unsigned char a_byte_num, unsigned char* a_data_p );
+
+/**
+ * @brief Select the ADG849 path of the device
+ *
+ * @param a_dev a device handle
+ * @param a_rfb HAL_RFB_20R or HAL_RFB_100K
+ *
+ */
+void ad5933_set_rfb( ad5933_dev* a_dev, unsigned char a_rfb );
+
+/**
+ * @brief Enable or disable automatic ranging
+ *
+ * Each point is checked against AD5933_RANGE_* limits. On saturation or
+ * low signal the output range, PGA or ADG849 path is moved one step on a
+ * gain ladder and only that point is measured again.
+ *
+ * @param a_dev a device handle
+ * @param a_enable 1 to enable
+ *
+ */
+void ad5933_set_autorange( ad5933_dev* a_dev, unsigned char a_enable );
+
+/**
+ * @brief Enable or disable repeat averaging
+ *
+ * Each point is measured again with REPEAT_FREQ while the running
+ * variance of the real and imaginary data gives a standard error of the
+ * mean above a_noise, up to a_max_samples. Clean points move on after
+ * AD5933_AVG_MIN_SAMPLES, noisy ones get more samples.
+ *
+ * @param a_dev a device handle
+ * @param a_max_samples a max samples per point, 0 or 1 to disable
+ * @param a_noise a target standard error of the mean in DFT codes
+ *
+ */
+void ad5933_set_averaging( ad5933_dev* a_dev, unsigned char a_max_samples, unsigned char a_noise );
 
 /**
  * @brief Set AD5933 start frequency and increment
  *
+ * @param a_dev a device handle
  * @param a_start_freq_hz a start frequency
  * @param a_delta_freq_hz a delta frequency
- * @param a_nof_increments a number of increments
+ * @param a_nof_increments a number of increments, up to AD5933_NUM_INC_MAX
+ *
+ */
+void ad5933_set_frequency( ad5933_dev* a_dev, unsigned long int a_start_freq_hz, unsigned long int a_delta_freq_hz, unsigned int a_nof_increments );
+
+/**
+ * @brief Frequency code of a frequency
+ *
+ * Integer only, f * 2^29 / MCLK is divided 8 bits at a time so every step
+ * fits in 32 bit. Use AD5933_FREQ_CODE for constant frequencies.
+ *
+ * @param a_freq_hz a frequency
+ *
+ * @return 24 bit frequency code
+ */
+unsigned long ad5933_freq_code( unsigned long a_freq_hz );
+
+/**
+ * @brief Load a fixed sweep configuration
+ *
+ * The register image is read from HAL_FLASH and programmed through the
+ * shadow map, no conversion is done at run time.
+ *
+ * @param a_dev a device handle
+ * @param a_config_p a sweep configuration in HAL_FLASH
+ *
+ */
+void ad5933_config_sweep( ad5933_dev* a_dev, const ad5933_sweep_config* a_config_p );
+
+/**
+ * @brief Measure a frequency plan instead of a linear sweep
+ *
+ * The plan is split into linear hardware segments that keep every point
+ * within a_tol of its code. At the end of a segment only the changed
+ * sweep registers are written and the next segment starts without a
+ * power down. Records are indexed by plan point, as one sweep. The plan
+ * must stay valid until the measurement ends. Call ad5933_config_measure
+ * afterwards.
+ *
+ * @param a_dev a device handle
+ * @param a_codes_p a ascending frequency code list, NULL for a linear sweep
+ * @param a_num a number of codes
+ * @param a_tol a tolerance in frequency codes
+ *
+ */
+void ad5933_set_plan( ad5933_dev* a_dev, const unsigned long* a_codes_p, unsigned int a_num, unsigned long a_tol );
+
+/**
+ * @brief Set the settling cycles of every point
+ *
+ * Above 511 cycles the x2 and x4 multipliers are used, rounding up.
+ * Call ad5933_config_measure afterwards.
+ *
+ * @param a_dev a device handle
+ * @param a_cycles a number of settling cycles, up to AD5933_SETTLE_MAX
  *
  */
-void ad5933_set_frequency( unsigned long int a_start_freq_hz, unsigned long int a_delta_freq_hz, unsigned char a_nof_increments );
+void ad5933_set_settling( ad5933_dev* a_dev, unsigned int a_cycles );
+
+/**
+ * @brief Program the settling cycles from a profile
+ *
+ * Each linear segment gets the largest settling of the bands it covers.
+ * Plan segments are split at the band edges, so every plan point gets
+ * the settling of its own band. The profile must stay valid while it is
+ * used and should match the range setting of the measurement. Call
+ * ad5933_config_measure afterwards.
+ *
+ * @param a_dev a device handle
+ * @param a_profile_p a settling profile, NULL to go back to ad5933_set_settling
+ *
+ */
+void ad5933_set_settle_profile( ad5933_dev* a_dev, const ad5933_settle_profile* a_profile_p );
 
 /**
  * @brief Get AD5933 temperature
  *
- * @param none
+ * Blocking, the cached temperature is updated too.
+ *
+ * @param a_dev a device handle
+ *
+ */
+void ad5933_get_temperature( ad5933_dev* a_dev );
+
+/**
+ * @brief Keep the cached temperature fresh without blocking
+ *
+ * Once the cached temperature is older than a_max_age_ms, a measurement
+ * is queued by ad5933_proc_data while the device is idle, before a sweep
+ * and between frequency plan segments, never inside a segment. Each
+ * record carries the cached value and AD5933_REC_TEMP_STALE when it is
+ * older than a_max_age_ms. A failed measurement keeps the old value and
+ * is tried again one period later.
+ *
+ * @param a_dev a device handle
+ * @param a_max_age_ms a max temperature age up to 30 minutes, 0 to disable the refresh
+ *
+ */
+void ad5933_set_temperature_refresh( ad5933_dev* a_dev, unsigned long a_max_age_ms );
+
+/**
+ * @brief Cached temperature
+ *
+ * @param a_dev a device handle
+ * @param a_age_ms_p a age of the value in ms, may be NULL
  *
+ * @return temperature in 1/32 degree C, AD5933_TEMP_UNKNOWN before the first measurement
  */
-void ad5933_get_temperature( void );
+short ad5933_temperature( ad5933_dev* a_dev, unsigned long* a_age_ms_p );
 
 /**
  * @brief Configure AD5933 measurement parameters
  *
- * @param none
+ * @param a_dev a device handle
  *
  */
-void ad5933_config_measure( void );
+void ad5933_config_measure( ad5933_dev* a_dev );
 
 /**
  * @brief Start AD5933 measurement
  *
- * @param none
+ * Once started the driver steps through the whole sweep by itself and
+ * stores each point in the record buffer. The sweep is held on the
+ * current point while the buffer is full.
+ *
+ * Every call returns at once. A step queues its bus transactions on the
+ * TWI engine and the next call moves on when they are complete and the
+ * settling or DFT deadline has passed. measure_trigger holds the current
+ * state.
+ *
+ * @param a_dev a device handle
+ *
+ */
+void ad5933_proc_data( ad5933_dev* a_dev );
+
+/**
+ * @brief Number of sweep records waiting in the record buffer
+ *
+ * @param a_dev a device handle
+ *
+ */
+unsigned char ad5933_records_available( ad5933_dev* a_dev );
+
+/**
+ * @brief Drain sweep records from the record buffer
+ *
+ * @param a_dev a device handle
+ * @param a_record_p a record array
+ * @param a_max_num a array size
+ *
+ * @return number of records copied
+ */
+unsigned char ad5933_read_records( ad5933_dev* a_dev, ad5933_record* a_record_p, unsigned char a_max_num );
+
+/**
+ * @brief Copy the oldest sweep record without removing it
+ *
+ * @param a_dev a device handle
+ * @param a_record_p a record
+ *
+ * @return 1 when a record is copied
+ */
+unsigned char ad5933_peek_record( ad5933_dev* a_dev, ad5933_record* a_record_p );
+
+/**
+ * @brief Sample one frequency continuously
+ *
+ * The frequency is programmed once and the excitation started, then every
+ * sample is a repeat frequency command, a status poll and a burst read,
+ * without going through standby. Samples go to a_buf_p with the time
+ * their conversion started. The loop holds while the ring is full. The
+ * settling cycles, auto-range and averaging settings apply to every
+ * sample. It only starts on a idle device and replaces the sweep settings,
+ * so call ad5933_config_measure or ad5933_config_sweep before the next sweep.
+ *
+ * @param a_dev a device handle
+ * @param a_freq_hz a frequency in Hz
+ * @param a_buf_p a sample ring
+ * @param a_size a number of samples in the ring, rounded down to a power of two
+ *
+ * @return 1 if the tracking started, 0 when the device is busy or a_size is 0
+ */
+unsigned char ad5933_track_start( ad5933_dev* a_dev, unsigned long a_freq_hz, ad5933_sample* a_buf_p, unsigned int a_size );
+
+/**
+ * @brief End the tracking after the sample being converted
+ *
+ * @param a_dev a device handle
+ *
+ */
+void ad5933_track_stop( ad5933_dev* a_dev );
+
+/**
+ * @brief Copy and remove the oldest tracking samples
+ *
+ * @param a_dev a device handle
+ * @param a_sample_p a sample array
+ * @param a_max_num a maximum number of samples to copy
+ *
+ * @return number of samples copied
+ */
+unsigned int ad5933_track_read( ad5933_dev* a_dev, ad5933_sample* a_sample_p, unsigned int a_max_num );
+
+/**
+ * @brief Achieved tracking rate
+ *
+ * @param a_dev a device handle
+ *
+ * @return samples per second between the first and the last sample
+ */
+unsigned long ad5933_track_rate( ad5933_dev* a_dev );
+
+/**
+ * @brief Run the measurements of several AD5933 sharing the bus
+ *
+ * Advances every device by one step. A device waiting for its settling
+ * or DFT time returns at once, so the bus serves the other devices in
+ * the meantime.
+ *
+ * @param a_dev_p a device handle array
+ * @param a_dev_num a number of devices
+ *
+ * @return number of devices still measuring
+ */
+unsigned char ad5933_sched_proc( ad5933_dev* const* a_dev_p, unsigned char a_dev_num );
+
+/**
+ * @brief Start a sweep every a_period_ms
+ *
+ * The sweep configured with ad5933_config_measure or ad5933_config_sweep
+ * is started by ad5933_proc_data at each period, the first one at once.
+ * Between sweeps the AD5933 is powered down, or kept in standby when the
+ * next sweep is closer than AD5933_WAKE_US. Periods missed by a long
+ * sweep are skipped.
+ *
+ * @param a_dev a device handle
+ * @param a_period_ms a period up to 30 minutes, 0 to stop
+ *
+ */
+void ad5933_set_period( ad5933_dev* a_dev, unsigned long a_period_ms );
+
+/**
+ * @brief Sleep the MCU until the next step of the devices is due
+ *
+ * Call it at the end of the main loop, after ad5933_sched_proc and the
+ * record reads. Returns at once when a device has work to do. Waits with
+ * transactions on the bus or bytes on the serial port use idle sleep,
+ * so do the settling and conversion waits of a running sweep. Longer
+ * waits between sweeps, with both stopped, power the MCU down.
+ *
+ * @param a_dev_p a device handle array
+ * @param a_dev_num a number of devices
+ *
+ * @return HAL_SLEEP_IDLE or HAL_SLEEP_DEEP, 0 when not slept
+ */
+unsigned char ad5933_sched_sleep( ad5933_dev* const* a_dev_p, unsigned char a_dev_num );
+
+/**
+ * @brief Clear the energy estimate
+ *
+ * @param a_dev_p a device handle array
+ * @param a_dev_num a number of devices
+ *
+ */
+void ad5933_energy_reset( ad5933_dev* const* a_dev_p, unsigned char a_dev_num );
+
+/**
+ * @brief Energy estimate from the MCU sleep and AD5933 power state times
+ *
+ * Uses the AD5933_SUPPLY_MV and current figures, the MCU time comes from
+ * ad5933_sched_sleep.
+ *
+ * @param a_dev_p a device handle array
+ * @param a_dev_num a number of devices
+ * @param a_energy_p a estimate buffer
+ *
+ */
+void ad5933_energy_get( ad5933_dev* const* a_dev_p, unsigned char a_dev_num, ad5933_energy* a_energy_p );
+
+#ifdef AD5933_STATS
+/**
+ * @brief Counters of the last sweep, the running one is reported up to now
+ *
+ * @param a_dev a device handle
+ * @param a_stats_p a counters buffer
+ *
+ */
+void ad5933_get_sweep_stats( ad5933_dev* a_dev, ad5933_sweep_stats* a_stats_p );
+
+/**
+ * @brief Sweep rate
+ *
+ * @param a_stats_p sweep counters
+ *
+ * @return points per second
+ */
+unsigned long ad5933_stats_points_per_s( const ad5933_sweep_stats* a_stats_p );
+
+/**
+ * @brief Share of the sweep time with a transaction on the bus
+ *
+ * @param a_stats_p sweep counters
  *
+ * @return bus utilization in percent
  */
-void ad5933_proc_data( void );
+unsigned char ad5933_stats_bus_load( const ad5933_sweep_stats* a_stats_p );
+#endif
 
 
 #endif /* __DEV_AD5933_H__ */
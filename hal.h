@@ -0,0 +1,177 @@
+#ifndef HAL_H_K3QZ7WTN
+#define HAL_H_K3QZ7WTN
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file hal.h 
+ *
+ * @brief Board services used by the AD5933 driver
+ *
+ * The driver reaches the bus through the twi.h transaction API and every
+ * other piece of hardware through this file. hal_avr.c implements it for
+ * the target board, sim/hal_sim.c for host builds against the simulator.
+ */
+
+/**
+ * @brief Constant tables kept in program memory, read back with hal_flash_read
+ */
+#ifdef __AVR__
+#include <avr/pgmspace.h>
+#define HAL_FLASH PROGMEM
+#else
+#define HAL_FLASH
+#endif
+
+/**
+ * @brief ADG849 feedback resistor selection
+ */
+#define HAL_RFB_100K 0x00
+#define HAL_RFB_20R 0x01
+
+/**
+ * @brief initialize board I/O and the time base used by the driver
+ * @param none.
+ *
+ */
+void hal_init(void);
+
+/**
+ * @brief Select the ADG849 feedback resistor path
+ *
+ * @param a_channel mux channel of the AD5933, boards with a single ADG849 ignore it
+ * @param a_rfb HAL_RFB_20R or HAL_RFB_100K
+ *
+ */
+void hal_rfb_select(unsigned char a_channel, unsigned char a_rfb);
+
+/**
+ * @brief Free running time base, wraps around every 71 minutes
+ * @param none.
+ *
+ * @return time in microseconds
+ */
+unsigned long hal_time_us(void);
+
+/**
+ * @brief Blocking delay
+ *
+ * @param a_ms delay in milliseconds
+ *
+ */
+void hal_delay_ms(unsigned int a_ms);
+
+/**
+ * @brief Sleep until the next interrupt
+ * @param none.
+ *
+ */
+void hal_idle(void);
+
+/**
+ * @brief Sleep depths of hal_sleep_until
+ */
+#define HAL_SLEEP_IDLE 0x01
+#define HAL_SLEEP_DEEP 0x02
+
+/* Shortest deep sleep, the watchdog period */
+#define HAL_DEEP_SLEEP_MIN_US 16000UL
+
+/* Watchdog oscillator tolerance, 1/HAL_WDT_TOL_DIV of the period */
+#define HAL_WDT_TOL_DIV 10
+
+/**
+ * @brief Sleep until a time, or less
+ *
+ * Idle sleep keeps the time base, the bus and the serial port running and
+ * returns on the next interrupt. With a_deep set and a wait of at least
+ * HAL_DEEP_SLEEP_MIN_US the MCU is powered down instead, for the longest
+ * watchdog period that ends before a_time_us even on a slow watchdog. The
+ * time base is moved on by the period of a fast watchdog, so it never runs
+ * ahead of real time; the rest of the wait is left to idle sleep. Only use
+ * a_deep when no transfer is running and the wait is not a settling time.
+ *
+ * @param a_time_us a wake up time
+ * @param a_deep a 1 to allow deep sleep
+ *
+ * @return HAL_SLEEP_IDLE or HAL_SLEEP_DEEP
+ */
+unsigned char hal_sleep_until(unsigned long a_time_us, unsigned char a_deep);
+
+/**
+ * @brief initialize the serial port, 8N1
+ *
+ * @param a_baud a baud rate
+ *
+ */
+void hal_uart_init(unsigned long a_baud);
+
+/**
+ * @brief Send a buffer from the transmit interrupt
+ *
+ * Returns at once, the buffer must stay untouched until hal_uart_busy
+ * returns 0.
+ *
+ * @param a_data_p a data buffer
+ * @param a_size a data size
+ *
+ */
+void hal_uart_send(const unsigned char* a_data_p, unsigned int a_size);
+
+/**
+ * @brief Buffer given to hal_uart_send still in use
+ * @param none.
+ *
+ * @return 1 while sending
+ */
+unsigned char hal_uart_busy(void);
+
+/**
+ * @brief Read a HAL_FLASH table
+ *
+ * @param a_data_p a data buffer
+ * @param a_flash_p a table address
+ * @param a_size a data size
+ *
+ */
+void hal_flash_read(void* a_data_p, const void* a_flash_p, unsigned int a_size);
+
+/**
+ * @brief Read from the non volatile memory
+ *
+ * @param a_addr a EEPROM address
+ * @param a_data_p a data buffer
+ * @param a_size a data size
+ *
+ */
+void hal_eeprom_read(unsigned int a_addr, void* a_data_p, unsigned int a_size);
+
+/**
+ * @brief Write to the non volatile memory, unchanged bytes are not rewritten
+ *
+ * @param a_addr a EEPROM address
+ * @param a_data_p a data buffer
+ * @param a_size a data size
+ *
+ */
+void hal_eeprom_write(unsigned int a_addr, const void* a_data_p, unsigned int a_size);
+
+
+#endif /* end of include guard: HAL_H_K3QZ7WTN */
@@ -0,0 +1,223 @@
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include "dev_ad5933.h"
+#include "hal.h"
+
+/* Time base tick, timer 2 clocked at F_CPU/64 */
+#define HAL_US_PER_TICK (64000000UL / F_CPU)
+
+/**
+ * @brief Timer 2 overflow count
+ */
+static volatile unsigned long g_hal_overflows;
+
+/**
+ * @brief Time spent in deep sleep with timer 2 stopped
+ */
+static unsigned long g_hal_sleep_us;
+
+/**
+ * @brief Deep sleep ended by the watchdog, set by WDT_vect
+ */
+static volatile unsigned char g_hal_wdt_wake;
+
+/**
+ * @brief Serial transmit buffer, next byte and bytes left
+ */
+static const unsigned char* volatile g_hal_uart_p;
+static volatile unsigned int g_hal_uart_num;
+
+
+void hal_init(void) {
+
+	//ADG849 control pin as output
+	DDRD |= _BV(DDD6);
+
+	//Timer 2 free running at F_CPU/64 with overflow interrupt
+	power_timer2_enable();
+	TCCR2A = 0;
+	TCCR2B = _BV(CS22);
+	TIMSK2 = _BV(TOIE2);
+}
+
+ISR(TIMER2_OVF_vect) {
+
+	g_hal_overflows++;
+}
+
+unsigned long hal_time_us(void) {
+
+	unsigned long overflows;
+	unsigned char ticks;
+	unsigned char sreg = SREG;
+
+	cli();
+
+	overflows = g_hal_overflows;
+	ticks = TCNT2;
+
+	//Overflow pending but not yet serviced
+	if((TIFR2 & _BV(TOV2)) && (ticks < 255)) {
+		overflows++;
+	}
+
+	SREG = sreg;
+
+	return ((overflows << 8) + ticks) * HAL_US_PER_TICK + g_hal_sleep_us;
+}
+
+void hal_rfb_select(unsigned char a_channel, unsigned char a_rfb) {
+
+	//Single ADG849 on the board
+	(void)a_channel;
+
+	//ADG849 control -> logic high select 20 ohm resistor, logic low select 100K ohm
+	if(a_rfb == HAL_RFB_20R) {
+		PORTD |= _BV(AD5933_IO_PORT);
+	}
+	else {
+		PORTD &= ~_BV(AD5933_IO_PORT);
+	}
+}
+
+void hal_delay_ms(unsigned int a_ms) {
+
+	//_delay_ms needs a compile time constant
+	while(a_ms--) {
+		_delay_ms(1);
+	}
+}
+
+void hal_idle(void) {
+
+	//Timer 2 overflow wakes the CPU at least every 256 * 64 / F_CPU, 1024 us at 16 MHz, 2048 us at 8 MHz
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	sleep_mode();
+}
+
+ISR(WDT_vect) {
+
+	g_hal_wdt_wake = 1;
+}
+
+unsigned char hal_sleep_until(unsigned long a_time_us, unsigned char a_deep) {
+
+	unsigned long wait = a_time_us - hal_time_us();
+	unsigned char prescaler = 0;
+
+	if((long)wait <= 0) {
+		return HAL_SLEEP_IDLE;
+	}
+
+	if(!a_deep || (wait < HAL_DEEP_SLEEP_MIN_US)) {
+		hal_idle();
+		return HAL_SLEEP_IDLE;
+	}
+
+	//Longest watchdog period within the wait on a slow watchdog, 16 ms to 2 s
+	wait -= wait / (HAL_WDT_TOL_DIV + 1);
+	if(wait < HAL_DEEP_SLEEP_MIN_US) {
+		hal_idle();
+		return HAL_SLEEP_IDLE;
+	}
+	while((prescaler < 7) && ((HAL_DEEP_SLEEP_MIN_US << (prescaler + 1)) <= wait)) {
+		prescaler++;
+	}
+
+	//Watchdog in interrupt mode only, timer 2 is synchronous and stops in power down
+	cli();
+	g_hal_wdt_wake = 0;
+	wdt_reset();
+	WDTCSR = _BV(WDCE) | _BV(WDE);
+	WDTCSR = _BV(WDIE) | prescaler;
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	sleep_enable();
+	sei();
+	sleep_cpu();
+	sleep_disable();
+	wdt_disable();
+
+	//Period of a fast watchdog, the time base lags rather than runs ahead
+	//Another wake up source loses the time slept
+	if(g_hal_wdt_wake) {
+		cli();
+		g_hal_sleep_us += (HAL_DEEP_SLEEP_MIN_US << prescaler) - ((HAL_DEEP_SLEEP_MIN_US << prescaler) / HAL_WDT_TOL_DIV);
+		sei();
+	}
+
+	return HAL_SLEEP_DEEP;
+}
+
+void hal_uart_init(unsigned long a_baud) {
+
+	//Double speed, 8N1, transmitter only
+	power_usart0_enable();
+	UCSR0A = _BV(U2X0);
+	UBRR0 = ((F_CPU / 8) + (a_baud / 2)) / a_baud - 1;
+	UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+	UCSR0B = _BV(TXEN0);
+}
+
+void hal_uart_send(const unsigned char* a_data_p, unsigned int a_size) {
+
+	if(a_size == 0) {
+		return;
+	}
+
+	g_hal_uart_p = a_data_p;
+	g_hal_uart_num = a_size;
+
+	//Data register empty interrupt feeds the bytes
+	UCSR0B |= _BV(UDRIE0);
+}
+
+ISR(USART_UDRE_vect) {
+
+	UDR0 = *g_hal_uart_p++;
+
+	if(--g_hal_uart_num == 0) {
+		UCSR0B &= ~_BV(UDRIE0);
+	}
+}
+
+unsigned char hal_uart_busy(void) {
+
+	return (g_hal_uart_num != 0);
+}
+
+void hal_flash_read(void* a_data_p, const void* a_flash_p, unsigned int a_size) {
+
+	memcpy_P(a_data_p, a_flash_p, a_size);
+}
+
+void hal_eeprom_read(unsigned int a_addr, void* a_data_p, unsigned int a_size) {
+
+	eeprom_read_block(a_data_p, (const void*)a_addr, a_size);
+}
+
+void hal_eeprom_write(unsigned int a_addr, const void* a_data_p, unsigned int a_size) {
+
+	eeprom_update_block(a_data_p, (void*)a_addr, a_size);
+}
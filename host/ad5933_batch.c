@@ -0,0 +1,331 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_batch.c 
+ *
+ * @brief Host side batch processing of raw AD5933 points
+ */
+
+#include <math.h>
+#include "ad5933_batch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AD5933_BATCH_X86
+#include <immintrin.h>
+#endif
+
+/* atan on [0, 1], Abramowitz and Stegun 4.4.49, error below 1e-5 rad */
+#define BATCH_ATAN_C0 0.9998660f
+#define BATCH_ATAN_C1 -0.3302995f
+#define BATCH_ATAN_C2 0.1801410f
+#define BATCH_ATAN_C3 -0.0851330f
+#define BATCH_ATAN_C4 0.0208351f
+
+#define BATCH_PI 3.14159265f
+#define BATCH_PI_2 1.57079633f
+#define BATCH_RAD2DEG 57.2957795f
+
+/**
+ * @brief Kernel set in use, -1 before the first call
+ */
+static signed char g_batch_isa = -1;
+
+/**
+ * @brief Polynomial atan2, the vector kernels do the same operations
+ */
+static float ad5933_batch_atan2(float a_y, float a_x) {
+
+	float ax = fabsf(a_x);
+	float ay = fabsf(a_y);
+	float hi = (ax > ay) ? ax : ay;
+	float lo = (ax > ay) ? ay : ax;
+	float a = (hi > 0) ? (lo / hi) : 0;
+	float s = a * a;
+	float r;
+
+	r = a * (BATCH_ATAN_C0 + s * (BATCH_ATAN_C1 + s * (BATCH_ATAN_C2 + s * (BATCH_ATAN_C3 + s * BATCH_ATAN_C4))));
+
+	if(ay > ax) {
+		r = BATCH_PI_2 - r;
+	}
+	if(a_x < 0) {
+		r = BATCH_PI - r;
+	}
+	if(a_y < 0) {
+		r = -r;
+	}
+
+	return r;
+}
+
+/**
+ * @brief Scalar kernels, also the tail of the vector kernels
+ */
+static void ad5933_batch_decode_scalar(ad5933_batch* a_batch_p, const unsigned char* a_raw_p, unsigned int a_first) {
+
+	unsigned int i;
+
+	for(i = a_first; i < a_batch_p->num; i++) {
+		a_batch_p->real[i] = (short)((a_raw_p[4 * i] << 8) | a_raw_p[(4 * i) + 1]);
+		a_batch_p->imaginary[i] = (short)((a_raw_p[(4 * i) + 2] << 8) | a_raw_p[(4 * i) + 3]);
+	}
+}
+
+static void ad5933_batch_impedance_scalar(ad5933_batch* a_batch_p, unsigned int a_first) {
+
+	unsigned int i;
+	float re, im;
+
+	for(i = a_first; i < a_batch_p->num; i++) {
+		re = a_batch_p->real[i];
+		im = a_batch_p->imaginary[i];
+		a_batch_p->impedance[i] = a_batch_p->gain[i] / sqrtf((re * re) + (im * im));
+		a_batch_p->phase[i] = (ad5933_batch_atan2(im, re) * BATCH_RAD2DEG) - a_batch_p->system_phase[i];
+	}
+}
+
+#ifdef AD5933_BATCH_X86
+
+/**
+ * @brief SSE2 kernels, 8 points per decode step and 4 per impedance step
+ */
+__attribute__((target("sse2")))
+static void ad5933_batch_decode_sse2(ad5933_batch* a_batch_p, const unsigned char* a_raw_p) {
+
+	unsigned int i;
+	__m128i v0, v1, re, im;
+
+	for(i = 0; (i + 8) <= a_batch_p->num; i += 8) {
+
+		v0 = _mm_loadu_si128((const __m128i*)&a_raw_p[4 * i]);
+		v1 = _mm_loadu_si128((const __m128i*)&a_raw_p[(4 * i) + 16]);
+
+		//High byte first to little endian, each 32 bit lane is real | imaginary << 16
+		v0 = _mm_or_si128(_mm_slli_epi16(v0, 8), _mm_srli_epi16(v0, 8));
+		v1 = _mm_or_si128(_mm_slli_epi16(v1, 8), _mm_srli_epi16(v1, 8));
+
+		re = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(v0, 16), 16), _mm_srai_epi32(_mm_slli_epi32(v1, 16), 16));
+		im = _mm_packs_epi32(_mm_srai_epi32(v0, 16), _mm_srai_epi32(v1, 16));
+
+		_mm_storeu_si128((__m128i*)&a_batch_p->real[i], re);
+		_mm_storeu_si128((__m128i*)&a_batch_p->imaginary[i], im);
+	}
+
+	ad5933_batch_decode_scalar(a_batch_p, a_raw_p, i);
+}
+
+__attribute__((target("sse2")))
+static __m128 ad5933_batch_atan2_sse2(__m128 a_y, __m128 a_x) {
+
+	const __m128 sign = _mm_set1_ps(-0.0f);
+	__m128 ax = _mm_andnot_ps(sign, a_x);
+	__m128 ay = _mm_andnot_ps(sign, a_y);
+	__m128 hi = _mm_max_ps(ax, ay);
+	__m128 lo = _mm_min_ps(ax, ay);
+	__m128 a, s, r, m;
+
+	//0 / 0 is masked to 0
+	a = _mm_and_ps(_mm_div_ps(lo, hi), _mm_cmpgt_ps(hi, _mm_setzero_ps()));
+	s = _mm_mul_ps(a, a);
+
+	r = _mm_add_ps(_mm_set1_ps(BATCH_ATAN_C3), _mm_mul_ps(s, _mm_set1_ps(BATCH_ATAN_C4)));
+	r = _mm_add_ps(_mm_set1_ps(BATCH_ATAN_C2), _mm_mul_ps(s, r));
+	r = _mm_add_ps(_mm_set1_ps(BATCH_ATAN_C1), _mm_mul_ps(s, r));
+	r = _mm_add_ps(_mm_set1_ps(BATCH_ATAN_C0), _mm_mul_ps(s, r));
+	r = _mm_mul_ps(a, r);
+
+	m = _mm_cmpgt_ps(ay, ax);
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(BATCH_PI_2), r)), _mm_andnot_ps(m, r));
+	m = _mm_cmplt_ps(a_x, _mm_setzero_ps());
+	r = _mm_or_ps(_mm_and_ps(m, _mm_sub_ps(_mm_set1_ps(BATCH_PI), r)), _mm_andnot_ps(m, r));
+	m = _mm_cmplt_ps(a_y, _mm_setzero_ps());
+
+	return _mm_xor_ps(r, _mm_and_ps(m, sign));
+}
+
+__attribute__((target("sse2")))
+static void ad5933_batch_impedance_sse2(ad5933_batch* a_batch_p) {
+
+	unsigned int i;
+	__m128i v;
+	__m128 re, im, mag, ph;
+
+	for(i = 0; (i + 4) <= a_batch_p->num; i += 4) {
+
+		//Sign extend 4 shorts to 32 bit
+		v = _mm_loadl_epi64((const __m128i*)&a_batch_p->real[i]);
+		re = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+		v = _mm_loadl_epi64((const __m128i*)&a_batch_p->imaginary[i]);
+		im = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+
+		mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(re, re), _mm_mul_ps(im, im)));
+		_mm_storeu_ps(&a_batch_p->impedance[i], _mm_div_ps(_mm_loadu_ps(&a_batch_p->gain[i]), mag));
+
+		ph = _mm_mul_ps(ad5933_batch_atan2_sse2(im, re), _mm_set1_ps(BATCH_RAD2DEG));
+		_mm_storeu_ps(&a_batch_p->phase[i], _mm_sub_ps(ph, _mm_loadu_ps(&a_batch_p->system_phase[i])));
+	}
+
+	ad5933_batch_impedance_scalar(a_batch_p, i);
+}
+
+/**
+ * @brief AVX2 kernels, 16 points per decode step and 8 per impedance step
+ */
+__attribute__((target("avx2")))
+static void ad5933_batch_decode_avx2(ad5933_batch* a_batch_p, const unsigned char* a_raw_p) {
+
+	unsigned int i;
+	__m256i v0, v1, re, im;
+
+	for(i = 0; (i + 16) <= a_batch_p->num; i += 16) {
+
+		v0 = _mm256_loadu_si256((const __m256i*)&a_raw_p[4 * i]);
+		v1 = _mm256_loadu_si256((const __m256i*)&a_raw_p[(4 * i) + 32]);
+
+		v0 = _mm256_or_si256(_mm256_slli_epi16(v0, 8), _mm256_srli_epi16(v0, 8));
+		v1 = _mm256_or_si256(_mm256_slli_epi16(v1, 8), _mm256_srli_epi16(v1, 8));
+
+		re = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(v0, 16), 16), _mm256_srai_epi32(_mm256_slli_epi32(v1, 16), 16));
+		im = _mm256_packs_epi32(_mm256_srai_epi32(v0, 16), _mm256_srai_epi32(v1, 16));
+
+		//Pack works inside 128 bit lanes, put the points back in order
+		re = _mm256_permute4x64_epi64(re, 0xd8);
+		im = _mm256_permute4x64_epi64(im, 0xd8);
+
+		_mm256_storeu_si256((__m256i*)&a_batch_p->real[i], re);
+		_mm256_storeu_si256((__m256i*)&a_batch_p->imaginary[i], im);
+	}
+
+	ad5933_batch_decode_scalar(a_batch_p, a_raw_p, i);
+}
+
+__attribute__((target("avx2")))
+static __m256 ad5933_batch_atan2_avx2(__m256 a_y, __m256 a_x) {
+
+	const __m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 ax = _mm256_andnot_ps(sign, a_x);
+	__m256 ay = _mm256_andnot_ps(sign, a_y);
+	__m256 hi = _mm256_max_ps(ax, ay);
+	__m256 lo = _mm256_min_ps(ax, ay);
+	__m256 a, s, r;
+
+	a = _mm256_and_ps(_mm256_div_ps(lo, hi), _mm256_cmp_ps(hi, _mm256_setzero_ps(), _CMP_GT_OQ));
+	s = _mm256_mul_ps(a, a);
+
+	r = _mm256_add_ps(_mm256_set1_ps(BATCH_ATAN_C3), _mm256_mul_ps(s, _mm256_set1_ps(BATCH_ATAN_C4)));
+	r = _mm256_add_ps(_mm256_set1_ps(BATCH_ATAN_C2), _mm256_mul_ps(s, r));
+	r = _mm256_add_ps(_mm256_set1_ps(BATCH_ATAN_C1), _mm256_mul_ps(s, r));
+	r = _mm256_add_ps(_mm256_set1_ps(BATCH_ATAN_C0), _mm256_mul_ps(s, r));
+	r = _mm256_mul_ps(a, r);
+
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(BATCH_PI_2), r), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+	r = _mm256_blendv_ps(r, _mm256_sub_ps(_mm256_set1_ps(BATCH_PI), r), _mm256_cmp_ps(a_x, _mm256_setzero_ps(), _CMP_LT_OQ));
+
+	return _mm256_xor_ps(r, _mm256_and_ps(_mm256_cmp_ps(a_y, _mm256_setzero_ps(), _CMP_LT_OQ), sign));
+}
+
+__attribute__((target("avx2")))
+static void ad5933_batch_impedance_avx2(ad5933_batch* a_batch_p) {
+
+	unsigned int i;
+	__m256 re, im, mag, ph;
+
+	for(i = 0; (i + 8) <= a_batch_p->num; i += 8) {
+
+		re = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&a_batch_p->real[i])));
+		im = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)&a_batch_p->imaginary[i])));
+
+		mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(re, re), _mm256_mul_ps(im, im)));
+		_mm256_storeu_ps(&a_batch_p->impedance[i], _mm256_div_ps(_mm256_loadu_ps(&a_batch_p->gain[i]), mag));
+
+		ph = _mm256_mul_ps(ad5933_batch_atan2_avx2(im, re), _mm256_set1_ps(BATCH_RAD2DEG));
+		_mm256_storeu_ps(&a_batch_p->phase[i], _mm256_sub_ps(ph, _mm256_loadu_ps(&a_batch_p->system_phase[i])));
+	}
+
+	ad5933_batch_impedance_scalar(a_batch_p, i);
+}
+
+#endif
+
+unsigned char ad5933_batch_isa_detect(void) {
+
+#ifdef AD5933_BATCH_X86
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2")) {
+		return E_AD5933_BATCH_AVX2;
+	}
+	if(__builtin_cpu_supports("sse2")) {
+		return E_AD5933_BATCH_SSE2;
+	}
+#endif
+
+	return E_AD5933_BATCH_SCALAR;
+}
+
+unsigned char ad5933_batch_isa_select(unsigned char a_isa) {
+
+	unsigned char isa = ad5933_batch_isa_detect();
+
+	g_batch_isa = (a_isa < isa) ? a_isa : isa;
+
+	return g_batch_isa;
+}
+
+void ad5933_batch_decode(ad5933_batch* a_batch_p, const unsigned char* a_raw_p) {
+
+	if(g_batch_isa < 0) {
+		g_batch_isa = ad5933_batch_isa_detect();
+	}
+
+	switch(g_batch_isa) {
+#ifdef AD5933_BATCH_X86
+	case E_AD5933_BATCH_AVX2:
+		ad5933_batch_decode_avx2(a_batch_p, a_raw_p);
+		break;
+	case E_AD5933_BATCH_SSE2:
+		ad5933_batch_decode_sse2(a_batch_p, a_raw_p);
+		break;
+#endif
+	default:
+		ad5933_batch_decode_scalar(a_batch_p, a_raw_p, 0);
+		break;
+	}
+}
+
+void ad5933_batch_impedance(ad5933_batch* a_batch_p) {
+
+	if(g_batch_isa < 0) {
+		g_batch_isa = ad5933_batch_isa_detect();
+	}
+
+	switch(g_batch_isa) {
+#ifdef AD5933_BATCH_X86
+	case E_AD5933_BATCH_AVX2:
+		ad5933_batch_impedance_avx2(a_batch_p);
+		break;
+	case E_AD5933_BATCH_SSE2:
+		ad5933_batch_impedance_sse2(a_batch_p);
+		break;
+#endif
+	default:
+		ad5933_batch_impedance_scalar(a_batch_p, 0);
+		break;
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef AD5933_BATCH_H_H5CV8TQN
+#define AD5933_BATCH_H_H5CV8TQN
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_batch.h 
+ *
+ * @brief Host side batch processing of raw AD5933 points
+ *
+ * Points are kept as a structure of arrays, one array per field, so the
+ * kernels load consecutive points straight into vector registers. Every
+ * kernel has a scalar version and, on x86, SSE2 and AVX2 versions picked
+ * at run time from the CPU features. All versions use the same arithmetic
+ * and agree to float rounding.
+ */
+
+/**
+ * @brief Kernel sets
+ */
+typedef enum _e_ad5933_batch_isa {
+
+	E_AD5933_BATCH_SCALAR = 0x00,
+	E_AD5933_BATCH_SSE2,
+	E_AD5933_BATCH_AVX2
+
+} e_ad5933_batch_isa;
+
+/**
+ * @brief Batch of points, structure of arrays
+ */
+typedef struct _ad5933_batch {
+
+	// number of points
+	unsigned int num;
+
+	// real and imaginary data
+	short* real;
+	short* imaginary;
+
+	// gain factor and system phase of each point, from the calibration
+	const float* gain;
+	const float* system_phase;
+
+	// impedance magnitude in ohm and phase in degrees
+	float* impedance;
+	float* phase;
+
+} ad5933_batch;
+
+/**
+ * @brief Best kernel set supported by the CPU
+ * @param none.
+ *
+ * @return a e_ad5933_batch_isa value
+ */
+unsigned char ad5933_batch_isa_detect(void);
+
+/**
+ * @brief Select the kernel set, lower than detected only
+ *
+ * @param a_isa a e_ad5933_batch_isa value
+ *
+ * @return kernel set in use
+ */
+unsigned char ad5933_batch_isa_select(unsigned char a_isa);
+
+/**
+ * @brief Decode raw burst reads
+ *
+ * The raw data is the Real and Imaginary registers as read from the
+ * AD5933, four bytes per point, high byte first, 2's complement.
+ *
+ * @param a_batch_p a batch, real and imaginary are written
+ * @param a_raw_p raw data of a_batch_p->num points
+ *
+ */
+void ad5933_batch_decode(ad5933_batch* a_batch_p, const unsigned char* a_raw_p);
+
+/**
+ * @brief Impedance of every point
+ *
+ * |Z| = gain / |real + j imaginary|, phase = atan2(imaginary, real) - system
+ * phase. The gain factor is Zcal * |Mcal| of the calibration point, a
+ * zero magnitude gives an infinite impedance. atan2 is a polynomial with
+ * a max error of 0.001 degrees.
+ *
+ * @param a_batch_p a batch, impedance and phase are written
+ *
+ */
+void ad5933_batch_impedance(ad5933_batch* a_batch_p);
+
+
+#endif /* end of include guard: AD5933_BATCH_H_H5CV8TQN */
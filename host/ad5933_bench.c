@@ -0,0 +1,143 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_bench.c
+ *
+ * @brief Throughput and accuracy of the batch kernels
+ *
+ * usage: ad5933_bench [points]
+ *
+ * Runs every kernel set the CPU supports on the same random points and
+ * compares them against the scalar kernels and libm atan2.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ad5933_batch.h"
+
+/* Default number of points */
+#define BENCH_POINTS 1000000
+
+/* Runs per kernel, the best is reported */
+#define BENCH_RUNS 10
+
+static const char* g_bench_isa_name[] = {"scalar", "sse2", "avx2"};
+
+static double bench_now(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static void bench_alloc(ad5933_batch* a_batch_p, unsigned int a_num, const float* a_gain_p, const float* a_phase_p) {
+
+	a_batch_p->num = a_num;
+	a_batch_p->real = malloc(a_num * sizeof(short));
+	a_batch_p->imaginary = malloc(a_num * sizeof(short));
+	a_batch_p->gain = a_gain_p;
+	a_batch_p->system_phase = a_phase_p;
+	a_batch_p->impedance = malloc(a_num * sizeof(float));
+	a_batch_p->phase = malloc(a_num * sizeof(float));
+}
+
+int main(int argc, char* argv[]) {
+
+	unsigned int num = (argc > 1) ? strtoul(argv[1], NULL, 0) : BENCH_POINTS;
+	unsigned char* raw = malloc(4 * num);
+	float* gain = malloc(num * sizeof(float));
+	float* system_phase = malloc(num * sizeof(float));
+	ad5933_batch ref, batch;
+	unsigned char isa, best;
+	unsigned int i, run;
+	double t, t_decode, t_impedance, err_z, err_ph, err_libm, d;
+
+	srand(1);
+	for(i = 0; i < (4 * num); i++) {
+		raw[i] = rand();
+	}
+	for(i = 0; i < num; i++) {
+		gain[i] = 1e6f * (1.0f + ((rand() % 1000) * 1e-3f));
+		system_phase[i] = (rand() % 2000) * 1e-3f - 1.0f;
+	}
+
+	bench_alloc(&ref, num, gain, system_phase);
+	bench_alloc(&batch, num, gain, system_phase);
+
+	ad5933_batch_isa_select(E_AD5933_BATCH_SCALAR);
+	ad5933_batch_decode(&ref, raw);
+	ad5933_batch_impedance(&ref);
+
+	//Polynomial atan2 against libm
+	err_libm = 0;
+	for(i = 0; i < num; i++) {
+		d = (atan2(ref.imaginary[i], ref.real[i]) * (180 / M_PI)) - system_phase[i];
+		d = fabs(ref.phase[i] - d);
+		err_libm = (d > err_libm) ? d : err_libm;
+	}
+
+	best = ad5933_batch_isa_detect();
+	printf("%u points, polynomial atan2 max error %.5f deg\n", num, err_libm);
+	printf("isa     decode Mpt/s  impedance Mpt/s  max |Z| dev  max phase dev\n");
+
+	for(isa = E_AD5933_BATCH_SCALAR; isa <= best; isa++) {
+
+		ad5933_batch_isa_select(isa);
+
+		t_decode = t_impedance = 1e9;
+		for(run = 0; run < BENCH_RUNS; run++) {
+			memset(batch.real, 0, num * sizeof(short));
+			memset(batch.imaginary, 0, num * sizeof(short));
+
+			t = bench_now();
+			ad5933_batch_decode(&batch, raw);
+			t = bench_now() - t;
+			t_decode = (t < t_decode) ? t : t_decode;
+
+			t = bench_now();
+			ad5933_batch_impedance(&batch);
+			t = bench_now() - t;
+			t_impedance = (t < t_impedance) ? t : t_impedance;
+		}
+
+		if(memcmp(batch.real, ref.real, num * sizeof(short)) || memcmp(batch.imaginary, ref.imaginary, num * sizeof(short))) {
+			printf("%s decode mismatch\n", g_bench_isa_name[isa]);
+			return 1;
+		}
+
+		err_z = err_ph = 0;
+		for(i = 0; i < num; i++) {
+			if(isfinite(ref.impedance[i])) {
+				d = fabs(batch.impedance[i] - ref.impedance[i]) / ref.impedance[i];
+				err_z = (d > err_z) ? d : err_z;
+			}
+			d = fabs(batch.phase[i] - ref.phase[i]);
+			err_ph = (d > err_ph) ? d : err_ph;
+		}
+
+		printf("%-7s %12.1f  %15.1f  %11.2g  %13.2g\n", g_bench_isa_name[isa], num / t_decode * 1e-6, num / t_impedance * 1e-6, err_z, err_ph);
+	}
+
+	return 0;
+}
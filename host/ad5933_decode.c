@@ -0,0 +1,82 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_decode.c
+ *
+ * @brief Prints the records of a AD5933 stream as CSV
+ *
+ * usage: ad5933_decode [file] [MCLK Hz]
+ *
+ * Reads the serial capture from the file or the standard input, e.g. a
+ * serial port set up with stty.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ad5933_host.h"
+
+/* Internal AD5933 oscillator */
+#define DECODE_MCLK_HZ 16.776e6
+
+/* Records decoded per read */
+#define DECODE_RECORDS 256
+
+
+int main(int argc, char** argv) {
+
+	static ad5933_host_decoder dec;
+	static ad5933_host_record records[DECODE_RECORDS];
+	unsigned char buf[512];
+	FILE* in = stdin;
+	double mclk = (argc > 2) ? atof(argv[2]) : DECODE_MCLK_HZ;
+	unsigned int len, pos, used, num, i;
+
+	if((argc > 1) && ((in = fopen(argv[1], "rb")) == NULL)) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	ad5933_host_init(&dec);
+	printf("device,index,frequency,real,imaginary,status,setting,samples,temperature\n");
+
+	while((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+
+		for(pos = 0; pos < len; pos += used) {
+
+			num = ad5933_host_feed(&dec, &buf[pos], len - pos, records, DECODE_RECORDS, &used);
+
+			for(i = 0; i < num; i++) {
+				printf("%u,%u,%.3f,%d,%d,0x%02x,0x%02x,%u,", records[i].device, records[i].index, ad5933_host_frequency(records[i].frequency_code, mclk),
+					records[i].real, records[i].imaginary, records[i].status, records[i].setting, records[i].samples);
+
+				//Empty temperature before the first measurement
+				if(records[i].temperature == AD5933_HOST_TEMP_UNKNOWN) {
+					printf("\n");
+				}
+				else {
+					printf("%.2f\n", records[i].temperature / 32.0);
+				}
+			}
+		}
+	}
+
+	fprintf(stderr, "frames %lu, crc errors %lu, format errors %lu\n", dec.frames, dec.crc_errors, dec.format_errors);
+
+	return 0;
+}
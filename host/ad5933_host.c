@@ -0,0 +1,182 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file ad5933_host.c 
+ *
+ * @brief Host side decoder of the AD5933 record stream
+ */
+
+#include "ad5933_host.h"
+
+/**
+ * @brief CRC-16/CCITT, polynomial 0x1021, initial value 0xffff
+ */
+static unsigned int ad5933_host_crc(const unsigned char* a_data_p, unsigned int a_size) {
+
+	unsigned int crc = 0xffff;
+	unsigned char i;
+
+	while(a_size--) {
+		crc ^= (unsigned int)*a_data_p++ << 8;
+		for(i = 0; i < 8; i++) {
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+		}
+		crc &= 0xffff;
+	}
+
+	return crc;
+}
+
+/**
+ * @brief COBS decode
+ *
+ * @return decoded size, 0 on a malformed frame
+ */
+static unsigned int ad5933_host_cobs(const unsigned char* a_data_p, unsigned int a_size, unsigned char* a_out_p) {
+
+	unsigned int in = 0;
+	unsigned int out = 0;
+	unsigned char code, i;
+
+	while(in < a_size) {
+
+		code = a_data_p[in++];
+		if((code == 0) || ((in + code - 1) > a_size)) {
+			return 0;
+		}
+
+		for(i = 1; i < code; i++) {
+			a_out_p[out++] = a_data_p[in++];
+		}
+
+		//Short block ends with a zero, except the last one
+		if((code != 0xff) && (in < a_size)) {
+			a_out_p[out++] = 0;
+		}
+	}
+
+	return out;
+}
+
+/**
+ * @brief Unpack a decoded frame
+ *
+ * @return number of records, -1 when the frame is not valid
+ */
+static int ad5933_host_frame(ad5933_host_decoder* a_dec_p, ad5933_host_record* a_record_p, unsigned int a_max_num) {
+
+	unsigned char p[AD5933_HOST_FRAME_MAX];
+	unsigned int size, crc, num, i;
+
+	size = ad5933_host_cobs(a_dec_p->frame, a_dec_p->len, p);
+
+	if(size < (AD5933_HOST_HEADER_SIZE + AD5933_HOST_CRC_SIZE)) {
+		a_dec_p->format_errors++;
+		return -1;
+	}
+
+	crc = p[size - 2] | ((unsigned int)p[size - 1] << 8);
+	if(crc != ad5933_host_crc(p, size - AD5933_HOST_CRC_SIZE)) {
+		a_dec_p->crc_errors++;
+		return -1;
+	}
+
+	num = p[2];
+	if((p[0] != AD5933_HOST_TYPE_RECORDS) || (size != (AD5933_HOST_HEADER_SIZE + (num * AD5933_HOST_RECORD_SIZE) + AD5933_HOST_CRC_SIZE))) {
+		a_dec_p->format_errors++;
+		return -1;
+	}
+
+	if(num > a_max_num) {
+		return -2;
+	}
+
+	for(i = 0; i < num; i++, a_record_p++) {
+		const unsigned char* r = &p[AD5933_HOST_HEADER_SIZE + (i * AD5933_HOST_RECORD_SIZE)];
+
+		a_record_p->device = p[1];
+		a_record_p->index = r[0] | ((unsigned int)r[1] << 8);
+		a_record_p->frequency_code = r[2] | ((unsigned long)r[3] << 8) | ((unsigned long)r[4] << 16);
+		a_record_p->real = (short)(r[5] | (r[6] << 8));
+		a_record_p->imaginary = (short)(r[7] | (r[8] << 8));
+		a_record_p->status = r[9];
+		a_record_p->setting = r[10];
+		a_record_p->samples = r[11];
+		a_record_p->temperature = (short)(r[12] | (r[13] << 8));
+	}
+
+	a_dec_p->frames++;
+	return num;
+}
+
+void ad5933_host_init(ad5933_host_decoder* a_dec_p) {
+
+	a_dec_p->len = 0;
+	a_dec_p->overflow = 0;
+	a_dec_p->frames = 0;
+	a_dec_p->crc_errors = 0;
+	a_dec_p->format_errors = 0;
+}
+
+unsigned int ad5933_host_feed(ad5933_host_decoder* a_dec_p, const unsigned char* a_data_p, unsigned int a_size, ad5933_host_record* a_record_p, unsigned int a_max_num, unsigned int* a_used_p) {
+
+	unsigned int i;
+	unsigned int num = 0;
+	int ret;
+
+	for(i = 0; i < a_size; i++) {
+
+		if(a_data_p[i] != 0) {
+			//Frame too long, drop it up to the next delimiter
+			if(a_dec_p->len < AD5933_HOST_FRAME_MAX) {
+				a_dec_p->frame[a_dec_p->len++] = a_data_p[i];
+			}
+			else {
+				a_dec_p->overflow = 1;
+			}
+			continue;
+		}
+
+		//Delimiter, a empty frame is only a resync
+		if(a_dec_p->overflow) {
+			a_dec_p->format_errors++;
+		}
+		else if(a_dec_p->len) {
+			ret = ad5933_host_frame(a_dec_p, &a_record_p[num], a_max_num - num);
+
+			//No room left, keep the frame for the next call
+			if(ret == -2) {
+				break;
+			}
+			if(ret > 0) {
+				num += ret;
+			}
+		}
+		a_dec_p->len = 0;
+		a_dec_p->overflow = 0;
+	}
+
+	*a_used_p = i;
+	return num;
+}
+
+double ad5933_host_frequency(unsigned long a_code, double a_mclk_hz) {
+
+	return a_code * a_mclk_hz / 536870912.0;
+}
@@ -0,0 +1,129 @@
+#ifndef AD5933_HOST_H_B7NZ4KWE
+#define AD5933_HOST_H_B7NZ4KWE
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_host.h 
+ *
+ * @brief Host side decoder of the AD5933 record stream
+ *
+ * Feed it the bytes read from the serial port in any chunk size. Frames
+ * are COBS decoded, checked against their CRC and unpacked into records,
+ * see ad5933_stream.h for the frame layout. Damaged frames are counted
+ * and dropped, decoding resumes at the next zero byte.
+ */
+
+/* Stream frame contents, same as ad5933_stream.h */
+#define AD5933_HOST_TYPE_RECORDS 0x01
+#define AD5933_HOST_HEADER_SIZE 3
+#define AD5933_HOST_RECORD_SIZE 14
+#define AD5933_HOST_CRC_SIZE 2
+
+/* Record temperature before the first measurement */
+#define AD5933_HOST_TEMP_UNKNOWN ((short)0x8000)
+
+/* Largest encoded frame accepted */
+#define AD5933_HOST_FRAME_MAX 1024
+
+/**
+ * @brief Decoded sweep record
+ */
+typedef struct _ad5933_host_record {
+
+	// device number inside the board
+	unsigned char device;
+
+	// point index inside the sweep or frequency plan
+	unsigned int index;
+
+	// frequency code of the point
+	unsigned long frequency_code;
+
+	// real and imaginary data
+	short real;
+	short imaginary;
+
+	// AD5933 status, range setting and samples averaged
+	unsigned char status;
+	unsigned char setting;
+	unsigned char samples;
+
+	// temperature in 1/32 degree C, AD5933_HOST_TEMP_UNKNOWN before the first measurement
+	short temperature;
+
+} ad5933_host_record;
+
+/**
+ * @brief Stream decoder state and counters
+ */
+typedef struct _ad5933_host_decoder {
+
+	// encoded bytes of the current frame
+	unsigned char frame[AD5933_HOST_FRAME_MAX];
+	unsigned int len;
+
+	// frame dropped until the next delimiter
+	unsigned char overflow;
+
+	// good frames, CRC failures and malformed frames
+	unsigned long frames;
+	unsigned long crc_errors;
+	unsigned long format_errors;
+
+} ad5933_host_decoder;
+
+/**
+ * @brief initialize a decoder
+ *
+ * @param a_dec_p a decoder
+ *
+ */
+void ad5933_host_init(ad5933_host_decoder* a_dec_p);
+
+/**
+ * @brief Decode stream bytes
+ *
+ * Records of a frame are only returned when all of them fit in the
+ * array, size it for at least one full frame.
+ *
+ * @param a_dec_p a decoder
+ * @param a_data_p received bytes
+ * @param a_size number of bytes
+ * @param a_record_p a record array
+ * @param a_max_num a array size
+ * @param a_used_p bytes consumed, the rest must be fed again
+ *
+ * @return number of records decoded
+ */
+unsigned int ad5933_host_feed(ad5933_host_decoder* a_dec_p, const unsigned char* a_data_p, unsigned int a_size, ad5933_host_record* a_record_p, unsigned int a_max_num, unsigned int* a_used_p);
+
+/**
+ * @brief Frequency of a frequency code
+ *
+ * @param a_code a frequency code
+ * @param a_mclk_hz a AD5933 system clock
+ *
+ * @return frequency in Hz
+ */
+double ad5933_host_frequency(unsigned long a_code, double a_mclk_hz);
+
+
+#endif /* end of include guard: AD5933_HOST_H_B7NZ4KWE */
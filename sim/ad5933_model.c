@@ -0,0 +1,338 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include <math.h>
+#include <string.h>
+#include "hal.h"
+#include "dev_ad5933.h"
+#include "sim.h"
+
+/* DFT of 1024 samples taken at MCLK/16 */
+#define MODEL_DFT_SAMPLES 1024.0
+
+/* Temperature conversion time */
+#define MODEL_TEMP_TIME 800e-6
+
+/* DFT code per volt peak to peak at the ADC input */
+#define MODEL_DFT_GAIN 4500.0
+
+/**
+ * @brief Excitation amplitude in volts peak to peak, indexed by the range bits
+ */
+static const double g_model_vrange[4] = { 1.98, 0.198, 0.383, 0.971 };
+
+/**
+ * @brief Uniform noise source in [0, 1)
+ */
+static double model_random(ad5933_model* a_model) {
+
+	a_model->seed = a_model->seed * 1103515245UL + 12345UL;
+
+	return ((a_model->seed >> 8) & 0xffffff) / 16777216.0;
+}
+
+/**
+ * @brief Gaussian noise source with unit variance
+ */
+static double model_gauss(ad5933_model* a_model) {
+
+	double u1 = model_random(a_model) + 1e-12;
+	double u2 = model_random(a_model);
+
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+static unsigned long model_reg24(const ad5933_model* a_model, unsigned char a_reg) {
+
+	return ((unsigned long)a_model->regs[a_reg] << 16) | ((unsigned long)a_model->regs[a_reg + 1] << 8) | a_model->regs[a_reg + 2];
+}
+
+static unsigned int model_reg9(const ad5933_model* a_model, unsigned char a_reg) {
+
+	return ((a_model->regs[a_reg] & 0x01) << 8) | a_model->regs[a_reg + 1];
+}
+
+/**
+ * @brief System clock selected by the control register
+ */
+static double model_mclk(const ad5933_model* a_model) {
+
+	return (a_model->regs[AD5933_CTRL_LOW] & AD5933_EXT_CLK) ? a_model->ext_mclk_hz : a_model->mclk_hz;
+}
+
+double ad5933_model_frequency(const ad5933_model* a_model, unsigned long a_code) {
+
+	return a_code * (model_mclk(a_model) / 4.0) / 134217728.0;
+}
+
+/**
+ * @brief Frequency of the current increment
+ */
+static double model_current_frequency(const ad5933_model* a_model) {
+
+	unsigned long code = model_reg24(a_model, AD5933_FREQ_HIGH) + a_model->index * model_reg24(a_model, AD5933_FREQ_INC_HIGH);
+
+	return ad5933_model_frequency(a_model, code);
+}
+
+/**
+ * @brief Settling time programmed in NUM_SETTLE for the current frequency
+ */
+static double model_settle_time(const ad5933_model* a_model) {
+
+	static const unsigned char multiplier[4] = { 1, 2, 1, 4 };
+	unsigned int cycles = model_reg9(a_model, AD5933_NUM_SETTLE_HIGH) * multiplier[(a_model->regs[AD5933_NUM_SETTLE_HIGH] >> 1) & 0x03];
+	double freq = model_current_frequency(a_model);
+
+	if(freq <= 0) {
+		return 0;
+	}
+
+	return cycles / freq;
+}
+
+/**
+ * @brief Start a DFT conversion at the current frequency
+ *
+ * @param a_extra_settle excitation time before the settling cycles
+ */
+static void model_start_dft(ad5933_model* a_model, double a_extra_settle) {
+
+	a_model->t_settle = model_settle_time(a_model) + a_extra_settle;
+	a_model->t_dft = sim_time() + model_settle_time(a_model) + (MODEL_DFT_SAMPLES * 16.0) / model_mclk(a_model);
+	a_model->regs[AD5933_STATUS] &= ~(AD5933_STAT_DATA_VALID | AD5933_STAT_SWEEP_DONE);
+}
+
+static short model_clip(double a_value) {
+
+	if(a_value > 32767.0) {
+		return 32767;
+	}
+	if(a_value < -32768.0) {
+		return -32768;
+	}
+	return (short)lrint(a_value);
+}
+
+/**
+ * @brief Produce the DFT result of the finished conversion
+ */
+static void model_finish_dft(ad5933_model* a_model) {
+
+	double freq = model_current_frequency(a_model);
+	double w = 2.0 * M_PI * freq;
+	double z_re = a_model->load.r_ohm;
+	double z_im = w * a_model->load.l_h;
+	double z_mag, rfb, gain, mag, phase, error, noise;
+	unsigned char ctrl = a_model->regs[AD5933_CTRL_HIGH];
+	short re, im;
+
+	if(a_model->load.c_f > 0) {
+		z_im -= 1.0 / (w * a_model->load.c_f);
+	}
+	z_mag = sqrt(z_re * z_re + z_im * z_im);
+
+	rfb = (a_model->rfb == HAL_RFB_20R) ? 20.0 : 100000.0;
+	gain = (ctrl & AD5933_PGA_1X) ? 1.0 : 5.0;
+
+	//Receive path voltage times the DFT scale
+	mag = MODEL_DFT_GAIN * g_model_vrange[(ctrl >> 1) & 0x03] * gain * rfb / z_mag;
+	phase = -atan2(z_im, z_re) - w * a_model->load.phase_delay_s;
+
+	//Residual transient of an excitation that did not settle
+	if(a_model->load.tau_s > 0) {
+		error = exp(-a_model->t_settle / a_model->load.tau_s);
+		mag *= 1.0 + 0.5 * error;
+		phase += 0.3 * error;
+	}
+
+	noise = a_model->load.noise * sqrt(1.0 + a_model->load.noise_corner_hz / freq);
+	re = model_clip(mag * cos(phase) + noise * model_gauss(a_model));
+	im = model_clip(mag * sin(phase) + noise * model_gauss(a_model));
+
+	a_model->regs[AD5933_REAL_HIGH] = (unsigned short)re >> 8;
+	a_model->regs[AD5933_REAL_LOW] = (unsigned short)re & 0xff;
+	a_model->regs[AD5933_IMAG_HIGH] = (unsigned short)im >> 8;
+	a_model->regs[AD5933_IMAG_LOW] = (unsigned short)im & 0xff;
+
+	a_model->regs[AD5933_STATUS] |= AD5933_STAT_DATA_VALID;
+	if(a_model->index >= model_reg9(a_model, AD5933_NUM_INC_HIGH)) {
+		a_model->regs[AD5933_STATUS] |= AD5933_STAT_SWEEP_DONE;
+	}
+
+	a_model->conversions++;
+	a_model->t_dft = -1;
+}
+
+/**
+ * @brief Bring the conversions up to the simulated time
+ */
+static void model_update(ad5933_model* a_model) {
+
+	unsigned short code;
+
+	if((a_model->t_dft >= 0) && (sim_time() >= a_model->t_dft)) {
+		model_finish_dft(a_model);
+	}
+
+	if((a_model->t_temp >= 0) && (sim_time() >= a_model->t_temp)) {
+		code = (unsigned short)lrint(a_model->load.temperature_c * 32.0) & 0x3fff;
+		a_model->regs[AD5933_TEMP_HIGH] = code >> 8;
+		a_model->regs[AD5933_TEMP_LOW] = code & 0xff;
+		a_model->regs[AD5933_STATUS] |= AD5933_STAT_TEMP_VALID;
+		a_model->t_temp = -1;
+	}
+}
+
+/**
+ * @brief Control register function written
+ */
+static void model_control(ad5933_model* a_model) {
+
+	switch(a_model->regs[AD5933_CTRL_HIGH] & 0xf0) {
+	case AD5933_INIT:
+		a_model->mode = E_MODEL_INIT;
+		a_model->index = 0;
+		a_model->t_init = sim_time();
+		a_model->t_freq = sim_time();
+		a_model->t_dft = -1;
+		a_model->regs[AD5933_STATUS] &= ~(AD5933_STAT_DATA_VALID | AD5933_STAT_SWEEP_DONE);
+		break;
+
+	case AD5933_SWEEP:
+		if(a_model->mode == E_MODEL_INIT) {
+			a_model->mode = E_MODEL_SWEEP;
+			model_start_dft(a_model, sim_time() - a_model->t_init);
+		}
+		break;
+
+	case AD5933_INCFREQ:
+		if((a_model->mode == E_MODEL_SWEEP) && (a_model->index < model_reg9(a_model, AD5933_NUM_INC_HIGH))) {
+			a_model->index++;
+			a_model->t_freq = sim_time();
+			model_start_dft(a_model, 0);
+		}
+		break;
+
+	case AD5933_REPEAT_FREQ:
+		//The excitation kept running at the same frequency
+		if(a_model->mode == E_MODEL_SWEEP) {
+			model_start_dft(a_model, sim_time() - a_model->t_freq);
+		}
+		break;
+
+	case AD5933_MEASURE_TEMP:
+		a_model->regs[AD5933_STATUS] &= ~AD5933_STAT_TEMP_VALID;
+		a_model->t_temp = sim_time() + MODEL_TEMP_TIME;
+		break;
+
+	case AD5933_PWR_DWN:
+		a_model->mode = E_MODEL_POWER_DOWN;
+		a_model->t_dft = -1;
+		break;
+
+	case AD5933_STANDBY:
+		a_model->mode = E_MODEL_STANDBY;
+		a_model->t_dft = -1;
+		break;
+
+	default:
+		break;
+	}
+}
+
+void ad5933_model_reset(ad5933_model* a_model) {
+
+	ad5933_model_load load = a_model->load;
+	unsigned char rfb = a_model->rfb;
+
+	memset(a_model, 0, sizeof(*a_model));
+
+	a_model->load = load;
+	a_model->rfb = rfb;
+	a_model->regs[AD5933_CTRL_HIGH] = AD5933_PWR_DWN;
+	a_model->mode = E_MODEL_POWER_DOWN;
+	a_model->t_dft = -1;
+	a_model->t_temp = -1;
+	a_model->mclk_hz = 16.776e6;
+	a_model->ext_mclk_hz = 16e6;
+	a_model->seed = 1;
+}
+
+void ad5933_model_write(ad5933_model* a_model, const unsigned char* a_data_p, unsigned char a_byte_num) {
+
+	unsigned char i;
+
+	model_update(a_model);
+
+	if(a_byte_num < 2) {
+		return;
+	}
+
+	switch(a_data_p[0]) {
+	case AD5933_ADDR_PTR:
+		a_model->pointer = a_data_p[1];
+		break;
+
+	case AD5933_BLOCK_WR:
+		for(i = 0; (i < a_data_p[1]) && (i + 2 < a_byte_num); i++) {
+			a_model->regs[(unsigned char)(a_model->pointer + i)] = a_data_p[i + 2];
+		}
+		if(a_model->pointer == AD5933_CTRL_HIGH) {
+			model_control(a_model);
+		}
+		break;
+
+	case AD5933_BLOCK_RD:
+		a_model->block_read_num = a_data_p[1];
+		break;
+
+	default:
+		//Write byte to a register address
+		a_model->regs[a_data_p[0]] = a_data_p[1];
+
+		if(a_data_p[0] == AD5933_CTRL_HIGH) {
+			model_control(a_model);
+		}
+		else if((a_data_p[0] == AD5933_CTRL_LOW) && (a_data_p[1] & AD5933_RESET)) {
+			a_model->mode = E_MODEL_STANDBY;
+			a_model->t_dft = -1;
+			a_model->regs[AD5933_STATUS] &= ~(AD5933_STAT_DATA_VALID | AD5933_STAT_SWEEP_DONE);
+		}
+		break;
+	}
+}
+
+void ad5933_model_read(ad5933_model* a_model, unsigned char* a_data_p, unsigned char a_byte_num) {
+
+	unsigned char i;
+
+	model_update(a_model);
+
+	for(i = 0; i < a_byte_num; i++) {
+		//Block read walks from the pointer, a receive byte returns the pointer location
+		if(a_model->block_read_num) {
+			a_data_p[i] = a_model->regs[(unsigned char)(a_model->pointer + i)];
+		}
+		else {
+			a_data_p[i] = a_model->regs[a_model->pointer];
+		}
+	}
+
+	a_model->block_read_num = 0;
+}
@@ -0,0 +1,161 @@
+#ifndef AD5933_MODEL_H_W6PD4JCE
+#define AD5933_MODEL_H_W6PD4JCE
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file ad5933_model.h 
+ *
+ * @brief Register level behavioural model of the AD5933
+ *
+ * Models the address pointer, the block read/write commands, the control
+ * register state machine, the status bits and the settling and DFT timing.
+ * Real and imaginary results are derived from a series RLC load seen
+ * through the 20 ohm / 100K ohm ADG849 feedback path.
+ */
+
+/**
+ * @brief Model control states
+ */
+typedef enum _e_ad5933_model_mode {
+
+	E_MODEL_POWER_DOWN = 0x00,
+	E_MODEL_STANDBY,
+	E_MODEL_INIT,
+	E_MODEL_SWEEP
+
+} e_ad5933_model_mode;
+
+/**
+ * @brief Load and analog front end parameters
+ */
+typedef struct _ad5933_model_load {
+
+	// series resistance, inductance and capacitance, c_f = 0 for no capacitor
+	double r_ohm;
+	double l_h;
+	double c_f;
+
+	// time constant of the excitation settling after INIT and frequency steps
+	double tau_s;
+
+	// DFT noise in codes rms
+	double noise;
+
+	// flicker noise corner, the noise grows as sqrt(1 + corner / f) below it
+	double noise_corner_hz;
+
+	// die temperature in Celsius
+	double temperature_c;
+
+	// system phase delay in seconds
+	double phase_delay_s;
+
+} ad5933_model_load;
+
+/**
+ * @brief AD5933 model state
+ */
+typedef struct _ad5933_model {
+
+	// register map
+	unsigned char regs[256];
+
+	// address pointer
+	unsigned char pointer;
+
+	// bytes requested by the last block read command
+	unsigned char block_read_num;
+
+	// control state and increment index
+	unsigned char mode;
+	unsigned int index;
+
+	// time of the last INIT command
+	double t_init;
+
+	// start of the excitation at the current frequency
+	double t_freq;
+
+	// completion time of the pending DFT, negative if none
+	double t_dft;
+
+	// settling time applied to the pending DFT
+	double t_settle;
+
+	// completion time of the pending temperature conversion, negative if none
+	double t_temp;
+
+	// DFT conversions done
+	unsigned long conversions;
+
+	// internal oscillator and external clock in Hz, CTRL_LOW selects one
+	double mclk_hz;
+	double ext_mclk_hz;
+
+	// ADG849 feedback path, HAL_RFB_20R or HAL_RFB_100K
+	unsigned char rfb;
+
+	ad5933_model_load load;
+
+	// noise generator state
+	unsigned long seed;
+
+} ad5933_model;
+
+/**
+ * @brief Power on reset of the model
+ *
+ * @param a_model a model
+ *
+ */
+void ad5933_model_reset(ad5933_model* a_model);
+
+/**
+ * @brief Bytes written by the master in a transaction
+ *
+ * @param a_model a model
+ * @param a_data_p data bytes
+ * @param a_byte_num number of bytes
+ *
+ */
+void ad5933_model_write(ad5933_model* a_model, const unsigned char* a_data_p, unsigned char a_byte_num);
+
+/**
+ * @brief Bytes read by the master in a transaction
+ *
+ * @param a_model a model
+ * @param a_data_p data buffer
+ * @param a_byte_num number of bytes
+ *
+ */
+void ad5933_model_read(ad5933_model* a_model, unsigned char* a_data_p, unsigned char a_byte_num);
+
+/**
+ * @brief Output frequency for a frequency code
+ *
+ * @param a_model a model
+ * @param a_code a 24 bit frequency code
+ *
+ */
+double ad5933_model_frequency(const ad5933_model* a_model, unsigned long a_code);
+
+
+#endif /* end of include guard: AD5933_MODEL_H_W6PD4JCE */
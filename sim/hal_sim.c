@@ -0,0 +1,174 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include <string.h>
+#include "hal.h"
+#include "twi.h"
+#include "sim.h"
+
+/* Simulated EEPROM size, ATmega328 layout with room for the wider host longs */
+#define SIM_EEPROM_SIZE 4096
+
+/* Simulated time of a idle wake up */
+#define SIM_IDLE_TIME 10e-6
+
+/* Time base overflow period, wakes the idle sleep */
+#define SIM_TICK_TIME (256.0 * 64 / F_CPU)
+
+ad5933_model g_sim_ad5933[SIM_AD5933_NUM];
+unsigned char g_sim_mux;
+sim_bus_stats g_sim_bus;
+sim_bus_faults g_sim_faults;
+sim_uart g_sim_uart;
+
+/**
+ * @brief Simulated clock in seconds
+ */
+static double g_sim_time;
+
+/**
+ * @brief Simulated EEPROM, erased
+ */
+static unsigned char g_sim_eeprom[SIM_EEPROM_SIZE];
+static unsigned char g_sim_eeprom_init;
+
+
+double sim_time(void) {
+
+	return g_sim_time;
+}
+
+void sim_advance(double a_seconds) {
+
+	g_sim_time += a_seconds;
+	sim_twi_poll();
+}
+
+void hal_init(void) {
+
+}
+
+void hal_rfb_select(unsigned char a_channel, unsigned char a_rfb) {
+
+	//One ADG849 per simulated AD5933
+	if(a_channel >= SIM_AD5933_NUM) {
+		a_channel = 0;
+	}
+
+	g_sim_ad5933[a_channel].rfb = a_rfb;
+}
+
+unsigned long hal_time_us(void) {
+
+	return (unsigned long)(g_sim_time * 1e6);
+}
+
+void hal_delay_ms(unsigned int a_ms) {
+
+	sim_advance(a_ms * 1e-3);
+}
+
+void hal_idle(void) {
+
+	sim_advance(SIM_IDLE_TIME);
+}
+
+unsigned char hal_sleep_until(unsigned long a_time_us, unsigned char a_deep) {
+
+	long wait = (long)(a_time_us - hal_time_us());
+	unsigned char prescaler = 0;
+	double step;
+
+	if(wait <= 0) {
+		return HAL_SLEEP_IDLE;
+	}
+
+	//Idle until the time base tick, TWI_vect wakes it sooner while transactions are queued
+	if(!a_deep || ((unsigned long)wait < HAL_DEEP_SLEEP_MIN_US)) {
+		step = twi_busy() ? SIM_IDLE_TIME : SIM_TICK_TIME;
+		if(step > wait * 1e-6) {
+			step = wait * 1e-6;
+		}
+		sim_advance(step);
+		return HAL_SLEEP_IDLE;
+	}
+
+	//Same period choice as the target, room for a slow watchdog
+	wait -= wait / (HAL_WDT_TOL_DIV + 1);
+	if((unsigned long)wait < HAL_DEEP_SLEEP_MIN_US) {
+		sim_advance(SIM_TICK_TIME);
+		return HAL_SLEEP_IDLE;
+	}
+	while((prescaler < 7) && ((HAL_DEEP_SLEEP_MIN_US << (prescaler + 1)) <= (unsigned long)wait)) {
+		prescaler++;
+	}
+
+	sim_advance((HAL_DEEP_SLEEP_MIN_US << prescaler) * 1e-6);
+	return HAL_SLEEP_DEEP;
+}
+
+void hal_uart_init(unsigned long a_baud) {
+
+	g_sim_uart.baud = a_baud;
+	g_sim_uart.len = 0;
+	g_sim_uart.end = sim_time();
+}
+
+void hal_uart_send(const unsigned char* a_data_p, unsigned int a_size) {
+
+	//Start, 8 data and stop bits per byte
+	if((g_sim_uart.len + a_size) <= SIM_UART_SIZE) {
+		memcpy(&g_sim_uart.data[g_sim_uart.len], a_data_p, a_size);
+		g_sim_uart.len += a_size;
+	}
+	g_sim_uart.end = sim_time() + (a_size * 10.0) / g_sim_uart.baud;
+}
+
+unsigned char hal_uart_busy(void) {
+
+	return (sim_time() < g_sim_uart.end);
+}
+
+void hal_flash_read(void* a_data_p, const void* a_flash_p, unsigned int a_size) {
+
+	memcpy(a_data_p, a_flash_p, a_size);
+}
+
+void hal_eeprom_read(unsigned int a_addr, void* a_data_p, unsigned int a_size) {
+
+	if(!g_sim_eeprom_init) {
+		memset(g_sim_eeprom, 0xff, SIM_EEPROM_SIZE);
+		g_sim_eeprom_init = 1;
+	}
+
+	if(a_addr + a_size <= SIM_EEPROM_SIZE) {
+		memcpy(a_data_p, &g_sim_eeprom[a_addr], a_size);
+	}
+}
+
+void hal_eeprom_write(unsigned int a_addr, const void* a_data_p, unsigned int a_size) {
+
+	if(!g_sim_eeprom_init) {
+		memset(g_sim_eeprom, 0xff, SIM_EEPROM_SIZE);
+		g_sim_eeprom_init = 1;
+	}
+
+	if(a_addr + a_size <= SIM_EEPROM_SIZE) {
+		memcpy(&g_sim_eeprom[a_addr], a_data_p, a_size);
+	}
+}
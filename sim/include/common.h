@@ -0,0 +1,19 @@
+#ifndef SIM_COMMON_H
+#define SIM_COMMON_H
+
+/**
+ * @file common.h
+ *
+ * @brief Host build replacement of the board common header
+ */
+
+#include <stdint.h>
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+/* ADG849 control pin number, the pin itself is modelled by hal_sim.c */
+#define PORTD6 6
+
+#endif /* SIM_COMMON_H */
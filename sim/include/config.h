@@ -0,0 +1,12 @@
+#ifndef SIM_CONFIG_H
+#define SIM_CONFIG_H
+
+/**
+ * @file config.h
+ *
+ * @brief Host build replacement of the board configuration header
+ */
+
+#define F_CPU 16000000UL
+
+#endif /* SIM_CONFIG_H */
@@ -0,0 +1,13 @@
+#ifndef SIM_PCA_H
+#define SIM_PCA_H
+
+/**
+ * @file pca.h
+ *
+ * @brief Host build replacement of the board platform header
+ */
+
+#include "config.h"
+#include "common.h"
+
+#endif /* SIM_PCA_H */
@@ -0,0 +1,20 @@
+#ifndef SIM_TWI_COMMON_H
+#define SIM_TWI_COMMON_H
+
+/**
+ * @file twi_common.h
+ *
+ * @brief Host build replacement of the TWI clock setup header
+ */
+
+#include <stdint.h>
+
+typedef enum _e_twi_scl_freq {
+
+	E_TWI_SCL_100K = 0x00,
+	E_TWI_SCL_250K,
+	E_TWI_SCL_400K
+
+} e_twi_scl_freq;
+
+#endif /* SIM_TWI_COMMON_H */
@@ -0,0 +1,121 @@
+#ifndef SIM_H_R2M8XQPL
+#define SIM_H_R2M8XQPL
+
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+
+/**
+ * @file sim.h 
+ *
+ * @brief Host simulation environment for the AD5933 driver
+ *
+ * twi_sim.c and hal_sim.c replace twi.c and hal_avr.c, route every bus
+ * transaction to the AD5933 register model and keep a simulated clock
+ * advanced by the main loop and driver delays. Queued transactions
+ * complete in the background as the clock passes their bus time.
+ */
+
+#include "ad5933_model.h"
+
+/**
+ * @brief Bus activity counters
+ */
+typedef struct _sim_bus_stats {
+
+	// completed and failed transactions
+	unsigned long transactions;
+
+	// bytes on the wire, address bytes included
+	unsigned long bytes;
+
+	// transactions not acknowledged by the slave
+	unsigned long nacks;
+
+	// time spent on the bus in seconds
+	double bus_time;
+
+} sim_bus_stats;
+
+/**
+ * @brief Injected bus faults, every period-th transaction fails, 0 disables
+ */
+typedef struct _sim_bus_faults {
+
+	// transactions not acknowledged by the slave
+	unsigned long nack_period;
+
+	// transactions holding the bus until the timeout
+	unsigned long stuck_period;
+
+	// bus recoveries done by the engine
+	unsigned long recoveries;
+
+} sim_bus_faults;
+
+/* Captured serial output size */
+#define SIM_UART_SIZE 65536
+
+/**
+ * @brief Serial port, bytes sent and end of the transmission on the wire
+ */
+typedef struct _sim_uart {
+
+	unsigned char data[SIM_UART_SIZE];
+	unsigned long len;
+	double baud;
+	double end;
+
+} sim_uart;
+
+/* Number of simulated AD5933, channel 0 also answers without mux */
+#define SIM_AD5933_NUM 8
+
+/**
+ * @brief Simulated AD5933 behind the mux channels, mux control register, bus counters and faults
+ */
+extern ad5933_model g_sim_ad5933[SIM_AD5933_NUM];
+extern unsigned char g_sim_mux;
+extern sim_bus_stats g_sim_bus;
+extern sim_bus_faults g_sim_faults;
+extern sim_uart g_sim_uart;
+
+/**
+ * @brief Simulated time in seconds
+ * @param none.
+ *
+ */
+double sim_time(void);
+
+/**
+ * @brief Advance the simulated clock
+ *
+ * @param a_seconds time step
+ *
+ */
+void sim_advance(double a_seconds);
+
+/**
+ * @brief Complete the queued bus transactions whose bus time is over
+ * @param none.
+ *
+ */
+void sim_twi_poll(void);
+
+
+#endif /* end of include guard: SIM_H_R2M8XQPL */
@@ -0,0 +1,802 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+/**
+ * @file sim_sweep.c
+ *
+ * @brief Runs the AD5933 driver against the simulator and reports the cost
+ * of every sweep point
+ *
+ * usage: ad5933_sim [R ohm] [C farad] [L henry] [devices] [autorange] [avg samples] [nack period] [stuck period]
+ *
+ * A nack or stuck period N makes every Nth bus transaction of the
+ * measurement runs fail.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "twi.h"
+#include "dev_ad5933.h"
+#include "ad5933_calc.h"
+#include "ad5933_cal.h"
+#include "ad5933_plan.h"
+#include "ad5933_stream.h"
+#include "ad5933_store.h"
+#include "ad5933_adapt.h"
+#include "ad5933_host.h"
+#include "hal.h"
+#include "sim.h"
+
+/* Main loop period between ad5933_proc_data calls */
+#define SIM_LOOP_TIME 10e-6
+
+/* Averaging target, standard error of the mean in DFT codes */
+#define SIM_AVG_NOISE 1
+
+/* Sweep programmed at startup, register image computed at compile time */
+static const ad5933_sweep_config g_sim_sweep HAL_FLASH = AD5933_SWEEP_CONFIG(30000, 1000, 10, 40, AD5933_BASE_CFG, HAL_RFB_20R);
+
+/* Log plan, points, span and tolerance in frequency codes */
+#define SIM_PLAN_POINTS 40
+#define SIM_PLAN_START_HZ 1000
+#define SIM_PLAN_STOP_HZ 100000
+#define SIM_PLAN_TOL 320
+
+/* Serial link of the streaming run */
+#define SIM_STREAM_BAUD 115200
+
+/* Calibration resistor */
+#define SIM_CAL_OHM 200
+
+/* Full sweep kept in a store, 511 increments */
+#define SIM_FULL_START_HZ 1000
+#define SIM_FULL_DELTA_HZ 190
+#define SIM_FULL_SIZE 2200
+
+/* Periodic runs, sweep periods and simulated time of each */
+static const unsigned int g_sim_periods_ms[] = { 100, 1000 };
+#define SIM_PERIOD_RUN_TIME 5.0
+
+/* Temperature refresh period, a few times per plan sweep */
+#define SIM_TEMP_AGE_MS 100
+
+/* Settling profile bands over the plan span */
+#define SIM_SETTLE_BANDS 6
+
+/* Single frequency tracking, frequency, simulated time and ring size */
+#define SIM_TRACK_HZ 30000
+#define SIM_TRACK_TIME 1.0
+#define SIM_TRACK_RING 32
+
+/* Settling cycles of every tracking sample, the excitation runs on between them */
+#define SIM_TRACK_SETTLE 4
+
+/* Series resonance of the adaptive run, about 15.9 kHz */
+#define SIM_ADAPT_R_OHM 200.0
+#define SIM_ADAPT_L_H 10e-3
+#define SIM_ADAPT_C_F 10e-9
+
+/* Adaptive run span, dense sweep step, coarse points and point budget */
+#define SIM_ADAPT_START_HZ 5000
+#define SIM_ADAPT_STOP_HZ 50000
+#define SIM_ADAPT_STEP_HZ 100
+#define SIM_ADAPT_COARSE 16
+#define SIM_ADAPT_BUDGET 64
+
+
+/* Longest simulated time spent inside one scheduler call */
+static double g_sim_step_max;
+
+/* Records with retried transactions, a bus recovery or no data */
+static unsigned int g_sim_retried;
+static unsigned int g_sim_timeouts;
+static unsigned int g_sim_failed;
+
+/**
+ * @brief Run the started devices to the end and print every record
+ *
+ * @return number of points
+ */
+static unsigned int sim_run(ad5933_dev* const* a_dev_p, unsigned char a_dev_num, ad5933_cal_table* a_cal_p) {
+
+	ad5933_record records[AD5933_RECORD_BUFFER_SIZE];
+	ad5933_impedance z;
+	unsigned char i, n, num, busy;
+	unsigned int points = 0;
+	double t_step;
+
+	do {
+		t_step = sim_time();
+		busy = ad5933_sched_proc(a_dev_p, a_dev_num);
+		if((sim_time() - t_step) > g_sim_step_max) {
+			g_sim_step_max = sim_time() - t_step;
+		}
+
+		for(n = 0; n < a_dev_num; n++) {
+
+			num = ad5933_read_records(a_dev_p[n], records, AD5933_RECORD_BUFFER_SIZE);
+
+			for(i = 0; i < num; i++) {
+				g_sim_retried += (records[i].status & AD5933_REC_RETRIED) != 0;
+				g_sim_timeouts += (records[i].status & AD5933_REC_TIMEOUT) != 0;
+				g_sim_failed += (records[i].status & AD5933_REC_FAILED) != 0;
+
+				//Points measured on another range need their own calibration
+				if(records[i].status & AD5933_REC_FAILED) {
+					z.magnitude = 0;
+					z.phase = 0;
+				}
+				else if((records[i].setting != a_cal_p->setting) && !ad5933_cal_find(a_cal_p, records[i].setting)) {
+					z.magnitude = 0;
+					z.phase = 0;
+				}
+				else {
+					ad5933_cal_impedance(a_cal_p, &records[i], &z);
+				}
+				printf("%u %3u %02x %2u %9.1f Hz %7d %7d %10.2f ohm %7.2f deg %6.2f C%s\n", n, records[i].index, records[i].setting, records[i].samples,
+					ad5933_model_frequency(&g_sim_ad5933[n], records[i].frequency_code), records[i].real, records[i].imaginary,
+					z.magnitude / (double)(1 << AD5933_Z_FRAC_BITS), z.phase / 100.0,
+					records[i].temperature / 32.0, (records[i].status & AD5933_REC_TEMP_STALE) ? " stale" : "");
+				points++;
+			}
+		}
+
+		sim_advance(SIM_LOOP_TIME);
+
+	} while(busy);
+
+	return points;
+}
+
+/**
+ * @brief Print the bus and time cost per point since the counters were cleared
+ *
+ * Builds with AD5933_STATS and TWI_STATS add the driver counters of the
+ * last sweep of a_dev_p and the last bus transactions.
+ */
+static void sim_report(ad5933_dev* a_dev_p, unsigned int a_points, double a_t_start) {
+
+#ifdef AD5933_STATS
+	ad5933_sweep_stats stats;
+	twi_trace trace[4];
+	unsigned int i, n;
+#endif
+
+	printf("points %u\n", a_points);
+	printf("transactions/point %.1f\n", (double)g_sim_bus.transactions / a_points);
+	printf("bytes/point %.1f\n", (double)g_sim_bus.bytes / a_points);
+	printf("time/point %.3f ms\n", 1e3 * (sim_time() - a_t_start) / a_points);
+	printf("bus utilization %.2f %%\n", 100.0 * g_sim_bus.bus_time / (sim_time() - a_t_start));
+	printf("longest step %.3f ms\n", 1e3 * g_sim_step_max);
+
+	if(g_sim_faults.nack_period || g_sim_faults.stuck_period) {
+		printf("retried points %u, recovered points %u, failed points %u, bus recoveries %lu\n",
+			g_sim_retried, g_sim_timeouts, g_sim_failed, g_sim_faults.recoveries);
+	}
+
+#ifdef AD5933_STATS
+	ad5933_get_sweep_stats(a_dev_p, &stats);
+	printf("sweep %u points in %lu us, %lu points/s, bus load %u %%\n", stats.points, stats.duration_us,
+		ad5933_stats_points_per_s(&stats), ad5933_stats_bus_load(&stats));
+	printf("sweep conversions %u, polls %u, transactions %lu, bytes %lu, starts %lu, stops %lu, nacks %lu, wait %lu us\n",
+		stats.conversions, stats.polls, stats.bus.transactions, stats.bus.bytes, stats.bus.starts, stats.bus.stops, stats.bus.nacks, stats.bus.wait_us);
+
+	//Keep the last 4 entries of the trace
+	for(n = 0; twi_trace_read(&trace[n & 3], 1); n++);
+	for(i = (n > 4) ? (n - 4) : 0; i < n; i++) {
+		printf("trace %lu us +%u us sla %02x w%u r%u %s\n", trace[i & 3].time_us, trace[i & 3].duration_us, trace[i & 3].sla,
+			trace[i & 3].write_len, trace[i & 3].read_len, (trace[i & 3].status == E_TWI_XFER_DONE) ? "done" : "error");
+	}
+#else
+	(void)a_dev_p;
+#endif
+}
+
+/**
+ * @brief Clear the bus counters
+ */
+static void sim_clear(void) {
+
+	g_sim_bus.transactions = 0;
+	g_sim_bus.bytes = 0;
+	g_sim_bus.bus_time = 0;
+	g_sim_step_max = 0;
+	g_sim_retried = 0;
+	g_sim_timeouts = 0;
+	g_sim_failed = 0;
+	g_sim_faults.recoveries = 0;
+}
+
+/**
+ * @brief Stream the records of the started device to the serial port and decode them on the host side
+ *
+ * @return number of records decoded
+ */
+static unsigned int sim_stream(ad5933_dev* a_dev_p) {
+
+	static ad5933_host_decoder dec;
+	static ad5933_host_record records[AD5933_STREAM_RECORDS];
+	unsigned long pos;
+	unsigned int used, num, i;
+	unsigned int points = 0;
+	unsigned char busy;
+
+	ad5933_stream_init(SIM_STREAM_BAUD);
+
+	do {
+		busy = ad5933_sched_proc(&a_dev_p, 1);
+		busy |= ad5933_stream_proc(&a_dev_p, 1);
+		sim_advance(SIM_LOOP_TIME);
+	} while(busy);
+
+	ad5933_host_init(&dec);
+	for(pos = 0; pos < g_sim_uart.len; pos += used) {
+		num = ad5933_host_feed(&dec, &g_sim_uart.data[pos], g_sim_uart.len - pos, records, AD5933_STREAM_RECORDS, &used);
+		points += num;
+
+		for(i = 0; i < num; i++) {
+			g_sim_retried += (records[i].status & AD5933_REC_RETRIED) != 0;
+			g_sim_timeouts += (records[i].status & AD5933_REC_TIMEOUT) != 0;
+			g_sim_failed += (records[i].status & AD5933_REC_FAILED) != 0;
+		}
+	}
+
+	printf("stream frames %lu, crc errors %lu, format errors %lu\n", dec.frames, dec.crc_errors, dec.format_errors);
+	printf("stream bytes/point %.1f\n", (double)g_sim_uart.len / points);
+
+	return points;
+}
+
+/**
+ * @brief Periodic sweeps of the configured device for a_seconds
+ *
+ * With a_sleep set the MCU sleeps in ad5933_sched_sleep between the
+ * steps, otherwise it stays awake in the main loop. Prints the energy
+ * estimate of the run.
+ *
+ * @return number of records
+ */
+static unsigned long sim_periodic(ad5933_dev* a_dev_p, unsigned int a_period_ms, unsigned char a_sleep, double a_seconds) {
+
+	ad5933_record records[AD5933_RECORD_BUFFER_SIZE];
+	ad5933_energy energy;
+	unsigned long points = 0;
+	double t_end = sim_time() + a_seconds;
+
+	ad5933_set_period(a_dev_p, a_period_ms);
+	ad5933_energy_reset(&a_dev_p, 1);
+
+	while(sim_time() < t_end) {
+		ad5933_sched_proc(&a_dev_p, 1);
+		points += ad5933_read_records(a_dev_p, records, AD5933_RECORD_BUFFER_SIZE);
+
+		if(!a_sleep || !ad5933_sched_sleep(&a_dev_p, 1)) {
+			sim_advance(SIM_LOOP_TIME);
+		}
+	}
+
+	ad5933_energy_get(&a_dev_p, 1, &energy);
+
+	printf("period %u ms%s, points %lu\n", a_period_ms, a_sleep ? "" : " awake", points);
+	printf("mcu awake %.1f ms, idle %.1f ms, deep sleep %.1f ms\n", energy.mcu_us[0] / 1e3, energy.mcu_us[HAL_SLEEP_IDLE] / 1e3, energy.mcu_us[HAL_SLEEP_DEEP] / 1e3);
+	printf("ad5933 on %.1f ms, standby %.1f ms, power down %.1f ms\n", energy.dev_us[AD5933_POWER_ON] / 1e3, energy.dev_us[AD5933_POWER_STANDBY] / 1e3,
+		energy.dev_us[AD5933_POWER_DOWN] / 1e3);
+	printf("energy %lu uJ, %lu points/J\n", energy.energy_uj, energy.points_per_j);
+
+	//Let the last sweep finish, its records are dropped
+	ad5933_set_period(a_dev_p, 0);
+	while(ad5933_sched_proc(&a_dev_p, 1) || ad5933_read_records(a_dev_p, records, AD5933_RECORD_BUFFER_SIZE)) {
+		sim_advance(SIM_LOOP_TIME);
+	}
+
+	return points;
+}
+
+/**
+ * @brief Sweep or plan of the configured device kept in a packed and a delta coded store
+ *
+ * The points read back from both stores are checked against the records,
+ * a full store keeps the first points.
+ *
+ * @return number of mismatches
+ */
+static unsigned int sim_store(ad5933_dev* a_dev_p) {
+
+	static ad5933_record ref[AD5933_NUM_INC_MAX + 1];
+	static unsigned char packed_buf[SIM_FULL_SIZE];
+	static unsigned char delta_buf[SIM_FULL_SIZE];
+	ad5933_store stores[2];
+	ad5933_store_cursor cursor;
+	ad5933_record record;
+	unsigned int points = 0;
+	unsigned int errors = 0;
+	unsigned char i;
+
+	ad5933_store_init(&stores[0], packed_buf, sizeof(packed_buf), 0);
+	ad5933_store_init(&stores[1], delta_buf, sizeof(delta_buf), 1);
+
+	for(i = 0; i < 2; i++) {
+		ad5933_store_begin(&stores[i], a_dev_p);
+	}
+
+	a_dev_p->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	while(ad5933_sched_proc(&a_dev_p, 1) || ad5933_records_available(a_dev_p)) {
+		while((points <= AD5933_NUM_INC_MAX) && ad5933_read_records(a_dev_p, &ref[points], 1)) {
+			for(i = 0; i < 2; i++) {
+				ad5933_store_add(&stores[i], &ref[points]);
+			}
+			points++;
+		}
+		sim_advance(SIM_LOOP_TIME);
+	}
+
+	for(i = 0; i < 2; i++) {
+		memset(&cursor, 0, sizeof(cursor));
+		while(ad5933_store_read(&stores[i], &cursor, &record)) {
+			errors += (record.index != ref[cursor.num - 1].index) || (record.frequency_code != ref[cursor.num - 1].frequency_code) ||
+				(record.real != ref[cursor.num - 1].real) || (record.imaginary != ref[cursor.num - 1].imaginary) ||
+				(record.status != ref[cursor.num - 1].status) || (record.setting != ref[cursor.num - 1].setting) ||
+				(record.samples != ref[cursor.num - 1].samples) || (record.temperature != ref[cursor.num - 1].temperature);
+		}
+		errors += (cursor.num != stores[i].num);
+
+		printf("%s store %u points, %u data bytes, %u event bytes%s\n", i ? "delta" : "packed", stores[i].num, stores[i].data_len, stores[i].event_len,
+			(stores[i].num < points) ? ", full" : "");
+	}
+
+	return errors;
+}
+
+/**
+ * @brief Run a plan sweep of the started device against the model load
+ *
+ * @return number of points
+ */
+static unsigned int sim_settle(ad5933_dev* a_dev_p, ad5933_cal_table* a_cal_p, double a_t_start) {
+
+	const ad5933_model_load* load = &g_sim_ad5933[0].load;
+	ad5933_record record;
+	ad5933_impedance z;
+	unsigned int points = 0;
+	double w, z_im, z_mag, error, error_max = 0;
+
+	while(ad5933_sched_proc(&a_dev_p, 1) || ad5933_records_available(a_dev_p)) {
+		while(ad5933_read_records(a_dev_p, &record, 1)) {
+			points++;
+
+			//Points on a range without calibration are only counted
+			if((record.setting != a_cal_p->setting) && !ad5933_cal_find(a_cal_p, record.setting)) {
+				continue;
+			}
+			ad5933_cal_impedance(a_cal_p, &record, &z);
+
+			w = 2.0 * M_PI * ad5933_model_frequency(&g_sim_ad5933[0], record.frequency_code);
+			z_im = w * load->l_h - ((load->c_f > 0) ? 1.0 / (w * load->c_f) : 0);
+			z_mag = sqrt(load->r_ohm * load->r_ohm + z_im * z_im);
+
+			error = fabs(z.magnitude / (double)(1 << AD5933_Z_FRAC_BITS) / z_mag - 1.0);
+			if(error > error_max) {
+				error_max = error;
+			}
+		}
+		sim_advance(SIM_LOOP_TIME);
+	}
+
+	printf("sweep %.1f ms, worst magnitude error %.2f %%\n", 1e3 * (sim_time() - a_t_start), 100.0 * error_max);
+
+	return points;
+}
+
+/**
+ * @brief Sample one frequency with single point sweeps, then with the tracking mode
+ *
+ * @return number of tracking samples out of order or lost
+ */
+static unsigned int sim_track(ad5933_dev* a_dev_p) {
+
+	static ad5933_sample ring[SIM_TRACK_RING];
+	ad5933_sample samples[SIM_TRACK_RING];
+	ad5933_record record;
+	unsigned long sweeps = 0;
+	unsigned long count = 0;
+	unsigned long last_time = 0;
+	unsigned int i, num;
+	unsigned int errors = 0;
+	double t_start;
+
+	//One sweep of a single point per sample
+	ad5933_set_frequency(a_dev_p, SIM_TRACK_HZ, 0, 0);
+	ad5933_config_measure(a_dev_p);
+
+	t_start = sim_time();
+	while((sim_time() - t_start) < SIM_TRACK_TIME) {
+		a_dev_p->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+		while(ad5933_sched_proc(&a_dev_p, 1)) {
+			sim_advance(SIM_LOOP_TIME);
+		}
+		sweeps += ad5933_read_records(a_dev_p, &record, 1);
+	}
+	printf("single point sweeps %.1f samples/s\n", sweeps / (sim_time() - t_start));
+
+	//Repeat frequency loop
+	ad5933_set_settling(a_dev_p, SIM_TRACK_SETTLE);
+	if(!ad5933_track_start(a_dev_p, SIM_TRACK_HZ, ring, SIM_TRACK_RING)) {
+		return 1;
+	}
+
+	t_start = sim_time();
+	do {
+		if((sim_time() - t_start) >= SIM_TRACK_TIME) {
+			ad5933_track_stop(a_dev_p);
+		}
+		ad5933_sched_proc(&a_dev_p, 1);
+
+		num = ad5933_track_read(a_dev_p, samples, SIM_TRACK_RING);
+		for(i = 0; i < num; i++) {
+			errors += count && ((long)(samples[i].time_us - last_time) <= 0);
+			errors += (samples[i].status & AD5933_REC_FAILED) != 0;
+			last_time = samples[i].time_us;
+			count++;
+		}
+
+		sim_advance(SIM_LOOP_TIME);
+
+	} while(a_dev_p->data.measure_trigger != E_FLAGS_AD5933_IDLE);
+
+	errors += (count != a_dev_p->track_count);
+	printf("tracking %lu samples, %lu samples/s, %.0f times the single point sweeps\n", count, ad5933_track_rate(a_dev_p),
+		ad5933_track_rate(a_dev_p) * (sim_time() - t_start) / (sweeps ? sweeps : 1));
+
+	return errors;
+}
+
+/**
+ * @brief Print the resonance found in a frequency ordered result
+ *
+ * @return frequency of the phase zero crossing in Hz, 0 if none
+ */
+static double sim_resonance(const char* a_name, const ad5933_record* a_records_p, unsigned int a_num, ad5933_cal_table* a_cal_p, double a_t_start) {
+
+	ad5933_impedance z;
+	unsigned long mag_min = 0xffffffffUL;
+	double f, f_min = 0, f_last = 0, f_cross = 0;
+	short phase_last = 0;
+	unsigned int i;
+
+	for(i = 0; i < a_num; i++) {
+		ad5933_cal_impedance(a_cal_p, &a_records_p[i], &z);
+		f = ad5933_model_frequency(&g_sim_ad5933[0], a_records_p[i].frequency_code);
+
+		if(z.magnitude < mag_min) {
+			mag_min = z.magnitude;
+			f_min = f;
+		}
+		if(i && (f_cross == 0) && ((phase_last < 0) != (z.phase < 0))) {
+			f_cross = f_last + (f - f_last) * phase_last / (double)(phase_last - z.phase);
+		}
+
+		f_last = f;
+		phase_last = z.phase;
+	}
+
+	printf("%s %u points, %lu transactions, %.1f ms, min |Z| at %.0f Hz, phase zero at %.1f Hz\n", a_name, a_num,
+		g_sim_bus.transactions, 1e3 * (sim_time() - a_t_start), f_min, f_cross);
+
+	return f_cross;
+}
+
+/**
+ * @brief Find a series resonance with a dense linear sweep, then with a adaptive sweep
+ *
+ * @return 1 when the adaptive result is out of order or misses the resonance
+ */
+static unsigned int sim_adapt(ad5933_dev* a_dev_p, ad5933_cal_table* a_cal_p) {
+
+	static ad5933_record dense[AD5933_NUM_INC_MAX + 1];
+	static ad5933_record result[SIM_ADAPT_BUDGET];
+	ad5933_model_load load = g_sim_ad5933[0].load;
+	ad5933_adapt adapt;
+	unsigned int i, num = 0;
+	unsigned int errors = 0;
+	double t_start, f_dense, f_adapt;
+
+	g_sim_ad5933[0].load.r_ohm = SIM_ADAPT_R_OHM;
+	g_sim_ad5933[0].load.l_h = SIM_ADAPT_L_H;
+	g_sim_ad5933[0].load.c_f = SIM_ADAPT_C_F;
+
+	//Calibrated range, found features stay on one setting
+	ad5933_config_sweep(a_dev_p, &g_sim_sweep);
+	ad5933_set_autorange(a_dev_p, 0);
+	if(!ad5933_cal_find(a_cal_p, AD5933_SETTING(a_dev_p->cfg, a_dev_p->rfb))) {
+		return 1;
+	}
+
+	//Dense sweep at the resolution wanted
+	ad5933_set_frequency(a_dev_p, SIM_ADAPT_START_HZ, SIM_ADAPT_STEP_HZ, (SIM_ADAPT_STOP_HZ - SIM_ADAPT_START_HZ) / SIM_ADAPT_STEP_HZ);
+	ad5933_config_measure(a_dev_p);
+
+	sim_clear();
+	t_start = sim_time();
+	a_dev_p->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+	while(ad5933_sched_proc(&a_dev_p, 1) || ad5933_records_available(a_dev_p)) {
+		while((num <= AD5933_NUM_INC_MAX) && ad5933_read_records(a_dev_p, &dense[num], 1)) {
+			num++;
+		}
+		sim_advance(SIM_LOOP_TIME);
+	}
+	f_dense = sim_resonance("dense", dense, num, a_cal_p, t_start);
+
+	//Coarse sweep refined where the curve bends or the phase crosses zero
+	sim_clear();
+	t_start = sim_time();
+	ad5933_adapt_begin(&adapt, a_dev_p, result, SIM_ADAPT_BUDGET, SIM_ADAPT_START_HZ, SIM_ADAPT_STOP_HZ, SIM_ADAPT_COARSE, SIM_ADAPT_STEP_HZ, a_cal_p);
+	do {
+		ad5933_sched_proc(&a_dev_p, 1);
+		sim_advance(SIM_LOOP_TIME);
+	} while(!ad5933_adapt_proc(&adapt, a_dev_p) || (a_dev_p->data.measure_trigger != E_FLAGS_AD5933_IDLE));
+	printf("adaptive sweeps %u\n", adapt.sweeps);
+	f_adapt = sim_resonance("adaptive", result, adapt.num, a_cal_p, t_start);
+
+	for(i = 1; i < adapt.num; i++) {
+		errors += (result[i].frequency_code <= result[i - 1].frequency_code);
+	}
+	errors += (f_adapt == 0) || (fabs(f_adapt - f_dense) > SIM_ADAPT_STEP_HZ);
+
+	//The coarse sweep reaches the stop frequency within the code rounding
+	errors += (adapt.num == 0) || (labs((long)result[adapt.num - 1].frequency_code - (long)ad5933_freq_code(SIM_ADAPT_STOP_HZ)) > (SIM_ADAPT_COARSE / 2));
+
+	g_sim_ad5933[0].load = load;
+
+	return errors;
+}
+
+/**
+ * @brief Phase of a point measured across the +-180 degree wrap from the system phase,
+ * then a system phase interpolated between calibration points across the wrap
+ *
+ * @return number of phases off by more than 0.5 degree
+ */
+static unsigned int sim_phase_wrap(void) {
+
+	static const short system_phase[2] = { -17003, 17003 };
+	static const short data[2][2] = { { -1000, 60 }, { -1000, -60 } };
+	ad5933_gain gain;
+	ad5933_record record;
+	ad5933_impedance z;
+	ad5933_cal_table table;
+	unsigned int errors = 0;
+	unsigned char i;
+	double expected;
+
+	gain.numerator = 1000000UL;
+	gain.shift = 0;
+
+	for(i = 0; i < 2; i++) {
+		gain.phase = system_phase[i];
+		record.real = data[i][0];
+		record.imaginary = data[i][1];
+		ad5933_calc_impedance(&gain, &record, &z);
+
+		expected = 100.0 * atan2(data[i][1], data[i][0]) * 180.0 / M_PI - system_phase[i];
+		expected -= (expected > AD5933_PHASE_180) ? 2 * AD5933_PHASE_180 : 0;
+		expected += (expected < -AD5933_PHASE_180) ? 2 * AD5933_PHASE_180 : 0;
+
+		printf("phase across the wrap %.2f deg, expected %.2f deg\n", z.phase / 100.0, expected / 100.0);
+		errors += (fabs(z.phase - expected) > 50);
+	}
+
+	//A quarter of the short way from 170.03 to -170.03 degree
+	table.num = 2;
+	table.entry[0].frequency_code = 1000;
+	table.entry[1].frequency_code = 2000;
+	for(i = 0; i < 2; i++) {
+		table.entry[i].gain = gain;
+		table.entry[i].gain.phase = system_phase[1 - i];
+	}
+	ad5933_cal_gain(&table, 1250, &gain);
+
+	expected = system_phase[1] + (2 * AD5933_PHASE_180 - 2 * system_phase[1]) / 4.0;
+	printf("system phase across the wrap %.2f deg, expected %.2f deg\n", gain.phase / 100.0, expected / 100.0);
+	errors += (fabs(gain.phase - expected) > 50);
+
+	return errors;
+}
+
+int main(int argc, char** argv) {
+
+	static ad5933_dev devs[SIM_AD5933_NUM];
+	static unsigned long plan[SIM_PLAN_POINTS];
+	ad5933_dev* dev_p[SIM_AD5933_NUM];
+	ad5933_model_load load;
+	ad5933_cal_table cal;
+	ad5933_settle_profile profile;
+	unsigned char n, dev_num;
+	unsigned int points;
+	double t_start;
+
+	dev_num = (argc > 4) ? atoi(argv[4]) : 1;
+	if((dev_num < 1) || (dev_num > SIM_AD5933_NUM)) {
+		dev_num = 1;
+	}
+
+	for(n = 0; n < dev_num; n++) {
+		//Same load on every channel, scaled to tell them apart
+		g_sim_ad5933[n].load.r_ohm = ((argc > 1) ? atof(argv[1]) : 200.0) * (n + 1);
+		g_sim_ad5933[n].load.c_f = (argc > 2) ? atof(argv[2]) : 0.0;
+		g_sim_ad5933[n].load.l_h = (argc > 3) ? atof(argv[3]) : 0.0;
+		g_sim_ad5933[n].load.tau_s = 200e-6;
+		g_sim_ad5933[n].load.noise = 2.0;
+		g_sim_ad5933[n].load.noise_corner_hz = 100e3;
+		g_sim_ad5933[n].load.temperature_c = 25.0 + n;
+		g_sim_ad5933[n].load.phase_delay_s = 1e-6;
+		ad5933_model_reset(&g_sim_ad5933[n]);
+
+		dev_p[n] = &devs[n];
+		ad5933_init(dev_p[n], (dev_num > 1) ? n : AD5933_MUX_NONE);
+	}
+
+	g_sim_bus.transactions = 0;
+	ad5933_config_sweep(dev_p[0], &g_sim_sweep);
+	printf("configuration transactions %lu\n", g_sim_bus.transactions);
+
+	//Same settings from the run time path, only the dirty registers are written
+	g_sim_bus.transactions = 0;
+	ad5933_config_measure(dev_p[0]);
+	printf("reconfiguration transactions %lu\n", g_sim_bus.transactions);
+
+	for(n = 1; n < dev_num; n++) {
+		ad5933_config_measure(dev_p[n]);
+	}
+
+	//Calibrate on a resistor and keep the table in EEPROM
+	load = g_sim_ad5933[0].load;
+	g_sim_ad5933[0].load.r_ohm = SIM_CAL_OHM;
+	g_sim_ad5933[0].load.c_f = 0;
+	g_sim_ad5933[0].load.l_h = 0;
+	printf("calibration points %u\n", ad5933_cal_run(dev_p[0], &cal, SIM_CAL_OHM));
+	ad5933_cal_store(&cal, 0);
+	g_sim_ad5933[0].load = load;
+
+	if(!ad5933_cal_find(&cal, AD5933_SETTING(dev_p[0]->cfg, dev_p[0]->rfb))) {
+		return 1;
+	}
+
+	if(sim_phase_wrap()) {
+		printf("phase wrap error\n");
+		return 1;
+	}
+
+	//Bus faults during the measurements only
+	g_sim_faults.nack_period = (argc > 7) ? atol(argv[7]) : 0;
+	g_sim_faults.stuck_period = (argc > 8) ? atol(argv[8]) : 0;
+
+	t_start = sim_time();
+	sim_clear();
+
+	for(n = 0; n < dev_num; n++) {
+		ad5933_set_autorange(dev_p[n], (argc > 5) ? atoi(argv[5]) : 0);
+		ad5933_set_averaging(dev_p[n], (argc > 6) ? atoi(argv[6]) : 0, SIM_AVG_NOISE);
+		ad5933_set_temperature_refresh(dev_p[n], SIM_TEMP_AGE_MS);
+		dev_p[n]->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+	}
+
+	points = sim_run(dev_p, dev_num, &cal);
+	if(points == 0) {
+		return 1;
+	}
+	sim_report(dev_p[0], points, t_start);
+
+	//Log spaced plan on the first device, linear hardware segments
+	ad5933_plan_log(plan, SIM_PLAN_POINTS, SIM_PLAN_START_HZ, SIM_PLAN_STOP_HZ);
+	ad5933_set_plan(dev_p[0], plan, SIM_PLAN_POINTS, SIM_PLAN_TOL);
+	ad5933_config_measure(dev_p[0]);
+	printf("plan segments %u\n", ad5933_plan_segments(plan, SIM_PLAN_POINTS, SIM_PLAN_TOL));
+
+	t_start = sim_time();
+	sim_clear();
+	dev_p[0]->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	points = sim_run(dev_p, 1, &cal);
+	if(points != SIM_PLAN_POINTS) {
+		return 1;
+	}
+	sim_report(dev_p[0], points, t_start);
+
+	//Same plan streamed to the host
+	t_start = sim_time();
+	sim_clear();
+	ad5933_config_measure(dev_p[0]);
+	dev_p[0]->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+
+	points = sim_stream(dev_p[0]);
+	if(points != SIM_PLAN_POINTS) {
+		return 1;
+	}
+	sim_report(dev_p[0], points, t_start);
+
+	//Same plan with the fixed settling, then with a tuned profile kept in EEPROM
+	ad5933_config_measure(dev_p[0]);
+	dev_p[0]->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+	if(sim_settle(dev_p[0], &cal, sim_time()) != SIM_PLAN_POINTS) {
+		return 1;
+	}
+
+	t_start = sim_time();
+	printf("settling bands %u", ad5933_settle_tune(dev_p[0], &profile, SIM_PLAN_START_HZ, SIM_PLAN_STOP_HZ, SIM_SETTLE_BANDS));
+	printf(" in %.1f ms\n", 1e3 * (sim_time() - t_start));
+	ad5933_settle_store(&profile);
+	memset(&profile, 0, sizeof(profile));
+	if(!ad5933_settle_load(&profile)) {
+		return 1;
+	}
+	for(n = 0; n < profile.num; n++) {
+		printf("band %u to %.0f Hz, %u cycles\n", n, ad5933_model_frequency(&g_sim_ad5933[0], profile.band_top[n]),
+			AD5933_SETTLE_CYCLES(profile.code[n]));
+	}
+
+	ad5933_set_settle_profile(dev_p[0], &profile);
+	ad5933_config_measure(dev_p[0]);
+	dev_p[0]->data.measure_trigger = E_FLAGS_AD5933_START_MEASURE;
+	if(sim_settle(dev_p[0], &cal, sim_time()) != SIM_PLAN_POINTS) {
+		return 1;
+	}
+	ad5933_set_settle_profile(dev_p[0], NULL);
+
+	//Full 511 increment sweep kept in SRAM
+	ad5933_set_plan(dev_p[0], NULL, 0, 0);
+	ad5933_set_frequency(dev_p[0], SIM_FULL_START_HZ, SIM_FULL_DELTA_HZ, AD5933_NUM_INC_MAX);
+	ad5933_config_measure(dev_p[0]);
+	if(sim_store(dev_p[0])) {
+		printf("store mismatch\n");
+		return 1;
+	}
+
+	//Log plan kept in SRAM, the points keep the programmed segment codes
+	ad5933_set_plan(dev_p[0], plan, SIM_PLAN_POINTS, SIM_PLAN_TOL);
+	ad5933_config_measure(dev_p[0]);
+	if(sim_store(dev_p[0])) {
+		printf("plan store mismatch\n");
+		return 1;
+	}
+	ad5933_set_plan(dev_p[0], NULL, 0, 0);
+
+	//Periodic linear sweeps, sleeping between the steps, then the same schedule awake
+	ad5933_config_sweep(dev_p[0], &g_sim_sweep);
+
+	for(n = 0; n < sizeof(g_sim_periods_ms) / sizeof(g_sim_periods_ms[0]); n++) {
+		sim_periodic(dev_p[0], g_sim_periods_ms[n], 1, SIM_PERIOD_RUN_TIME);
+	}
+	sim_periodic(dev_p[0], g_sim_periods_ms[n - 1], 0, SIM_PERIOD_RUN_TIME);
+
+	//Continuous sampling of one frequency
+	if(sim_track(dev_p[0])) {
+		printf("tracking error\n");
+		return 1;
+	}
+
+	//Adaptive sweep around a resonance
+	if(sim_adapt(dev_p[0], &cal)) {
+		printf("adaptive sweep error\n");
+		return 1;
+	}
+
+	return 0;
+}
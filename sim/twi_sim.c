@@ -0,0 +1,380 @@
+/* Copyright (C) 
+ * 2014 - Gabriel Durante
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "twi.h"
+#include "dev_ad5933.h"
+#include "sim.h"
+
+#ifdef TWI_STATS
+#include <string.h>
+#endif
+
+/**
+ * @brief SCL bit time in seconds
+ */
+static double g_twi_bit_time = 1.0 / 250000.0;
+
+
+void twi_init(uint8_t a_freq) {
+
+	static const double scl[3] = { 100000.0, 250000.0, 400000.0 };
+
+	if(a_freq < 3) {
+		g_twi_bit_time = 1.0 / scl[a_freq];
+	}
+}
+
+/**
+ * @brief AD5933 answering an address through the mux
+ */
+static ad5933_model* sim_twi_target(unsigned char a_sla) {
+
+	unsigned char i;
+
+	if((a_sla & 0xfe) != SLA_W) {
+		return 0;
+	}
+
+	//Mux disconnected, the AD5933 wired to the bus answers
+	if(g_sim_mux == 0) {
+		return &g_sim_ad5933[0];
+	}
+
+	//Exactly one channel must be connected
+	for(i = 0; i < SIM_AD5933_NUM; i++) {
+		if(g_sim_mux == (1 << i)) {
+			return &g_sim_ad5933[i];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Queued transactions, start and end time of the one on the bus
+ */
+static twi_xfer* g_twi_head;
+static twi_xfer* g_twi_tail;
+static double g_twi_start;
+static double g_twi_end;
+
+/**
+ * @brief Transactions started and fault injected in the one on the bus
+ */
+static unsigned long g_twi_count;
+static unsigned char g_twi_fault;
+
+#define SIM_TWI_FAULT_NONE 0
+#define SIM_TWI_FAULT_NACK 1
+#define SIM_TWI_FAULT_STUCK 2
+
+#ifdef TWI_STATS
+/**
+ * @brief Bus counters, trace ring and START time of the transaction on the bus
+ */
+static twi_stats g_twi_stats;
+static twi_trace g_twi_trace[TWI_TRACE_SIZE];
+static unsigned char g_twi_trace_head;
+static unsigned char g_twi_trace_tail;
+
+void twi_stats_get(twi_stats* a_stats_p) {
+
+	*a_stats_p = g_twi_stats;
+}
+
+void twi_stats_reset(void) {
+
+	memset(&g_twi_stats, 0, sizeof(g_twi_stats));
+	g_twi_trace_tail = g_twi_trace_head;
+}
+
+unsigned char twi_trace_read(twi_trace* a_trace_p, unsigned char a_max_num) {
+
+	unsigned char i;
+
+	for(i = 0; (i < a_max_num) && (g_twi_trace_tail != g_twi_trace_head); i++) {
+		a_trace_p[i] = g_twi_trace[g_twi_trace_tail++ & (TWI_TRACE_SIZE - 1)];
+	}
+
+	return i;
+}
+
+/**
+ * @brief Count a finished transaction and append it to the trace
+ */
+static void sim_twi_stats(twi_xfer* a_xfer, unsigned long a_bytes, unsigned long a_nacks) {
+
+	twi_trace* trace = &g_twi_trace[g_twi_trace_head++ & (TWI_TRACE_SIZE - 1)];
+	unsigned long duration = (unsigned long)((g_twi_end - g_twi_start) * 1e6);
+
+	if((unsigned char)(g_twi_trace_head - g_twi_trace_tail) > TWI_TRACE_SIZE) {
+		g_twi_trace_tail++;
+	}
+
+	trace->time_us = (unsigned long)(g_twi_start * 1e6);
+	trace->duration_us = duration;
+	trace->sla = a_xfer->sla;
+	trace->write_len = a_xfer->write_len;
+	trace->read_len = a_xfer->read_len;
+	trace->status = a_xfer->status;
+
+	g_twi_stats.transactions++;
+	g_twi_stats.bytes += a_bytes;
+	g_twi_stats.starts += (a_xfer->write_len && a_xfer->read_len && (a_nacks == 0)) ? 2 : 1;
+	g_twi_stats.stops++;
+	g_twi_stats.nacks += a_nacks;
+	g_twi_stats.bus_us += duration;
+}
+#endif
+
+/**
+ * @brief Bus time of a transaction, START, address byte of each phase, data bytes and STOP
+ */
+static double sim_twi_duration(twi_xfer* a_xfer) {
+
+	unsigned long bits = 2;
+
+	if(a_xfer->sla == AD5933_MUX_SLA_W) {
+		bits += 9 * (1 + a_xfer->write_len);
+	}
+	else if(sim_twi_target(a_xfer->sla) == 0) {
+		bits += 9;
+	}
+	else {
+		if(a_xfer->write_len) {
+			bits += 9 * (1 + a_xfer->write_len);
+		}
+		if(a_xfer->read_len) {
+			bits += 1 + 9 * (1 + a_xfer->read_len);
+		}
+	}
+
+	return bits * g_twi_bit_time;
+}
+
+/**
+ * @brief Run a transaction against the models once its bus time is over
+ */
+static void sim_twi_execute(twi_xfer* a_xfer) {
+
+	ad5933_model* model;
+#ifdef TWI_STATS
+	unsigned long bytes = g_sim_bus.bytes;
+	unsigned long nacks = g_sim_bus.nacks;
+#endif
+
+	g_sim_bus.bytes += a_xfer->write_len + a_xfer->read_len;
+
+	model = sim_twi_target(a_xfer->sla);
+
+	if(g_twi_fault == SIM_TWI_FAULT_NACK) {
+		//Injected NACK of the address byte
+		g_sim_bus.bytes += 1;
+		g_sim_bus.nacks++;
+		a_xfer->twsr = 0x20;
+		a_xfer->status = E_TWI_XFER_ERROR;
+	}
+	else if(a_xfer->sla == AD5933_MUX_SLA_W) {
+		//Mux control register
+		g_sim_bus.bytes += 1;
+		if(a_xfer->write_len) {
+			g_sim_mux = a_xfer->write_buf[0];
+		}
+		a_xfer->status = E_TWI_XFER_DONE;
+	}
+	else if(model == 0) {
+		//Nobody answers this address
+		g_sim_bus.bytes += 1;
+		g_sim_bus.nacks++;
+		a_xfer->twsr = 0x20;
+		a_xfer->status = E_TWI_XFER_ERROR;
+	}
+	else {
+		if(a_xfer->write_len) {
+			g_sim_bus.bytes += 1;
+			ad5933_model_write(model, a_xfer->write_buf, a_xfer->write_len);
+		}
+		if(a_xfer->read_len) {
+			g_sim_bus.bytes += 1;
+			ad5933_model_read(model, a_xfer->read_buf, a_xfer->read_len);
+		}
+		a_xfer->status = E_TWI_XFER_DONE;
+	}
+
+	g_sim_bus.transactions++;
+
+#ifdef TWI_STATS
+	sim_twi_stats(a_xfer, g_sim_bus.bytes - bytes, g_sim_bus.nacks - nacks);
+#endif
+
+	if(a_xfer->callback) {
+		a_xfer->callback(a_xfer);
+	}
+}
+
+/**
+ * @brief Start the transaction at the head of the queue
+ */
+static void sim_twi_start(double a_start) {
+
+	double duration = sim_twi_duration(g_twi_head);
+
+	g_twi_count++;
+	g_twi_fault = SIM_TWI_FAULT_NONE;
+
+	if(g_sim_faults.stuck_period && ((g_twi_count % g_sim_faults.stuck_period) == 0)) {
+		//A slave holds SDA, only the timeout ends the transaction
+		g_twi_fault = SIM_TWI_FAULT_STUCK;
+		duration = 1e9;
+	}
+	else if(g_sim_faults.nack_period && ((g_twi_count % g_sim_faults.nack_period) == 0)) {
+		g_twi_fault = SIM_TWI_FAULT_NACK;
+		duration = 11 * g_twi_bit_time;
+	}
+	else {
+		g_sim_bus.bus_time += duration;
+	}
+
+	g_twi_start = a_start;
+	g_twi_end = a_start + duration;
+}
+
+/**
+ * @brief Complete the chained transactions at the head of the queue as failed
+ */
+static void sim_twi_fail_chain(unsigned char a_twsr) {
+
+	twi_xfer* xfer;
+
+	while(g_twi_head && g_twi_head->chain) {
+
+		xfer = g_twi_head;
+		g_twi_head = xfer->next;
+
+		xfer->twsr = a_twsr;
+		xfer->status = E_TWI_XFER_ERROR;
+
+		if(xfer->callback) {
+			xfer->callback(xfer);
+		}
+	}
+}
+
+void sim_twi_poll(void) {
+
+	twi_xfer* xfer;
+
+	//Complete every transaction whose bus time is over, the next one starts right after
+	while(g_twi_head && (sim_time() >= g_twi_end)) {
+
+		xfer = g_twi_head;
+		g_twi_head = xfer->next;
+
+		sim_twi_execute(xfer);
+
+		if(xfer->status == E_TWI_XFER_ERROR) {
+			sim_twi_fail_chain(xfer->twsr);
+		}
+
+		if(g_twi_head) {
+			sim_twi_start(g_twi_end);
+		}
+	}
+}
+
+void twi_submit(twi_xfer* a_xfer) {
+
+	a_xfer->status = E_TWI_XFER_PENDING;
+	a_xfer->next = 0;
+
+	if(g_twi_head) {
+		//Bus busy, append to the queue
+		g_twi_tail->next = a_xfer;
+		g_twi_tail = a_xfer;
+	}
+	else {
+		g_twi_head = a_xfer;
+		g_twi_tail = a_xfer;
+		sim_twi_start(sim_time());
+	}
+}
+
+unsigned char twi_transfer(twi_xfer* a_xfer) {
+
+#ifdef TWI_STATS
+	double start = sim_time();
+#endif
+
+	twi_submit(a_xfer);
+
+	//Time runs until the engine completes the transaction
+	while(a_xfer->status == E_TWI_XFER_PENDING) {
+		sim_advance(g_twi_bit_time);
+		twi_check_timeout();
+	}
+
+#ifdef TWI_STATS
+	g_twi_stats.wait_us += (unsigned long)((sim_time() - start) * 1e6);
+#endif
+
+	return a_xfer->status;
+}
+
+unsigned char twi_busy(void) {
+
+	return (g_twi_head != 0);
+}
+
+unsigned char twi_bus_recover(void) {
+
+	g_sim_faults.recoveries++;
+
+	return 1;
+}
+
+unsigned char twi_check_timeout(void) {
+
+	twi_xfer* xfer = g_twi_head;
+
+	if((xfer == 0) || ((sim_time() - g_twi_start) <= (TWI_TIMEOUT_US * 1e-6))) {
+		return 0;
+	}
+
+	//Drop the transaction and free the bus
+	twi_bus_recover();
+	g_sim_bus.bus_time += sim_time() - g_twi_start;
+	g_sim_bus.transactions++;
+#ifdef TWI_STATS
+	g_twi_stats.timeouts++;
+#endif
+
+	g_twi_head = xfer->next;
+	xfer->twsr = TWI_TWSR_TIMEOUT;
+	xfer->status = E_TWI_XFER_ERROR;
+	sim_twi_fail_chain(TWI_TWSR_TIMEOUT);
+
+	if(g_twi_head) {
+		sim_twi_start(sim_time());
+	}
+
+	if(xfer->callback) {
+		xfer->callback(xfer);
+	}
+
+	return 1;
+}
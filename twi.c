@@ -19,7 +19,60 @@
 #include <avr/power.h>
 #include <util/twi.h> //TWI peripheral status definitions
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
 #include "twi.h"
+#include "hal.h"
+
+#ifdef TWI_STATS
+#include <string.h>
+#endif
+
+/* Control values used by the transaction engine */
+#define TWI_CR_GO (_BV(TWINT) | _BV(TWEN) | _BV(TWIE))
+#define TWI_CR_START (TWI_CR_GO | _BV(TWSTA))
+#define TWI_CR_STOP (_BV(TWINT) | _BV(TWEN) | _BV(TWSTO))
+
+/* TWI pins of the ATmega328, driven as open drain by the bus recovery */
+#define TWI_PORT PORTC
+#define TWI_DDR DDRC
+#define TWI_PIN PINC
+#define TWI_SDA PC4
+#define TWI_SCL PC5
+
+/* Half period of the recovery clock, 100 kHz */
+#define TWI_RECOVER_HALF_US 5
+
+/**
+ * @brief Transaction queue, the head is the transaction on the bus
+ */
+static twi_xfer* volatile g_twi_head;
+static twi_xfer* g_twi_tail;
+
+/**
+ * @brief Time the head transaction got the bus
+ */
+static unsigned long g_twi_head_us;
+
+/**
+ * @brief Byte index inside the current transaction phase
+ */
+static unsigned char g_twi_index;
+
+#ifdef TWI_STATS
+/**
+ * @brief Bus counters, trace ring and START time of the transaction on the bus
+ */
+static twi_stats g_twi_stats;
+static twi_trace g_twi_trace[TWI_TRACE_SIZE];
+static unsigned char g_twi_trace_head;
+static unsigned char g_twi_trace_tail;
+static unsigned long g_twi_start_us;
+
+#define TWI_STAT_ADD(a_field, a_num) (g_twi_stats.a_field += (a_num))
+#else
+#define TWI_STAT_ADD(a_field, a_num)
+#endif
 
 
 void twi_init(uint8_t a_freq) {
@@ -32,20 +85,34 @@ void twi_init(uint8_t a_freq) {
 	_twi_common_frequency_setup(a_freq);
 }
 
-void twi_wait_interrupt(void) {
+unsigned char twi_wait_interrupt(void) {
+
+	unsigned long start = hal_time_us();
+
+	while(!(TWCR & _BV(TWINT))) {
+		if((hal_time_us() - start) > TWI_TIMEOUT_US) {
+			TWI_STAT_ADD(wait_us, hal_time_us() - start);
+			return 0;
+		}
+	}
+
+	TWI_STAT_ADD(wait_us, hal_time_us() - start);
 
-	while(!(TWCR & _BV(TWINT)));
+	return 1;
 }
 
 unsigned char twi_send_start(void) {
 	//Send START
 	TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+	TWI_STAT_ADD(starts, 1);
 	
 	//Wait for TWI interrupt flag to be set
-	twi_wait_interrupt();		
+	if(!twi_wait_interrupt()) {
+		return TWI_TWSR_TIMEOUT;
+	}
 
 	//Check value of TWI Status Register is different of START or REPEAT START
-	if( ((TWSR & 0xF8) != TW_START ) || ((TWSR & 0xF8) != TW_REP_START  ) ) {
+	if( ((TWSR & 0xF8) != TW_START ) && ((TWSR & 0xF8) != TW_REP_START  ) ) {
 		//If it failed, return the TWSR value
 		return TWSR;	 	
 	}
@@ -57,21 +124,28 @@ unsigned char twi_send_start(void) {
 void twi_send_stop(void) {
 	//Send a STOP condition
 	TWCR = _BV(TWINT) | _BV(TWEN) | _BV(TWSTO);
+
+	//The STOP ends the transaction, counted as in twi_stats_complete
+	TWI_STAT_ADD(transactions, 1);
+	TWI_STAT_ADD(stops, 1);
 }
 
-char twi_send_address(unsigned char adr) {
+unsigned char twi_send_address(unsigned char adr) {
 	
 	//Load address value to TWDR register
 	TWDR = adr;
+	TWI_STAT_ADD(bytes, 1);
 	
 	//Clear int flag to send byte 
 	TWCR = _BV(TWINT) | _BV(TWEN);
 
 	//Wait for TWI interrupt flag set
-	twi_wait_interrupt();		
+	if(!twi_wait_interrupt()) {
+		return TWI_TWSR_TIMEOUT;
+	}
 
 	//Check value of TWI Status Register is different of MASTER TRANSMIT SLAVE ACK or MASTER RECEIVE SLAVE ACK
-	if( ((TWSR & 0xF8) != TW_MT_SLA_ACK) || ((TWSR & 0xF8) != TW_MR_SLA_ACK )) {
+	if( ((TWSR & 0xF8) != TW_MT_SLA_ACK) && ((TWSR & 0xF8) != TW_MR_SLA_ACK )) {
 		//If NACK received return TWSR
 		return TWSR;	
 	}		
@@ -84,12 +158,15 @@ unsigned char twi_send_byte(unsigned char data) {
 
 	//Load data value to TWDR register
 	TWDR = data;
+	TWI_STAT_ADD(bytes, 1);
 	
 	//Clear int flag to send byte
  	TWCR = _BV(TWINT) | _BV(TWEN);  	
 
 	//Wait for TWI interrupt flag set
-	twi_wait_interrupt();
+	if(!twi_wait_interrupt()) {
+		return TWI_TWSR_TIMEOUT;
+	}
 
 	//Check value of TWI Status Register is different of MASTER TRANSMIT DATA ACK
 	if( (TWSR & 0xF8) != TW_MT_DATA_ACK ) {
@@ -100,3 +177,338 @@ unsigned char twi_send_byte(unsigned char data) {
 	return TWI_SUCCESS;		//Else return SUCCESS
 }
 
+
+void twi_submit(twi_xfer* a_xfer) {
+
+	unsigned char sreg = SREG;
+
+	a_xfer->status = E_TWI_XFER_PENDING;
+	a_xfer->next = 0;
+
+	cli();
+
+	if(g_twi_head) {
+		//Bus busy, append to the queue
+		g_twi_tail->next = a_xfer;
+		g_twi_tail = a_xfer;
+	}
+	else {
+		//Bus idle, send START and let TWI_vect run the transaction
+		g_twi_head = a_xfer;
+		g_twi_tail = a_xfer;
+		g_twi_head_us = hal_time_us();
+		TWCR = TWI_CR_START;
+	}
+
+	SREG = sreg;
+}
+
+unsigned char twi_transfer(twi_xfer* a_xfer) {
+
+#ifdef TWI_STATS
+	unsigned long start = hal_time_us();
+#endif
+
+	twi_submit(a_xfer);
+
+	set_sleep_mode(SLEEP_MODE_IDLE);
+
+	//Sleep until TWI_vect completes the transaction, the time base wakes up the timeout check
+	cli();
+	while(a_xfer->status == E_TWI_XFER_PENDING) {
+		sleep_enable();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		twi_check_timeout();
+		cli();
+	}
+	sei();
+
+	TWI_STAT_ADD(wait_us, hal_time_us() - start);
+
+	return a_xfer->status;
+}
+
+unsigned char twi_busy(void) {
+
+	return (g_twi_head != 0);
+}
+
+/**
+ * @brief Complete the chained transactions at the head of the queue as failed
+ *
+ * @param a_twsr TWSR value of the failed transaction
+ *
+ */
+static void twi_fail_chain(unsigned char a_twsr) {
+
+	twi_xfer* xfer;
+
+	while(g_twi_head && g_twi_head->chain) {
+
+		xfer = g_twi_head;
+		g_twi_head = xfer->next;
+
+		xfer->twsr = a_twsr;
+		xfer->status = E_TWI_XFER_ERROR;
+
+		if(xfer->callback) {
+			xfer->callback(xfer);
+		}
+	}
+}
+
+unsigned char twi_bus_recover(void) {
+
+	unsigned char i;
+
+	//Release the pins, the bus pull-ups hold them high
+	TWCR = 0;
+	TWI_PORT &= ~(_BV(TWI_SDA) | _BV(TWI_SCL));
+	TWI_DDR &= ~(_BV(TWI_SDA) | _BV(TWI_SCL));
+
+	//Clock out the byte the slave is sending until it lets SDA go
+	for(i = 0; (i < 9) && !(TWI_PIN & _BV(TWI_SDA)); i++) {
+		TWI_DDR |= _BV(TWI_SCL);
+		_delay_us(TWI_RECOVER_HALF_US);
+		TWI_DDR &= ~_BV(TWI_SCL);
+		_delay_us(TWI_RECOVER_HALF_US);
+	}
+
+	//START then STOP, resets the slave bus logic
+	TWI_DDR |= _BV(TWI_SDA);
+	_delay_us(TWI_RECOVER_HALF_US);
+	TWI_DDR &= ~_BV(TWI_SDA);
+	_delay_us(TWI_RECOVER_HALF_US);
+
+	TWCR = _BV(TWEN);
+
+	return (TWI_PIN & _BV(TWI_SDA)) != 0;
+}
+
+unsigned char twi_check_timeout(void) {
+
+	twi_xfer* xfer;
+	unsigned char sreg = SREG;
+
+	cli();
+
+	xfer = g_twi_head;
+
+	if((xfer == 0) || ((hal_time_us() - g_twi_head_us) <= TWI_TIMEOUT_US)) {
+		SREG = sreg;
+		return 0;
+	}
+
+	//Drop the transaction and free the bus
+	twi_bus_recover();
+	TWI_STAT_ADD(timeouts, 1);
+
+	g_twi_head = xfer->next;
+	xfer->twsr = TWI_TWSR_TIMEOUT;
+	xfer->status = E_TWI_XFER_ERROR;
+	twi_fail_chain(TWI_TWSR_TIMEOUT);
+
+	if(g_twi_head) {
+		g_twi_head_us = hal_time_us();
+		TWCR = TWI_CR_START;
+	}
+
+	//Callbacks run with interrupts disabled, as from TWI_vect
+	if(xfer->callback) {
+		xfer->callback(xfer);
+	}
+
+	SREG = sreg;
+
+	return 1;
+}
+
+#ifdef TWI_STATS
+void twi_stats_get(twi_stats* a_stats_p) {
+
+	unsigned char sreg = SREG;
+
+	cli();
+	*a_stats_p = g_twi_stats;
+	SREG = sreg;
+}
+
+void twi_stats_reset(void) {
+
+	unsigned char sreg = SREG;
+
+	cli();
+	memset(&g_twi_stats, 0, sizeof(g_twi_stats));
+	g_twi_trace_tail = g_twi_trace_head;
+	SREG = sreg;
+}
+
+unsigned char twi_trace_read(twi_trace* a_trace_p, unsigned char a_max_num) {
+
+	unsigned char i;
+	unsigned char sreg = SREG;
+
+	cli();
+
+	for(i = 0; (i < a_max_num) && (g_twi_trace_tail != g_twi_trace_head); i++) {
+		a_trace_p[i] = g_twi_trace[g_twi_trace_tail++ & (TWI_TRACE_SIZE - 1)];
+	}
+
+	SREG = sreg;
+
+	return i;
+}
+
+/**
+ * @brief Count a finished transaction and append it to the trace
+ *
+ * @param a_xfer a transaction descriptor
+ * @param a_status a transaction status
+ *
+ */
+static void twi_stats_complete(twi_xfer* a_xfer, unsigned char a_status) {
+
+	unsigned long now = hal_time_us();
+	twi_trace* trace = &g_twi_trace[g_twi_trace_head++ & (TWI_TRACE_SIZE - 1)];
+
+	//Full, drop the oldest entry
+	if((unsigned char)(g_twi_trace_head - g_twi_trace_tail) > TWI_TRACE_SIZE) {
+		g_twi_trace_tail++;
+	}
+
+	trace->time_us = g_twi_start_us;
+	trace->duration_us = now - g_twi_start_us;
+	trace->sla = a_xfer->sla;
+	trace->write_len = a_xfer->write_len;
+	trace->read_len = a_xfer->read_len;
+	trace->status = a_status;
+
+	g_twi_stats.transactions++;
+	g_twi_stats.stops++;
+	g_twi_stats.bus_us += now - g_twi_start_us;
+}
+#endif
+
+/**
+ * @brief Finish the current transaction and start the next queued one
+ *
+ * @param a_status a transaction status
+ *
+ */
+static void twi_complete(unsigned char a_status) {
+
+	twi_xfer* xfer = g_twi_head;
+
+	xfer->twsr = TW_STATUS;
+	g_twi_head = xfer->next;
+
+#ifdef TWI_STATS
+	twi_stats_complete(xfer, a_status);
+#endif
+
+	xfer->status = a_status;
+
+	//Fail the transactions depending on a failed one
+	if(a_status == E_TWI_XFER_ERROR) {
+		twi_fail_chain(xfer->twsr);
+	}
+
+	//STOP, followed by a START when more work is queued
+	if(g_twi_head) {
+		g_twi_head_us = hal_time_us();
+		TWCR = TWI_CR_STOP | _BV(TWIE) | _BV(TWSTA);
+	}
+	else {
+		TWCR = TWI_CR_STOP;
+	}
+
+	if(xfer->callback) {
+		xfer->callback(xfer);
+	}
+}
+
+ISR(TWI_vect) {
+
+	twi_xfer* xfer = g_twi_head;
+
+	switch(TW_STATUS) {
+	case TW_START:
+		g_twi_index = 0;
+#ifdef TWI_STATS
+		g_twi_start_us = hal_time_us();
+#endif
+		TWI_STAT_ADD(starts, 1);
+		TWI_STAT_ADD(bytes, 1);
+		//Skip the write phase of read only transactions
+		if(xfer->write_len) {
+			TWDR = xfer->sla;
+		}
+		else {
+			TWDR = xfer->sla | TW_READ;
+		}
+		TWCR = TWI_CR_GO;
+		break;
+
+	case TW_REP_START:
+		TWI_STAT_ADD(starts, 1);
+		TWI_STAT_ADD(bytes, 1);
+		TWDR = xfer->sla | TW_READ;
+		TWCR = TWI_CR_GO;
+		break;
+
+	case TW_MT_SLA_ACK:
+	case TW_MT_DATA_ACK:
+		if(g_twi_index < xfer->write_len) {
+			TWDR = xfer->write_buf[g_twi_index++];
+			TWI_STAT_ADD(bytes, 1);
+			TWCR = TWI_CR_GO;
+		}
+		else if(xfer->read_len) {
+			TWCR = TWI_CR_START;
+		}
+		else {
+			twi_complete(E_TWI_XFER_DONE);
+		}
+		break;
+
+	case TW_MR_SLA_ACK:
+		g_twi_index = 0;
+		//Acknowledge every byte but the last one
+		if(xfer->read_len > 1) {
+			TWCR = TWI_CR_GO | _BV(TWEA);
+		}
+		else {
+			TWCR = TWI_CR_GO;
+		}
+		break;
+
+	case TW_MR_DATA_ACK:
+		xfer->read_buf[g_twi_index++] = TWDR;
+		TWI_STAT_ADD(bytes, 1);
+		if(g_twi_index < (xfer->read_len - 1)) {
+			TWCR = TWI_CR_GO | _BV(TWEA);
+		}
+		else {
+			TWCR = TWI_CR_GO;
+		}
+		break;
+
+	case TW_MR_DATA_NACK:
+		xfer->read_buf[g_twi_index] = TWDR;
+		TWI_STAT_ADD(bytes, 1);
+		twi_complete(E_TWI_XFER_DONE);
+		break;
+
+	default:
+		//NACK, arbitration lost or bus error
+#ifdef TWI_STATS
+		if((TW_STATUS == TW_MT_SLA_NACK) || (TW_STATUS == TW_MT_DATA_NACK) || (TW_STATUS == TW_MR_SLA_NACK)) {
+			g_twi_stats.nacks++;
+		}
+#endif
+		twi_complete(E_TWI_XFER_ERROR);
+		break;
+	}
+}
@@ -39,6 +39,14 @@
 #define SLA_W 0x1a
 #define SLA_R 0x1b
 
+/* twsr of a transaction aborted by twi_check_timeout, TWSR codes are multiples of 8 */
+#define TWI_TWSR_TIMEOUT 0x01
+
+/* Max bus time of a transaction before it is aborted and the bus recovered */
+#ifndef TWI_TIMEOUT_US
+#define TWI_TIMEOUT_US 5000UL
+#endif
+
 /**
  * @brief general TWI interface initialization
  *
@@ -48,16 +56,18 @@
 void twi_init(uint8_t a_freq);
 
 /**
- * @brief Wait for TWI interrupt flag
+ * @brief Wait for TWI interrupt flag, at most TWI_TIMEOUT_US
  * @param none.
  *
+ * @return 1 when the flag is set, 0 on timeout
  */
-void twi_wait_interrupt(void);
+unsigned char twi_wait_interrupt(void);
 
 /**
  * @brief Send TWI start condition
  * @param none.
  *
+ * @return TWI_SUCCESS, the TWSR value or TWI_TWSR_TIMEOUT
  */
 unsigned char twi_send_start(void);
 
@@ -72,16 +82,217 @@ void twi_send_stop(void);
  * @brief Send TWI address
  * @param adr a data address.
  *
+ * @return TWI_SUCCESS, the TWSR value or TWI_TWSR_TIMEOUT
  */
-char twi_send_address(unsigned char adr);
+unsigned char twi_send_address(unsigned char adr);
 
 /**
  * @brief Send TWI byte
  * @param data a data byte.
  *
+ * @return TWI_SUCCESS, the TWSR value or TWI_TWSR_TIMEOUT
  */
 unsigned char twi_send_byte(unsigned char data);
 
+/**
+ * @brief TWI transaction status
+ */
+typedef enum _e_twi_xfer_status {
+
+	E_TWI_XFER_IDLE = 0x00,
+	E_TWI_XFER_PENDING,
+	E_TWI_XFER_DONE,
+	E_TWI_XFER_ERROR
+
+} e_twi_xfer_status;
+
+typedef struct _twi_xfer twi_xfer;
+
+/**
+ * @brief Transaction completion callback, called from TWI_vect context
+ */
+typedef void (*twi_xfer_callback)(twi_xfer* a_xfer);
+
+/**
+ * @brief TWI transaction descriptor
+ *
+ * A transaction is START, SLA+W and write_len bytes from write_buf, then
+ * (if read_len is not zero) REPEATED START, SLA+R and read_len bytes into
+ * read_buf, then STOP. With write_len zero the write phase is skipped.
+ * A chained transaction depends on the one queued before it, e.g. a mux
+ * channel select, and is not sent when that one failed.
+ * The descriptor and both buffers must stay valid until status leaves
+ * E_TWI_XFER_PENDING.
+ */
+struct _twi_xfer {
+
+	// slave address + write bit
+	unsigned char sla;
+
+	// bytes to be sent
+	const unsigned char* write_buf;
+	unsigned char write_len;
+
+	// bytes to be received
+	unsigned char* read_buf;
+	unsigned char read_len;
+
+	// completion callback, may be NULL
+	twi_xfer_callback callback;
+
+	// 1 to fail at once, without bus activity, when the transaction queued before it failed
+	unsigned char chain;
+
+	// transaction status
+	volatile unsigned char status;
+
+	// TWSR value of the failed bus state, TWI_TWSR_TIMEOUT when aborted
+	unsigned char twsr;
+
+	// next queued transaction
+	twi_xfer* next;
+};
+
+/**
+ * @brief Queue a TWI transaction, returns immediately
+ *
+ * @param a_xfer a transaction descriptor
+ *
+ */
+void twi_submit(twi_xfer* a_xfer);
+
+/**
+ * @brief Queue a TWI transaction and sleep until it is completed
+ *
+ * A transaction stuck on the bus is aborted after TWI_TIMEOUT_US.
+ *
+ * @param a_xfer a transaction descriptor
+ *
+ * @return E_TWI_XFER_DONE or E_TWI_XFER_ERROR
+ */
+unsigned char twi_transfer(twi_xfer* a_xfer);
+
+/**
+ * @brief Check if the transaction engine has queued work
+ * @param none.
+ *
+ */
+unsigned char twi_busy(void);
+
+/**
+ * @brief Abort the transaction on the bus once it took longer than TWI_TIMEOUT_US
+ *
+ * A slave holding SDA low or a lost interrupt leaves the engine waiting
+ * forever. The transaction is completed with E_TWI_XFER_ERROR and
+ * TWI_TWSR_TIMEOUT, the bus recovered and the queue restarted. Call it
+ * from the main loop while transactions are pending.
+ *
+ * @param none.
+ *
+ * @return 1 when a transaction was aborted
+ */
+unsigned char twi_check_timeout(void);
+
+/**
+ * @brief Free a bus held by a slave
+ *
+ * Clocks SCL until the slave releases SDA, at most 9 times, then sends a
+ * STOP and enables the TWI peripheral again.
+ *
+ * @param none.
+ *
+ * @return 1 when SDA is released
+ */
+unsigned char twi_bus_recover(void);
+
+/**
+ * @brief Bus instrumentation, built only with TWI_STATS defined
+ *
+ * The counters and the trace are updated from TWI_vect, without
+ * TWI_STATS neither the code nor the data is compiled in.
+ */
+#ifdef TWI_STATS
+
+/* Trace entries, a power of 2 */
+#ifndef TWI_TRACE_SIZE
+#define TWI_TRACE_SIZE 16
+#endif
+
+/**
+ * @brief Completed transaction
+ */
+typedef struct _twi_trace {
+
+	// time of the START and bus time in microseconds
+	unsigned long time_us;
+	unsigned int duration_us;
+
+	// slave address + write bit and phase sizes
+	unsigned char sla;
+	unsigned char write_len;
+	unsigned char read_len;
+
+	// E_TWI_XFER_DONE or E_TWI_XFER_ERROR
+	unsigned char status;
+
+} twi_trace;
+
+/**
+ * @brief Bus counters since the last twi_stats_reset
+ */
+typedef struct _twi_stats {
+
+	// completed and failed transactions
+	unsigned long transactions;
+
+	// bytes on the wire, address bytes included
+	unsigned long bytes;
+
+	// START and REPEATED START, STOP conditions
+	unsigned long starts;
+	unsigned long stops;
+
+	// address or data bytes not acknowledged
+	unsigned long nacks;
+
+	// transactions aborted by twi_check_timeout
+	unsigned long timeouts;
+
+	// time with a transaction on the bus
+	unsigned long bus_us;
+
+	// time the CPU spent blocked in twi_wait_interrupt and twi_transfer
+	unsigned long wait_us;
+
+} twi_stats;
+
+/**
+ * @brief Copy the counters
+ *
+ * @param a_stats_p a counters buffer
+ *
+ */
+void twi_stats_get(twi_stats* a_stats_p);
+
+/**
+ * @brief Clear the counters and the trace
+ * @param none.
+ *
+ */
+void twi_stats_reset(void);
+
+/**
+ * @brief Take the oldest trace entries, older ones are overwritten when the trace is full
+ *
+ * @param a_trace_p a trace buffer
+ * @param a_max_num a trace buffer size
+ *
+ * @return number of entries copied
+ */
+unsigned char twi_trace_read(twi_trace* a_trace_p, unsigned char a_max_num);
+
+#endif
+
 
 #endif /* end of include guard: TWI_H_V8WDZFBC */
 